@@ -1,7 +1,13 @@
-#include <iostream>         // cout, cerr
 #include <vector>
 #include <cmath>
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstring>          // strcmp
+#include <algorithm>        // min
+#include <cstddef>          // offsetof
+#include <chrono>           // benchmark timing
+#include <memory>
+#include <thread>
+#include <atomic>
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 #define STB_IMAGE_IMPLEMENTATION
@@ -14,6 +20,29 @@
 #include <vector>
 #include <cmath>
 #include "camera.h" // Camera class
+#include "transform.h" // Cached object transforms
+#include "jobsystem.h" // Worker threads for per-frame CPU work
+#include "culling.h" // Frustum culling helpers
+#include "framepacket.h" // Simulation to render thread hand-off
+#include "vertexformat.h" // Compact vertex layouts
+#include "meshoptimize.h" // Vertex cache and overdraw optimization
+#include "fileio.h" // Atomic file writes and output directories
+#include "meshcache.h" // Memory-mapped binary mesh files
+#include "meshimport.h" // OBJ and glTF loading
+#include "meshgen.h" // Allocation-free cylinder and sphere kernels
+#include "ringbuffer.h" // Persistently mapped per-frame buffers
+#include "framepacing.h" // Frame rate cap, frames in flight and latency measurement
+#include "capture.h" // Asynchronous framebuffer readback to PNG or raw files
+#include "imagediff.h" // Perceptual image comparison for the regression test
+#include "softraster.h" // Tile-based CPU rasterizer for machines without a GPU
+#include "phong.h" // SIMD Phong shading of fragment batches
+#include "lightmap.h" // Baked ambient and diffuse lighting of the static scene
+#include "shadow.h" // Cached point light shadow cube maps
+#include "occlusion.h" // CPU hierarchical depth buffer for occlusion culling
+#include "bvh.h" // Bounding volume hierarchy over the scene objects
+#include "picking.h" // Ray casts against meshes for mouse picking
+#include "inputqueue.h" // Lock-free queue of input events from the GLFW callbacks
+#include "logger.h"     // Asynchronous logging
 
 using namespace std; // Standard namespace
 
@@ -21,6 +50,7 @@ using namespace std; // Standard namespace
 #ifndef GLSL
 #define GLSL(Version, Source) "#version " #Version " core \n" #Source
 #endif
+#define GLSL_DECLARATIONS(Source) #Source "\n"
 
 // Unnamed namespace
 namespace
@@ -38,6 +68,38 @@ namespace
         GLuint vbo;         // Handle for the vertex buffer object
         GLuint ebo;
         GLuint nVertices;    // Number of indices of the mesh
+        glm::vec3 boundsMin; // Local space bounding box
+        glm::vec3 boundsMax;
+        VertexFormat format; // Layout of the vertex buffer
+        GLenum indexType;    // GL_UNSIGNED_SHORT when every index fits in 16 bits, GL_UNSIGNED_INT otherwise
+        const RasterMesh* raster; // CPU copy of the geometry for the software rasterizer and the lightmap baker
+        GLuint lightmapVbo;  // lightmap texture coordinates (attribute 3), 0 when the mesh is not lightmapped
+        const PickMesh* pick; // positions and triangle BVH for mouse picking, nullptr when the mesh can't be picked
+    };
+
+    // CPU side mesh data: position, normal and texture coordinate interleaved, plus triangle indices
+    struct MeshData
+    {
+        static const int FLOATS_PER_VERTEX = 8;
+        std::vector<GLfloat> vertices;
+        std::vector<GLuint> indices;
+    };
+
+    // A drawable object in the scene: which mesh and texture to use and where its transform is stored
+    struct SceneObject
+    {
+        const GLMesh* mesh;
+        GLuint texture;
+        TransformHandle transform;
+        bool dynamic = false;   // moves every frame: drawn into the shadow maps each frame instead of the cached static maps
+    };
+
+    // One visible object of the current frame, produced by the culling jobs
+    struct DrawItem
+    {
+        const GLMesh* mesh;
+        GLuint texture;
+        glm::mat4 model;
     };
 
     // Main GLFW window
@@ -54,6 +116,146 @@ namespace
     GLMesh gMeshCylinderTop; // battery top face (for different texture)
     GLMesh gMeshCylinderCathode; // battery top cylinder terminal
     GLMesh gMeshSphere; // basic cube
+    GLMesh gMeshImported; // model loaded with --import
+    bool gHasImportedMesh = false;
+
+    // Object transforms (world matrices are cached and only rebuilt when something moves)
+    TransformHierarchy gTransforms;
+    std::vector<SceneObject> gSceneObjects;
+
+    // Transform updates, culling and draw list building are spread across these threads
+    std::unique_ptr<JobSystem> gJobs;
+
+    // World bounds of gSceneObjects, refit when objects move; used for frustum culling (main thread only)
+    BVH gSceneBVH;
+    const float BVH_REBUILD_COST_RATIO = 1.5f; // rebuild once refitting made the tree this much more expensive
+
+    // Mouse picking: the left button selects the object under the crosshair
+    std::deque<PickMesh> gPickMeshes;           // referenced by GLMesh::pick
+    int gSelectedObject = -1;                   // index into gSceneObjects, -1 when nothing is selected
+
+    // Immutable snapshot of everything needed to draw one frame, built by the simulation (main) thread
+    struct FramePacket
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec3 viewPosition;
+        glm::vec3 lightPositions[3];
+        glm::vec3 lightColors[3];
+        int framebufferWidth;
+        int framebufferHeight;
+        double inputTime; // glfwGetTime() when the input this frame reflects was polled
+        bool capture;     // read this frame back and write it to disk
+        std::vector<DrawItem> drawItems;
+        bool staticCastersChanged;              // staticCasters is filled: a static object moved (or first frame)
+        std::vector<DrawItem> staticCasters;    // every static object, for the cached shadow maps
+        std::vector<DrawItem> dynamicCasters;   // every dynamic object, drawn into the shadow maps each frame
+    };
+
+    // Per-frame constants as seen by the shaders (std140 uniform block FrameData in frameDataShaderSource)
+    struct FrameUniforms
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec4 viewPosition;
+        glm::vec4 lightPositions[3];
+        glm::vec4 lightColors[3];
+        glm::vec4 objectColor;
+        glm::vec4 uvScale;
+    };
+
+    // Per-object data as seen by the vertex shaders (std430 storage buffer ObjectBuffer in objectDataShaderSource),
+    // indexed by uObjectIndex
+    struct ObjectUniforms
+    {
+        glm::mat4 model;
+        glm::vec4 positionOffset; // bounds minimum for quantized positions, 0 otherwise
+        glm::vec4 positionScale;  // bounds extent for quantized positions, 1 otherwise
+    };
+
+    const GLuint FRAME_DATA_BINDING = 0;
+    const GLuint OBJECT_DATA_BINDING = 1;
+
+    // Frame and object data for the frames in flight; created and used by the render thread only
+    PersistentRingBuffer gFrameRing;
+
+    // Frame pacing: fewer frames in flight and a lower swap interval cut latency, more frames raise throughput
+    int gSwapInterval = 1;                      // vblanks per buffer swap, 0 = no vsync, -1 = adaptive vsync
+    int gMaxFramesInFlight = 2;                 // frames the GPU may queue before the render thread waits
+    FrameLimiter gFrameLimiter;                 // optional frame rate cap on the main loop
+    FramePacer gFramePacer;                     // render thread only
+    FILE* gLatencyLog = nullptr;                // per-frame latencies as CSV, render thread only
+
+    // Frame capture: F12 saves the next frame, F11 starts/stops writing every frame
+    FrameCapture gCapture;                      // render thread only
+    CaptureFormat gCaptureFormat = CAPTURE_FORMAT_PNG;
+    const char* gCaptureDirectory = "captures";
+    bool gCaptureScreenshot = false;            // main thread
+    bool gCaptureRecording = false;             // main thread
+
+    // Rendering regression test: fixed viewpoints rendered offscreen and compared against reference images.
+    // The references depend on the GPU and driver, so they are not part of the repository: record them once
+    // on a known good build with --regression-record, then --regression-test compares against them.
+    struct RegressionView
+    {
+        const char* name;
+        glm::vec3 position;
+        float yaw;
+        float pitch;
+        bool perspective;
+    };
+    const RegressionView REGRESSION_VIEWS[] = {
+        { "front", glm::vec3(0.0f, 0.0f, 5.0f), -90.0f, 0.0f, true },
+        { "left", glm::vec3(-5.0f, 2.0f, 4.0f), -40.0f, -20.0f, true },
+        { "right", glm::vec3(5.0f, 1.5f, 4.0f), -130.0f, -15.0f, true },
+        { "top", glm::vec3(0.0f, 6.0f, 0.5f), -90.0f, -85.0f, true },
+        { "ortho", glm::vec3(0.0f, 0.0f, 5.0f), -90.0f, 0.0f, false },
+    };
+    const char* REGRESSION_DIRECTORY = "regression";
+    const unsigned REGRESSION_TOLERANCE = 8;              // PixelDistance a pixel may differ by without counting
+    const double REGRESSION_MAX_DIFFERING = 0.001;        // fraction of pixels allowed over the tolerance
+    const int REGRESSION_TIMED_FRAMES = 30;
+
+    // Software rendering (--software): no window or GL context, meshes and textures are kept on the CPU
+    bool gSoftwareRendering = false;
+    std::deque<RasterMesh> gRasterMeshes;       // referenced by GLMesh::raster
+    std::vector<RasterTexture> gRasterTextures; // texture id N is gRasterTextures[N - 1]
+
+    // Baked lighting (--lightmap): ambient and diffuse light of the static objects come from an atlas that is
+    // baked on the first run and cached next to the meshes; specular is still computed per fragment
+    bool gLightmapping = false;
+    LightmapSettings gLightmapSettings = { 16.0f, 2048, 0, 0.75f, 0 }; // --lightmap-ao <rays> enables ambient occlusion
+    const GLint LIGHTMAP_TEXTURE_UNIT = 1;
+    GLuint gLightmapTexture = 0;
+    glm::vec3 gLightmapLampPosition;            // where the first lamp was when the lightmap was baked
+    std::deque<GLMesh> gLightmapMeshes;         // per-object mesh copies with lightmap coordinates
+
+    // Point light shadows (--shadows): cube maps of the static objects are cached until a light or a static object
+    // moves, dynamic objects are drawn on top every frame
+    bool gShadowsEnabled = false;
+    int gShadowMapSize = 1024;                  // --shadow-size
+    const float SHADOW_FAR_PLANE = 50.0f;
+    const GLint SHADOW_TEXTURE_UNIT = 2;        // units 2 to 4, one per light
+    bool gStaticCastersSent = false;            // main thread: the render thread has received the static casters
+    PointShadowMaps gShadowMaps;                // render thread only
+    std::vector<DrawItem> gStaticCasters;       // render thread only
+
+    // Occlusion culling (--occlusion-culling): the objects covering most of the screen are rasterized into a small
+    // CPU depth buffer and objects whose bounds are hidden behind them are dropped from the draw list
+    bool gOcclusionCulling = false;
+    OcclusionBuffer gOcclusionBuffer;           // main thread only
+    const int OCCLUSION_BUFFER_WIDTH = 256;     // the height follows the framebuffer aspect ratio
+    const int MAX_OCCLUDERS = 8;
+    const float MIN_OCCLUDER_COVERAGE = 0.01f;  // fraction of the screen an object's bounds must cover to occlude
+    size_t gOcclusionTested = 0;                // objects tested and culled since the last report
+    size_t gOcclusionCulled = 0;
+
+    // The render thread owns the GL context once the scene is loaded and draws the packets it receives
+    FramePacketBuffer<FramePacket> gFramePackets;
+    std::thread gRenderThread;
+    std::atomic<bool> gRenderFailed{ false };  // set by the render thread when it can't go on; closes the window
+    int gFramebufferWidth = WINDOW_WIDTH;   // updated by the resize callback on the main thread
+    int gFramebufferHeight = WINDOW_HEIGHT;
 
     // Texture
     GLuint gTexture1;
@@ -67,20 +269,40 @@ namespace
     glm::vec2 gUVScale(1.0f, 1.0f);
     GLint gTexWrapMode = GL_REPEAT;
 
+    // Layout used when uploading meshes (--vertex-format full|compact|quantized)
+    VertexFormat gVertexFormat = VERTEX_FORMAT_FULL;
+    const char* const VERTEX_FORMAT_NAMES[] = { "full", "compact", "quantized" };
+
+    // Generated meshes are stored here after the first run and mapped from disk afterwards (--no-mesh-cache disables)
+    const char* const MESH_CACHE_DIRECTORY = "meshcache";
+    bool gUseMeshCache = true;
+
     // Shader program
     GLuint gCubeProgramId;
+    GLuint gCompactProgramId; // same lighting as gCubeProgramId, decodes compact vertices
     GLuint gLampProgramId;
+    GLuint gLightmapProgramId;        // baked ambient and diffuse, per fragment specular
+    GLuint gCompactLightmapProgramId;
+    GLuint gShadowProgramId;          // writes light distances into the shadow cube maps
 
     // camera
     Camera gCamera(glm::vec3(0.0f, 0.0f, 5.0f));
+    Camera gRenderCamera;   // gCamera interpolated for the last frame built; keeps its matrices while nothing moves
     float gLastX = WINDOW_WIDTH / 2.0f;
     float gLastY = WINDOW_HEIGHT / 2.0f;
     bool gFirstMouse = true;
     bool isPerspective = true; // True for perspective projection, false for orthographic
 
-    // timing
-    float gDeltaTime = 0.0f; // time between current frame and last frame
-    float gLastFrame = 0.0f;
+    // input: the GLFW callbacks queue events, UProcessInput applies them once per frame
+    SPSCQueue<InputEvent, 1024> gInputEvents;
+    bool gKeysDown[GLFW_KEY_LAST + 1] = {};     // held keys as of the last drained event
+
+    // timing: the simulation advances in fixed steps, rendering interpolates between the last two steps
+    const double SIMULATION_STEP = 1.0 / 60.0;  // seconds simulated per update
+    const int MAX_SIMULATION_STEPS = 8;         // per frame, so a long stall doesn't snowball
+    double gLastFrame = 0.0;
+    double gSimulationAccumulator = 0.0;        // real time not yet simulated
+    float gRenderAlpha = 0.0f;                  // how far rendering is between the previous and current step
 
     // Subject position and scale
     glm::vec3 gCubePosition(0.0f, 0.0f, 0.0f);
@@ -100,6 +322,18 @@ namespace
 
     // Lamp animation
     bool gIsLampOrbiting = false;
+    const float LAMP_ORBIT_SPEED = glm::radians(45.0f); // radians per second
+
+    // Toy ball animation (--rolling-ball): rolls back and forth along z, so it is a dynamic shadow caster
+    bool gIsBallRolling = false;
+    TransformHandle gBallTransform = INVALID_TRANSFORM;
+    float gBallPhase = 0.0f;
+    const float BALL_ROLL_SPEED = 1.0f;     // radians of phase per second
+    const float BALL_RADIUS = 0.6f;
+
+    // Simulated state at the start of the current step, used to interpolate rendering
+    glm::vec3 gPreviousCameraPosition;
+    glm::vec3 gPreviousLightPosition;
 }
 
 /* User-defined Function prototypes to:
@@ -109,22 +343,97 @@ namespace
  */
 bool UInitialize(int, char* [], GLFWwindow** window);
 void UResizeWindow(GLFWwindow* window, int width, int height);
+void UKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void UProcessInput(GLFWwindow* window);
+void USimulate(GLFWwindow* window, float step);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void UBuildMeshCube(MeshData& data);
+void UBuildMeshPlane(MeshData& data);
+void UBuildMeshPyramid(MeshData& data);
+void UBuildMeshCylinder(MeshData& data);
+void UBuildMeshSphere(MeshData& data, int sectorCount = 24, int stackCount = 12);
+void UComputeMeshBounds(const MeshData& data, glm::vec3& boundsMin, glm::vec3& boundsMax);
+void UOptimizeMesh(MeshData& data, const char* name);
+void UEncodeMesh(const MeshData& data, VertexFormat format, MeshFileHeader& header, std::vector<unsigned char>& vertexBytes, std::vector<unsigned char>& indexBytes);
+void UUploadMesh(GLMesh& mesh, const MeshFileHeader& header, const void* vertices, const void* indices);
+void UCreateMesh(GLMesh& mesh, const MeshData& data, VertexFormat format);
+void UCreateMeshCached(GLMesh& mesh, const char* name, void (*build)(MeshData& data));
+void UCreatePickMesh(GLMesh& mesh, const void* vertices, size_t vertexCount, VertexFormat format, const void* indices, size_t indexSize, size_t indexCount);
+glm::mat4 UDequantizeMatrix(const GLMesh& mesh);
 void UCreateMeshCube(GLMesh& mesh);
 void UCreateMeshPlane(GLMesh& mesh);
 void UCreateMeshPyramid(GLMesh& mesh);
 void UCreateMeshCylinder(GLMesh& mesh);
 void UCreateMeshSphere(GLMesh& mesh);
+void UCreateMeshSphereMapped(GLMesh& mesh, int sectorCount, int stackCount);
+bool UImportMesh(GLMesh& mesh, const char* path);
 void UDestroyMesh(GLMesh& mesh);
 bool UCreateTexture(const char* filename, GLuint& textureId);
 void UDestroyTexture(GLuint textureId);
-void URender();
-void renderObject(const GLMesh& mesh, const glm::mat4& model, GLuint textureID, GLint modelLoc);
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+void UCreateScene();
+void UUpdateTransforms(JobSystem& jobs, TransformHierarchy& transforms);
+void UBuildDrawList(JobSystem& jobs, const std::vector<SceneObject>& objects, const TransformHierarchy& transforms, BVH& bvh, const Frustum& frustum, std::vector<DrawItem>& drawList);
+void UCullOccluded(const glm::mat4& viewProjection, int viewportWidth, int viewportHeight, std::vector<DrawItem>& drawList);
+glm::mat4 UProjectionMatrix();
+void UBuildFramePacket(FramePacket& packet);
+void UViewRay(float ndcX, float ndcY, const glm::mat4& viewProjection, glm::vec3& origin, glm::vec3& direction);
+int URaycastScene(const std::vector<SceneObject>& objects, const TransformHierarchy& transforms, const BVH& bvh, const glm::vec3& origin, const glm::vec3& direction, float& distance);
+void UPickObject();
+void URenderThread();
+void URender(const FramePacket& packet);
+ObjectUniforms* UBeginFrameData(const FrameUniforms& frame, size_t objectCount);
+void renderObject(const GLMesh& mesh, GLint objectIndex, GLuint textureID, GLint objectIndexLoc);
+void UShaderSource(GLuint shaderId, const char* source, bool objectData);
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId, const char* geomShaderSource = nullptr);
 void UDestroyShaderProgram(GLuint programId);
+void UBenchmarkTransforms(int objectCount);
+void UBenchmarkJobs(int objectCount);
+void UBenchmarkPhong(int fragmentCount);
+void UBenchmarkBVH(int objectCount);
+void UBenchmarkPicking(int trianglesPerMesh);
+void UBenchmarkVertexFormats();
+void UBenchmarkGenerators();
+bool URunRegressionTest(bool record);
+void UCreateRasterMesh(GLMesh& mesh, const MeshData& data);
+const RasterMesh* UKeepMeshData(const MeshData& data);
+bool UBakeLightmap();
+bool URenderSoftware(int frameCount, const char* outputPath);
+bool UHasArgument(int argc, char* argv[], const char* name);
+const char* UGetArgument(int argc, char* argv[], const char* name);
+
+
+/* Shared declarations, inserted after the #version line of every shader by UShaderSource: per-frame constants and
+ * per-object data, written by the CPU into a persistently mapped ring buffer. They have to match FrameUniforms and
+ * ObjectUniforms byte for byte. */
+const GLchar* frameDataShaderSource = GLSL_DECLARATIONS(
+layout(std140, binding = 0) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+    vec4 lightPos[3];
+    vec4 lightColor[3];
+    vec4 objectColor;
+    vec4 uvScale;
+};
+);
+
+// vertex shaders only; the object data is not read in later stages
+const GLchar* objectDataShaderSource = GLSL_DECLARATIONS(
+struct ObjectData
+{
+    mat4 model;
+    vec4 positionOffset; // bounds minimum for quantized positions, 0 otherwise
+    vec4 positionScale; // bounds extent for quantized positions, 1 otherwise
+};
+layout(std430, binding = 1) readonly buffer ObjectBuffer
+{
+    ObjectData objects[];
+};
+uniform int uObjectIndex; // which entry of objects[] is being drawn
+);
 
 
 /* Cube Vertex Shader Source Code*/
@@ -133,24 +442,23 @@ const GLchar* cubeVertexShaderSource = GLSL(440,
     layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
 layout(location = 1) in vec3 normal; // VAP position 1 for normals
 layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in vec2 lightmapCoordinate; // only enabled for lightmapped meshes
 
 out vec3 vertexNormal; // For outgoing normals to fragment shader
 out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
 out vec2 vertexTextureCoordinate;
-
-//Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+out vec2 vertexLightmapCoordinate;
 
 void main()
 {
+    mat4 model = objects[uObjectIndex].model;
     gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
 
     vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
 
     vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
     vertexTextureCoordinate = textureCoordinate;
+    vertexLightmapCoordinate = lightmapCoordinate;
 }
 );
 
@@ -164,13 +472,18 @@ in vec2 vertexTextureCoordinate;
 
 out vec4 fragmentColor; // For outgoing cube color to the GPU
 
-// Uniform / Global variables for object color, light colors, light positions, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 lightColor[3]; // Array to hold multiple light colors
-uniform vec3 lightPos[3]; // Array to hold multiple light positions
-uniform vec3 viewPosition;
 uniform sampler2D uTexture; // Useful when working with multiple textures
-uniform vec2 uvScale;
+uniform samplerCubeShadow uShadowMaps[3]; // distance to the nearest caster around each light
+uniform float uShadowFarPlane; // 0 when shadows are off
+
+// 1 where light i reaches the fragment, 0 in its shadow; the lookup is pushed along the normal against acne
+float shadow(int i, vec3 norm)
+{
+    if (uShadowFarPlane <= 0.0)
+        return 1.0;
+    vec3 toFragment = vertexFragmentPos + norm * 0.02 - lightPos[i].xyz;
+    return texture(uShadowMaps[i], vec4(toFragment, length(toFragment) / uShadowFarPlane - 0.0005));
+}
 
 void main()
 {
@@ -182,26 +495,27 @@ void main()
 
     for (int i = 0; i < 3; ++i) { // Loop through each light source
         // Calculate Ambient lighting
-        ambient += ambientStrength * lightColor[i]; // Generate ambient light color for each light
+        ambient += ambientStrength * lightColor[i].rgb; // Generate ambient light color for each light
 
         // Calculate Diffuse lighting
         vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-        vec3 lightDirection = normalize(lightPos[i] - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
+        vec3 lightDirection = normalize(lightPos[i].xyz - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
         float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-        diffuse += impact * lightColor[i]; // Generate diffuse light color for each light
+        float lit = shadow(i, norm); // Diffuse and specular are blocked by shadow casters
+        diffuse += lit * impact * lightColor[i].rgb; // Generate diffuse light color for each light
 
         // Calculate Specular lighting
         float specularIntensity = 0.6f; // Set specular light strength
         float highlightSize = 16.0f; // Set specular highlight size
-        vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
+        vec3 viewDir = normalize(viewPosition.xyz - vertexFragmentPos); // Calculate view direction
         vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
         // Calculate specular component for each light
         float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-        specular += specularIntensity * specularComponent * lightColor[i];
+        specular += lit * specularIntensity * specularComponent * lightColor[i].rgb;
     }
 
     // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale.xy);
 
     // Calculate phong result
     vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
@@ -211,19 +525,163 @@ void main()
 }
 );
 
+/* Lightmapped Fragment Shader Source Code (same lighting as cubeFragmentShaderSource, ambient and diffuse baked)*/
+const GLchar* lightmapFragmentShaderSource = GLSL(440,
+
+in vec3 vertexNormal; // For incoming normals
+in vec3 vertexFragmentPos; // For incoming fragment position
+in vec2 vertexTextureCoordinate;
+in vec2 vertexLightmapCoordinate;
+
+out vec4 fragmentColor; // For outgoing cube color to the GPU
+
+uniform sampler2D uTexture;
+uniform sampler2D uLightmap; // rgb: ambient + diffuse of lights 1 and 2, a: ambient + diffuse factor of light 0
+uniform vec3 uBakedLampPosition; // light 0 position the lightmap was baked with
+uniform samplerCubeShadow uShadowMaps[3]; // distance to the nearest caster around each light
+uniform float uShadowFarPlane; // 0 when shadows are off
+
+// 1 where light i reaches the fragment, 0 in its shadow; the lookup is pushed along the normal against acne
+float shadow(int i, vec3 norm)
+{
+    if (uShadowFarPlane <= 0.0)
+        return 1.0;
+    vec3 toFragment = vertexFragmentPos + norm * 0.02 - lightPos[i].xyz;
+    return texture(uShadowMaps[i], vec4(toFragment, length(toFragment) / uShadowFarPlane - 0.0005));
+}
+
+void main()
+{
+    vec4 baked = texture(uLightmap, vertexLightmapCoordinate);
+    vec3 norm = normalize(vertexNormal);
+
+    // Light 0 is the lamp that can orbit; once it has left its baked position its diffuse term is computed here.
+    // Baked terms already include the shadows of the static objects when shadows are on.
+    float lamp = baked.a;
+    if (distance(lightPos[0].xyz, uBakedLampPosition) > 0.001)
+        lamp = 0.01 + shadow(0, norm) * max(dot(norm, normalize(lightPos[0].xyz - vertexFragmentPos)), 0.0);
+    vec3 light = baked.rgb + lamp * lightColor[0].rgb;
+
+    // Specular depends on the view, so it is never baked
+    vec3 viewDir = normalize(viewPosition.xyz - vertexFragmentPos);
+    for (int i = 0; i < 3; ++i) {
+        vec3 lightDirection = normalize(lightPos[i].xyz - vertexFragmentPos);
+        vec3 reflectDir = reflect(-lightDirection, norm);
+        light += shadow(i, norm) * 0.6 * pow(max(dot(viewDir, reflectDir), 0.0), 16.0) * lightColor[i].rgb;
+    }
+
+    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale.xy);
+    fragmentColor = vec4(light * textureColor.xyz, 1.0);
+}
+);
+
+/* Shadow Caster Shader Source Code: world space triangles, fanned out to the six cube map faces by the geometry shader*/
+const GLchar* shadowVertexShaderSource = GLSL(440,
+
+    layout(location = 0) in vec3 position; // float position, or unorm16 position relative to the mesh bounds
+
+void main()
+{
+    ObjectData object = objects[uObjectIndex];
+    gl_Position = object.model * vec4(object.positionOffset.xyz + position * object.positionScale.xyz, 1.0f); // world space
+}
+);
+
+const GLchar* shadowGeometryShaderSource = GLSL(440,
+
+    layout(triangles) in;
+layout(triangle_strip, max_vertices = 18) out;
+
+uniform mat4 uFaceMatrices[6]; // light view-projection of each cube map face
+
+out vec3 fragmentWorldPos;
+
+void main()
+{
+    for (int face = 0; face < 6; ++face)
+    {
+        vec4 clip[3];
+        for (int i = 0; i < 3; ++i)
+            clip[i] = uFaceMatrices[face] * gl_in[i].gl_Position;
+
+        // Skip faces the triangle lies completely outside of
+        vec3 x = vec3(clip[0].x, clip[1].x, clip[2].x);
+        vec3 y = vec3(clip[0].y, clip[1].y, clip[2].y);
+        vec3 w = vec3(clip[0].w, clip[1].w, clip[2].w);
+        if (all(greaterThan(x, w)) || all(lessThan(x, -w)) || all(greaterThan(y, w)) || all(lessThan(y, -w)) || all(lessThan(w, vec3(0.0))))
+            continue;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            gl_Layer = face;
+            fragmentWorldPos = gl_in[i].gl_Position.xyz;
+            gl_Position = clip[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
+);
+
+const GLchar* shadowFragmentShaderSource = GLSL(440,
+
+    in vec3 fragmentWorldPos;
+
+uniform vec3 uLightPosition;
+uniform float uFarPlane;
+
+void main()
+{
+    gl_FragDepth = length(fragmentWorldPos - uLightPosition) / uFarPlane; // linear distance, compared by the receivers
+}
+);
+
+/* Compact Vertex Shader Source Code (octahedral snorm16 normals, half float UVs, optionally quantized positions)*/
+const GLchar* compactVertexShaderSource = GLSL(440,
+
+    layout(location = 0) in vec3 position; // float position, or unorm16 position relative to the mesh bounds
+layout(location = 1) in vec2 normal; // octahedral encoded normal
+layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in vec2 lightmapCoordinate; // only enabled for lightmapped meshes
+
+out vec3 vertexNormal; // For outgoing normals to fragment shader
+out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
+out vec2 vertexTextureCoordinate;
+out vec2 vertexLightmapCoordinate;
+
+// Unfolds an octahedral encoded normal back onto the unit sphere
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main()
+{
+    ObjectData object = objects[uObjectIndex];
+    mat4 model = object.model;
+    vec3 localPosition = object.positionOffset.xyz + position * object.positionScale.xyz;
+    gl_Position = projection * view * model * vec4(localPosition, 1.0f); // Transforms vertices into clip coordinates
+
+    vertexFragmentPos = vec3(model * vec4(localPosition, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+
+    vertexNormal = mat3(transpose(inverse(model))) * decodeOctahedral(normal); // get normal vectors in world space only and exclude normal translation properties
+    vertexTextureCoordinate = textureCoordinate;
+    vertexLightmapCoordinate = lightmapCoordinate;
+}
+);
+
 /* Lamp Shader Source Code*/
 const GLchar* lampVertexShaderSource = GLSL(440,
 
     layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
 
-        //Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+    gl_Position = projection * view * objects[uObjectIndex].model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
 }
 );
 
@@ -260,9 +718,97 @@ void flipImageVertically(unsigned char* image, int width, int height, int channe
 
 int main(int argc, char* argv[])
 {
-    if (!UInitialize(argc, argv, &gWindow))
+    // Benchmarks run without opening a window
+    if (argc > 1 && strcmp(argv[1], "--bench-transforms") == 0)
+    {
+        UBenchmarkTransforms(argc > 2 ? atoi(argv[2]) : 50000);
+        return EXIT_SUCCESS;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-jobs") == 0)
+    {
+        UBenchmarkJobs(argc > 2 ? atoi(argv[2]) : 200000);
+        return EXIT_SUCCESS;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-phong") == 0)
+    {
+        UBenchmarkPhong(argc > 2 ? atoi(argv[2]) : 1 << 20);
+        return EXIT_SUCCESS;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-bvh") == 0)
+    {
+        UBenchmarkBVH(argc > 2 ? atoi(argv[2]) : 1000000);
+        return EXIT_SUCCESS;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-picking") == 0)
+    {
+        UBenchmarkPicking(argc > 2 ? atoi(argv[2]) : 1 << 20);
+        return EXIT_SUCCESS;
+    }
+
+    // Frame pacing (simulation speed is unaffected); --uncapped renders as fast as possible without vsync
+    if (UHasArgument(argc, argv, "--uncapped"))
+        gSwapInterval = 0;
+    if (const char* interval = UGetArgument(argc, argv, "--swap-interval"))
+        gSwapInterval = atoi(interval);
+    if (const char* frames = UGetArgument(argc, argv, "--max-frames-in-flight"))
+        gMaxFramesInFlight = std::max(1, std::min(atoi(frames), (int)PersistentRingBuffer::FRAME_COUNT));
+    if (const char* fps = UGetArgument(argc, argv, "--fps-cap"))
+        gFrameLimiter.SetRate(atof(fps));
+    if (const char* path = UGetArgument(argc, argv, "--latency-log"))
+    {
+        gLatencyLog = fopen(path, "w");
+        if (gLatencyLog)
+            fprintf(gLatencyLog, "frame,input_to_submit_ms,input_to_gpu_done_ms\n");
+        else
+            ULOG_WARNING << "Could not open latency log " << path;
+    }
+
+    // Vertex layout used for every mesh
+    if (const char* format = UGetArgument(argc, argv, "--vertex-format"))
+    {
+        if (strcmp(format, "compact") == 0)
+            gVertexFormat = VERTEX_FORMAT_COMPACT;
+        else if (strcmp(format, "quantized") == 0)
+            gVertexFormat = VERTEX_FORMAT_QUANTIZED;
+    }
+
+    // Frame capture output
+    if (const char* format = UGetArgument(argc, argv, "--capture-format"))
+        gCaptureFormat = strcmp(format, "raw") == 0 ? CAPTURE_FORMAT_RAW : CAPTURE_FORMAT_PNG;
+    if (const char* directory = UGetArgument(argc, argv, "--capture-dir"))
+        gCaptureDirectory = directory;
+
+    // Baked lighting; the software renderer keeps lighting everything per pixel
+    gLightmapping = UHasArgument(argc, argv, "--lightmap");
+    if (const char* rays = UGetArgument(argc, argv, "--lightmap-ao"))
+    {
+        gLightmapping = true;
+        gLightmapSettings.aoRays = std::max(1, atoi(rays));
+    }
+
+    // Point light shadows; the lightmap then bakes the shadows of the static lights as well
+    gShadowsEnabled = UHasArgument(argc, argv, "--shadows");
+    gIsBallRolling = UHasArgument(argc, argv, "--rolling-ball");
+    if (const char* size = UGetArgument(argc, argv, "--shadow-size"))
+        gShadowMapSize = std::max(64, std::min(atoi(size), 4096));
+    gLightmapSettings.shadows = gShadowsEnabled ? 1 : 0;
+
+    // Occlusion culling needs the CPU copies of the meshes, so the mesh cache is not loaded with it
+    gOcclusionCulling = UHasArgument(argc, argv, "--occlusion-culling");
+
+    gUseMeshCache = !UHasArgument(argc, argv, "--no-mesh-cache");
+    if (gUseMeshCache)
+        CreateDirectoryIfMissing(MESH_CACHE_DIRECTORY);
+
+    // Render on the CPU instead: no window and no GL context are created
+    gSoftwareRendering = UHasArgument(argc, argv, "--software");
+    gLightmapping = gLightmapping && !gSoftwareRendering;
+    if (!gSoftwareRendering && !UInitialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
 
+    // Start the worker threads (one per hardware thread, the main thread included)
+    gJobs.reset(new JobSystem());
+
     // Toy puzzle cube
     UCreateMeshCube(gMeshCube);
     
@@ -285,11 +831,42 @@ int main(int argc, char* argv[])
     // Toy ball
     UCreateMeshSphere(gMeshSphere);
 
+    // Imported model (--import model.obj|model.glb)
+    if (const char* importPath = UGetArgument(argc, argv, "--import"))
+    {
+        if (!UImportMesh(gMeshImported, importPath))
+            return EXIT_FAILURE;
+        gHasImportedMesh = true;
+    }
+
     // Create the shader programs
-    if (!UCreateShaderProgram(cubeVertexShaderSource, cubeFragmentShaderSource, gCubeProgramId))
-        return EXIT_FAILURE;
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
-        return EXIT_FAILURE;
+    if (!gSoftwareRendering)
+    {
+        if (!UCreateShaderProgram(cubeVertexShaderSource, cubeFragmentShaderSource, gCubeProgramId))
+            return EXIT_FAILURE;
+        if (!UCreateShaderProgram(compactVertexShaderSource, cubeFragmentShaderSource, gCompactProgramId))
+            return EXIT_FAILURE;
+        if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
+            return EXIT_FAILURE;
+        if (!UCreateShaderProgram(cubeVertexShaderSource, lightmapFragmentShaderSource, gLightmapProgramId))
+            return EXIT_FAILURE;
+        if (!UCreateShaderProgram(compactVertexShaderSource, lightmapFragmentShaderSource, gCompactLightmapProgramId))
+            return EXIT_FAILURE;
+        if (!UCreateShaderProgram(shadowVertexShaderSource, shadowFragmentShaderSource, gShadowProgramId, shadowGeometryShaderSource))
+            return EXIT_FAILURE;
+    }
+
+    // Vertex throughput benchmark needs the GL context and shaders but nothing else
+    if (UHasArgument(argc, argv, "--bench-vertex"))
+    {
+        UBenchmarkVertexFormats();
+        return EXIT_SUCCESS;
+    }
+    if (UHasArgument(argc, argv, "--bench-generators"))
+    {
+        UBenchmarkGenerators();
+        return EXIT_SUCCESS;
+    }
 
     // texture images/sources
     const char* textureToy = "toypuzzle.png";                    // Image credit: me
@@ -303,70 +880,161 @@ int main(int argc, char* argv[])
     // Load textures
     if (!UCreateTexture(textureToy, gTexture1))
     {
-        cout << "Failed to load texture " << textureToy << endl;
+        ULOG_ERROR << "Failed to load texture " << textureToy;
         return EXIT_FAILURE;
     }
     if (!UCreateTexture(textureWood, gTexture2))
     {
-        cout << "Failed to load texture " << textureWood << endl;
+        ULOG_ERROR << "Failed to load texture " << textureWood;
         return EXIT_FAILURE;
     }
     if (!UCreateTexture(textureBattery, gTexture3))
     {
-        cout << "Failed to load texture " << textureBattery << endl;
+        ULOG_ERROR << "Failed to load texture " << textureBattery;
         return EXIT_FAILURE;
     }
     if (!UCreateTexture(textureBatteryTop, gTexture4))
     {
-        cout << "Failed to load texture " << textureBatteryTop << endl;
+        ULOG_ERROR << "Failed to load texture " << textureBatteryTop;
         return EXIT_FAILURE;
     }
     if (!UCreateTexture(chargerAdapterBody, gTexture5))
     {
-        cout << "Failed to load texture " << chargerAdapterBody << endl;
+        ULOG_ERROR << "Failed to load texture " << chargerAdapterBody;
         return EXIT_FAILURE;
     }
     if (!UCreateTexture(chargerAdapterProng, gTexture6))
     {
-        cout << "Failed to load texture " << chargerAdapterProng << endl;
+        ULOG_ERROR << "Failed to load texture " << chargerAdapterProng;
         return EXIT_FAILURE;
     }
     if (!UCreateTexture(textureBall, gTexture7))
     {
-        cout << "Failed to load texture " << textureBall << endl;
+        ULOG_ERROR << "Failed to load texture " << textureBall;
         return EXIT_FAILURE;
     }
 
 
 
+    // Place the objects on the desk
+    UCreateScene();
+
+    // Software rendering stops here: timed frames of the default view, the last one written to a PNG
+    if (gSoftwareRendering)
+    {
+        const char* frames = UGetArgument(argc, argv, "--software-frames");
+        const char* output = UGetArgument(argc, argv, "--software-output");
+        return URenderSoftware(frames ? atoi(frames) : 100, output ? output : "software.png") ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Bake the lighting of the static objects (or load it from the cache) and switch them to lightmapped meshes
+    if (gLightmapping && !UBakeLightmap())
+        return EXIT_FAILURE;
+
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
     glUseProgram(gCubeProgramId);
     // We set the texture as texture unit 0
     glUniform1i(glGetUniformLocation(gCubeProgramId, "uTexture"), 0);
+    glUseProgram(gCompactProgramId);
+    glUniform1i(glGetUniformLocation(gCompactProgramId, "uTexture"), 0);
+    for (GLuint programId : { gLightmapProgramId, gCompactLightmapProgramId })
+    {
+        glUseProgram(programId);
+        glUniform1i(glGetUniformLocation(programId, "uTexture"), 0);
+        glUniform1i(glGetUniformLocation(programId, "uLightmap"), LIGHTMAP_TEXTURE_UNIT);
+        glUniform3fv(glGetUniformLocation(programId, "uBakedLampPosition"), 1, glm::value_ptr(gLightmapLampPosition));
+    }
+    for (GLuint programId : { gCubeProgramId, gCompactProgramId, gLightmapProgramId, gCompactLightmapProgramId })
+    {
+        const GLint shadowUnits[SHADOW_LIGHT_COUNT] = { SHADOW_TEXTURE_UNIT, SHADOW_TEXTURE_UNIT + 1, SHADOW_TEXTURE_UNIT + 2 };
+        glUseProgram(programId);
+        glUniform1iv(glGetUniformLocation(programId, "uShadowMaps"), SHADOW_LIGHT_COUNT, shadowUnits);
+        glUniform1f(glGetUniformLocation(programId, "uShadowFarPlane"), gShadowsEnabled ? SHADOW_FAR_PLANE : 0.0f);
+    }
+
+    // Render the fixed viewpoints offscreen and compare them with (or record) the reference images
+    bool regressionRecord = UHasArgument(argc, argv, "--regression-record");
+    if (regressionRecord || UHasArgument(argc, argv, "--regression-test"))
+        return URunRegressionTest(regressionRecord) ? EXIT_SUCCESS : EXIT_FAILURE;
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    // Start the simulation from the current state
+    gPreviousCameraPosition = gCamera.GetPosition();
+    gPreviousLightPosition = gLightPosition;
+    gLastFrame = glfwGetTime();
+
+    // Render and simulation throughput, reported every few seconds
+    double statsStart = gLastFrame;
+    int statsFrames = 0;
+    int statsSteps = 0;
+
+    // Hand the GL context over to the render thread
+    glfwMakeContextCurrent(NULL);
+    gRenderThread = std::thread(URenderThread);
+
     // render loop
     // -----------
     while (!glfwWindowShouldClose(gWindow))
     {
+        // Wait for the frame rate cap before polling, so the frame is built from the freshest input
+        gFrameLimiter.Wait();
+        glfwPollEvents();
+
         // per-frame timing
         // --------------------
-        float currentFrame = glfwGetTime();
-        gDeltaTime = currentFrame - gLastFrame;
+        double currentFrame = glfwGetTime();
+        gSimulationAccumulator += currentFrame - gLastFrame;
         gLastFrame = currentFrame;
 
         // input
         // -----
         UProcessInput(gWindow);
 
-        // Render this frame
-        URender();
-
-        glfwPollEvents();
+        // Advance the simulation in fixed steps so results don't depend on the frame rate
+        int steps = 0;
+        while (gSimulationAccumulator >= SIMULATION_STEP && steps < MAX_SIMULATION_STEPS)
+        {
+            USimulate(gWindow, (float)SIMULATION_STEP);
+            gSimulationAccumulator -= SIMULATION_STEP;
+            ++steps;
+        }
+        if (steps == MAX_SIMULATION_STEPS)
+            gSimulationAccumulator = 0.0; // drop time we could not catch up on
+        gRenderAlpha = (float)(gSimulationAccumulator / SIMULATION_STEP);
+
+        // Build this frame while the render thread is still drawing the previous one
+        FramePacket& packet = gFramePackets.BeginWrite();
+        UBuildFramePacket(packet);
+        packet.inputTime = currentFrame;
+        gFramePackets.Publish();
+
+        ++statsFrames;
+        statsSteps += steps;
+        if (currentFrame - statsStart >= 5.0)
+        {
+            double seconds = currentFrame - statsStart;
+            ULOG_INFO << "Render: " << statsFrames / seconds << " fps (" << 1000.0 * seconds / statsFrames << " ms/frame), simulation: " << statsSteps / seconds << " steps/s";
+            if (gOcclusionCulling)
+                ULOG_INFO << "Occlusion culling: " << (double)gOcclusionCulled / statsFrames << " of " << (double)gOcclusionTested / statsFrames << " objects culled per frame";
+            gOcclusionTested = gOcclusionCulled = 0;
+            statsStart = currentFrame;
+            statsFrames = 0;
+            statsSteps = 0;
+        }
     }
 
+    // Stop the render thread and take the GL context back to release resources
+    gFramePackets.Stop();
+    gRenderThread.join();
+    glfwMakeContextCurrent(gWindow);
+    if (gInputEvents.DroppedCount() > 0)
+        ULOG_WARNING << "Input queue overflowed, " << gInputEvents.DroppedCount() << " events dropped";
+
+    // Stop the worker threads
+    gJobs.reset();
+
     // Release mesh data
     UDestroyMesh(gMeshCube);
     UDestroyMesh(gMeshCubeChargerBody);
@@ -378,6 +1046,12 @@ int main(int argc, char* argv[])
     UDestroyMesh(gMeshCylinderTop);
     UDestroyMesh(gMeshCylinderCathode);
     UDestroyMesh(gMeshSphere);
+    if (gHasImportedMesh)
+        UDestroyMesh(gMeshImported);
+    for (GLMesh& mesh : gLightmapMeshes)
+        UDestroyMesh(mesh);
+    if (gLightmapTexture)
+        glDeleteTextures(1, &gLightmapTexture);
 
     // Release texture
     UDestroyTexture(gTexture1);
@@ -390,10 +1064,14 @@ int main(int argc, char* argv[])
 
     // Release shader program
     UDestroyShaderProgram(gCubeProgramId);
+    UDestroyShaderProgram(gCompactProgramId);
     UDestroyShaderProgram(gLampProgramId);
+    UDestroyShaderProgram(gLightmapProgramId);
+    UDestroyShaderProgram(gCompactLightmapProgramId);
+    UDestroyShaderProgram(gShadowProgramId);
 
 
-    exit(EXIT_SUCCESS); // Terminates the program successfully
+    exit(gRenderFailed ? EXIT_FAILURE : EXIT_SUCCESS); // Terminates the program
 }
 
 
@@ -416,12 +1094,14 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
     if (*window == NULL)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
+        ULOG_ERROR << "Failed to create GLFW window";
         glfwTerminate();
         return false;
     }
     glfwMakeContextCurrent(*window);
+    glfwGetFramebufferSize(*window, &gFramebufferWidth, &gFramebufferHeight);
     glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+    glfwSetKeyCallback(*window, UKeyCallback);
     glfwSetCursorPosCallback(*window, UMousePositionCallback);
     glfwSetScrollCallback(*window, UMouseScrollCallback);
     glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
@@ -437,59 +1117,135 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 
     if (GLEW_OK != GlewInitResult)
     {
-        std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
+        ULOG_ERROR << glewGetErrorString(GlewInitResult);
         return false;
     }
 
     // Displays GPU OpenGL version
-    cout << "OpenGL Version: " << glGetString(GL_VERSION) << endl;
+    ULOG_INFO << "OpenGL Version: " << glGetString(GL_VERSION);
 
     return true;
 }
 
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
+// process all input: applies the events the callbacks queued since the last frame
 void UProcessInput(GLFWwindow* window)
 {
-    static const float cameraSpeed = 2.5f;
-    static bool keyPressed = false;
-    // End program
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
-
-    // WASD Movement inputs
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(LEFT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(UP, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(DOWN, gDeltaTime);
-
-    // Camera perspective toggle
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
-        if (!keyPressed) // Prevents toggling too fast
+    InputEvent event;
+    while (gInputEvents.Pop(event))
+    {
+        switch (event.type)
         {
-            isPerspective = !isPerspective;
-            keyPressed = true;
+        case INPUT_KEY:
+            if (event.action == GLFW_RELEASE)
+            {
+                gKeysDown[event.code] = false;
+                break;
+            }
+            if (event.action != GLFW_PRESS)
+                break; // toggles react to the press, not to key repeat
+            gKeysDown[event.code] = true;
+
+            switch (event.code)
+            {
+            case GLFW_KEY_ESCAPE: // End program
+                glfwSetWindowShouldClose(window, true);
+                break;
+            case GLFW_KEY_L: // Lamp orbit toggle
+                gIsLampOrbiting = !gIsLampOrbiting;
+                break;
+            case GLFW_KEY_P: // Camera perspective toggle
+                isPerspective = !isPerspective;
+                break;
+            case GLFW_KEY_F12: // Screenshot of the next frame
+                CreateDirectoryIfMissing(gCaptureDirectory);
+                gCaptureScreenshot = true;
+                break;
+            case GLFW_KEY_F11: // Frame recording toggle
+                CreateDirectoryIfMissing(gCaptureDirectory);
+                gCaptureRecording = !gCaptureRecording;
+                ULOG_INFO << (gCaptureRecording ? "Recording frames to " : "Stopped recording frames to ") << gCaptureDirectory;
+                break;
+            }
+            break;
+
+        case INPUT_MOUSE_MOVE:
+            if (gFirstMouse)
+            {
+                gLastX = event.x;
+                gLastY = event.y;
+                gFirstMouse = false;
+            }
+            gCamera.ProcessMouseMovement(event.x - gLastX, gLastY - event.y); // y reversed since y-coordinates go from bottom to top
+            gLastX = event.x;
+            gLastY = event.y;
+            break;
+
+        case INPUT_SCROLL:
+            gCamera.ProcessMouseScroll(event.y);
+            break;
+
+        case INPUT_MOUSE_BUTTON:
+            // Left click selects the object under the crosshair; the other buttons are unused
+            if (event.code == GLFW_MOUSE_BUTTON_LEFT && event.action == GLFW_PRESS)
+                UPickObject();
+            break;
         }
     }
-    else
+}
+
+
+// advances everything that moves over time by one fixed step
+void USimulate(GLFWwindow* window, float step)
+{
+    // Remember where things were so rendering can interpolate towards the new state
+    gPreviousCameraPosition = gCamera.GetPosition();
+    gPreviousLightPosition = gLightPosition;
+
+    // WASD Movement inputs
+    if (gKeysDown[GLFW_KEY_W])
+        gCamera.ProcessKeyboard(FORWARD, step);
+    if (gKeysDown[GLFW_KEY_S])
+        gCamera.ProcessKeyboard(BACKWARD, step);
+    if (gKeysDown[GLFW_KEY_A])
+        gCamera.ProcessKeyboard(LEFT, step);
+    if (gKeysDown[GLFW_KEY_D])
+        gCamera.ProcessKeyboard(RIGHT, step);
+    if (gKeysDown[GLFW_KEY_E])
+        gCamera.ProcessKeyboard(UP, step);
+    if (gKeysDown[GLFW_KEY_Q])
+        gCamera.ProcessKeyboard(DOWN, step);
+
+    // Orbit the first lamp around the scene's vertical axis
+    if (gIsLampOrbiting)
+        gLightPosition = glm::vec3(glm::rotate(LAMP_ORBIT_SPEED * step, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(gLightPosition, 1.0f));
+
+    // Roll the toy ball between z = 1 and z = -1; turning it by distance over radius keeps it from sliding
+    if (gIsBallRolling)
     {
-        keyPressed = false;
+        gBallPhase = fmodf(gBallPhase + BALL_ROLL_SPEED * step, glm::radians(360.0f));
+        float z = cosf(gBallPhase);
+        gTransforms.SetPosition(gBallTransform, glm::vec3(-2.0f, -0.4f, z));
+        gTransforms.SetRotation(gBallTransform, 1.5708f + (z - 1.0f) / BALL_RADIUS, glm::vec3(1.0f, 0.0f, 0.0f));
     }
 }
 
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
+// (the render thread owns the GL context, so the new size is passed along with the next frame packet)
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
-    glViewport(0, 0, width, height);
+    gFramebufferWidth = width;
+    gFramebufferHeight = height;
+}
+
+
+// glfw: whenever a key is pressed, repeated or released, this callback is called
+// -------------------------------------------------------------------------------
+void UKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (key >= 0 && key <= GLFW_KEY_LAST)
+        gInputEvents.Push({ INPUT_KEY, (uint8_t)action, (int16_t)key, 0.0f, 0.0f });
 }
 
 
@@ -497,20 +1253,7 @@ void UResizeWindow(GLFWwindow* window, int width, int height)
 // -------------------------------------------------------
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 {
-    if (gFirstMouse)
-    {
-        gLastX = xpos;
-        gLastY = ypos;
-        gFirstMouse = false;
-    }
-
-    float xoffset = xpos - gLastX;
-    float yoffset = gLastY - ypos; // reversed since y-coordinates go from bottom to top
-
-    gLastX = xpos;
-    gLastY = ypos;
-
-    gCamera.ProcessMouseMovement(xoffset, yoffset);
+    gInputEvents.Push({ INPUT_MOUSE_MOVE, 0, 0, (float)xpos, (float)ypos });
 }
 
 
@@ -518,195 +1261,596 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 // ----------------------------------------------------------------------
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 {
-    gCamera.ProcessMouseScroll(yoffset);
+    gInputEvents.Push({ INPUT_SCROLL, 0, 0, (float)xoffset, (float)yoffset });
 }
 
 // glfw: handle mouse button events
 // --------------------------------
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 {
-    switch (button)
+    gInputEvents.Push({ INPUT_MOUSE_BUTTON, (uint8_t)action, (int16_t)button, 0.0f, 0.0f });
+}
+
+// Creates the transform of every object in the scene and pairs it with a mesh and texture
+void UCreateScene()
+{
+    // Adds an object and returns its transform so children can be attached to it
+    auto addObject = [](const GLMesh& mesh, GLuint texture, const glm::vec3& position, float angle, const glm::vec3& axis, const glm::vec3& scale, TransformHandle parent = INVALID_TRANSFORM)
     {
-    case GLFW_MOUSE_BUTTON_LEFT:
+        TransformHandle transform = gTransforms.Create(position, angle, axis, scale, parent);
+        gSceneObjects.push_back({ &mesh, texture, transform });
+        return transform;
+    };
+
+    // Plane (desk surface)
+    addObject(gMeshPlane, gTexture2, glm::vec3(0.0f, -1.0f, 0.0f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(56.0f, 1.0f, 24.0f));
+
+    // Pyramid (testing)
+    addObject(gMeshPyramid, gTexture1, glm::vec3(20.0f, -0.96f, 0.0f), -0.5f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.5f, 1.5f, 1.5f));
+
+    // Cylinder (battery body, top face and positive terminal)
+    addObject(gMeshCylinder, gTexture3, glm::vec3(-1.2f, -0.47f, 2.0f), 3.14f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 1.0f));
+    addObject(gMeshCylinderTop, gTexture4, glm::vec3(-1.2f, 0.032f, 2.0f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.98f, 0.01f, 0.98f));
+    addObject(gMeshCylinderCathode, gTexture4, glm::vec3(-1.2f, 0.032f, 2.0f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.5f, 0.05f, 0.5f));
+
+    // Cube (Charging Adapter's body); the prongs are children so they follow the body
+    TransformHandle chargerBody = addObject(gMeshCubeChargerBody, gTexture5, glm::vec3(2.0f, -0.5f, -0.1f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.55f, 1.0f, 0.7f));
+    addObject(gMeshCubeChargerProng1, gTexture6, glm::vec3(0.0f, 0.65f, 0.22f), 1.571f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.01f, 0.30f, 0.2f), chargerBody);
+    addObject(gMeshCubeChargerProng2, gTexture6, glm::vec3(0.0f, 0.65f, -0.22f), 1.571f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.01f, 0.30f, 0.2f), chargerBody);
+
+    // Sphere (Toy ball), moved by USimulate when it rolls
+    gBallTransform = addObject(gMeshSphere, gTexture7, glm::vec3(-2.0f, -0.4f, 1.0f), 1.5708f, glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(BALL_RADIUS));
+    gSceneObjects.back().dynamic = gIsBallRolling;
+
+    // Cube (Toy puzzle)
+    addObject(gMeshCube, gTexture1, glm::vec3(0.0f, -0.25f, 0.0f), 0.769f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.5f, 1.5f, 1.5f));
+
+    // Imported model, scaled to fit a 1.5 unit box and standing on the desk next to the toy cube
+    if (gHasImportedMesh)
     {
-        if (action == GLFW_PRESS)
-            cout << "Left mouse button pressed" << endl;
-        else
-            cout << "Left mouse button released" << endl;
+        glm::vec3 extent = gMeshImported.boundsMax - gMeshImported.boundsMin;
+        float largest = glm::max(extent.x, glm::max(extent.y, extent.z));
+        float scale = largest > 0.0f ? 1.5f / largest : 1.0f;
+        glm::vec3 center = (gMeshImported.boundsMin + gMeshImported.boundsMax) * 0.5f;
+        glm::vec3 position(4.0f - center.x * scale, -1.0f - gMeshImported.boundsMin.y * scale, 1.5f - center.z * scale);
+        addObject(gMeshImported, gTexture1, position, 0.0f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(scale));
     }
-    break;
+}
 
-    case GLFW_MOUSE_BUTTON_MIDDLE:
+// Updates the transform hierarchy one depth level at a time, splitting each level across the worker threads
+void UUpdateTransforms(JobSystem& jobs, TransformHierarchy& transforms)
+{
+    transforms.PrepareUpdate();
+    for (int level = 0; level < transforms.LevelCount(); ++level)
     {
-        if (action == GLFW_PRESS)
-            cout << "Middle mouse button pressed" << endl;
-        else
-            cout << "Middle mouse button released" << endl;
+        int begin = transforms.LevelBegin(level);
+        jobs.ParallelFor(transforms.LevelEnd(level) - begin, 1024, [&transforms, begin](int first, int last)
+        {
+            transforms.UpdateRange(begin + first, begin + last);
+        });
     }
-    break;
+}
 
-    case GLFW_MOUSE_BUTTON_RIGHT:
+// Brings the BVH up to date with the objects that moved (building it on first use), culls it against the view
+// frustum and gathers the visible objects into the draw list in parallel chunks
+void UBuildDrawList(JobSystem& jobs, const std::vector<SceneObject>& objects, const TransformHierarchy& transforms, BVH& bvh, const Frustum& frustum, std::vector<DrawItem>& drawList)
+{
+    const int chunkSize = 512;
+    static std::vector<std::vector<DrawItem>> chunkLists; // reused between frames to avoid allocations
+    static std::vector<std::vector<int>> chunkMoved;
+    static std::vector<int> moved;
+    static std::vector<glm::vec3> boundsMin, boundsMax;
+    static std::vector<unsigned char> visible;
+
+    int objectCount = (int)objects.size();
+    int chunkCount = (objectCount + chunkSize - 1) / chunkSize;
+    if ((int)chunkLists.size() < chunkCount)
     {
-        if (action == GLFW_PRESS)
-            cout << "Right mouse button pressed" << endl;
-        else
-            cout << "Right mouse button released" << endl;
+        chunkLists.resize(chunkCount);
+        chunkMoved.resize(chunkCount);
     }
-    break;
 
-    default:
-        cout << "Unhandled mouse button event" << endl;
-        break;
+    // World bounds of the objects whose transform changed in this update, or of every object for a new tree
+    bool build = bvh.ObjectCount() != objectCount;
+    if (build)
+    {
+        boundsMin.resize(objectCount);
+        boundsMax.resize(objectCount);
     }
-}
+    jobs.ParallelFor(chunkCount, 1, [&](int firstChunk, int lastChunk)
+    {
+        for (int chunk = firstChunk; chunk < lastChunk; ++chunk)
+        {
+            std::vector<int>& list = chunkMoved[chunk];
+            list.clear();
+
+            int end = std::min(objectCount, (chunk + 1) * chunkSize);
+            for (int i = chunk * chunkSize; i < end; ++i)
+            {
+                const SceneObject& object = objects[i];
+                if (!build && !transforms.Changed(object.transform))
+                    continue;
+                glm::vec3 worldMin, worldMax;
+                TransformBounds(object.mesh->boundsMin, object.mesh->boundsMax, transforms.GetWorldMatrix(object.transform), worldMin, worldMax);
+                if (build)
+                {
+                    boundsMin[i] = worldMin;
+                    boundsMax[i] = worldMax;
+                }
+                else
+                {
+                    bvh.SetObjectBounds(i, worldMin, worldMax);
+                    list.push_back(i);
+                }
+            }
+        }
+    });
 
-// Rendering function for each frame
-void URender()
-{
+    if (build)
+        bvh.Build(boundsMin.data(), boundsMax.data(), objectCount);
+    else
+    {
+        moved.clear();
+        for (int chunk = 0; chunk < chunkCount; ++chunk)
+            moved.insert(moved.end(), chunkMoved[chunk].begin(), chunkMoved[chunk].end());
+        if (!moved.empty())
+        {
+            bvh.Refit(moved.data(), moved.size());
+            if (bvh.Cost() > BVH_REBUILD_COST_RATIO * bvh.BuiltCost())
+                bvh.Rebuild();
+        }
+    }
 
-    glEnable(GL_DEPTH_TEST);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Mark what the tree finds inside the frustum, then gather in object order so the draw order stays the same
+    visible.assign(objectCount, 0);
+    bvh.QueryFrustum(frustum, [](int object) { visible[object] = 1; });
+    jobs.ParallelFor(chunkCount, 1, [&](int firstChunk, int lastChunk)
+    {
+        for (int chunk = firstChunk; chunk < lastChunk; ++chunk)
+        {
+            std::vector<DrawItem>& list = chunkLists[chunk];
+            list.clear();
 
-    glUseProgram(gCubeProgramId);
+            int end = std::min(objectCount, (chunk + 1) * chunkSize);
+            for (int i = chunk * chunkSize; i < end; ++i)
+                if (visible[i])
+                    list.push_back({ objects[i].mesh, objects[i].texture, transforms.GetWorldMatrix(objects[i].transform) });
+        }
+    });
+
+    drawList.clear();
+    for (int chunk = 0; chunk < chunkCount; ++chunk)
+        drawList.insert(drawList.end(), chunkLists[chunk].begin(), chunkLists[chunk].end());
+}
+
+// Rasterizes the largest visible objects into the occlusion buffer and removes the draw items hidden behind them
+void UCullOccluded(const glm::mat4& viewProjection, int viewportWidth, int viewportHeight, std::vector<DrawItem>& drawList)
+{
+    int height = std::max(1, OCCLUSION_BUFFER_WIDTH * std::max(viewportHeight, 1) / std::max(viewportWidth, 1));
+    if (gOcclusionBuffer.Width() != OCCLUSION_BUFFER_WIDTH || gOcclusionBuffer.Height() != height)
+        gOcclusionBuffer.Resize(OCCLUSION_BUFFER_WIDTH, height);
+    gOcclusionBuffer.Clear();
+
+    // Occluders: the visible objects with CPU geometry whose bounds cover the most screen
+    std::vector<std::pair<float, size_t>> occluders;
+    std::vector<glm::vec3> bounds(drawList.size() * 2);
+    for (size_t i = 0; i < drawList.size(); ++i)
+    {
+        const DrawItem& item = drawList[i];
+        TransformBounds(item.mesh->boundsMin, item.mesh->boundsMax, item.model, bounds[i * 2], bounds[i * 2 + 1]);
+        float coverage = gOcclusionBuffer.ScreenCoverage(bounds[i * 2], bounds[i * 2 + 1], viewProjection);
+        if (item.mesh->raster && coverage >= MIN_OCCLUDER_COVERAGE)
+            occluders.push_back({ coverage, i });
+    }
+    std::sort(occluders.begin(), occluders.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first > b.first; });
+    if (occluders.size() > (size_t)MAX_OCCLUDERS)
+        occluders.resize(MAX_OCCLUDERS);
+    for (const std::pair<float, size_t>& occluder : occluders)
+    {
+        const DrawItem& item = drawList[occluder.second];
+        const RasterMesh& mesh = *item.mesh->raster;
+        gOcclusionBuffer.DrawOccluder(mesh.vertices.data(), MeshData::FLOATS_PER_VERTEX, mesh.indices.data(), mesh.indices.size(), viewProjection * item.model);
+    }
+    gOcclusionBuffer.BuildHierarchy();
+
+    // Keep the draw order of the visible items
+    size_t kept = 0;
+    for (size_t i = 0; i < drawList.size(); ++i)
+        if (gOcclusionBuffer.IsVisible(bounds[i * 2], bounds[i * 2 + 1], viewProjection))
+            drawList[kept++] = drawList[i];
+    gOcclusionTested += drawList.size();
+    gOcclusionCulled += drawList.size() - kept;
+    drawList.resize(kept);
+}
 
-    glm::mat4 view = gCamera.GetViewMatrix();
-    glm::mat4 projection;
+// Perspective or orthographic projection of the camera
+glm::mat4 UProjectionMatrix()
+{
     if (isPerspective) {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+        return glm::perspective(glm::radians(gCamera.Zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
     }
     else {
         float aspectRatio = (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT;
-        projection = glm::ortho(-aspectRatio * 2.0f, aspectRatio * 2.0f, -2.0f, 2.0f, 0.1f, 100.0f);
-    }
-
-    // Set view and projection matrices only once for all objects
-    GLint modelLoc = glGetUniformLocation(gCubeProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gCubeProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gCubeProgramId, "projection");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Set light and camera data to the shader
-    GLint lightPositionLoc = glGetUniformLocation(gCubeProgramId, "lightPos");
-    GLint lightColorLoc = glGetUniformLocation(gCubeProgramId, "lightColor");
-    GLint viewPositionLoc = glGetUniformLocation(gCubeProgramId, "viewPosition");
-
-    glm::vec3 lightPositions[] = { gLightPosition, gLightPosition2, gLightPosition3 };
-    glm::vec3 lightColors[] = { gLightColor, gLightColor2, gLightColor3 };
-
-    glUniform3fv(lightPositionLoc, 3, glm::value_ptr(lightPositions[0]));
-    glUniform3fv(lightColorLoc, 3, glm::value_ptr(lightColors[0]));
-    glUniform3f(viewPositionLoc, gCamera.Position.x, gCamera.Position.y, gCamera.Position.z);
-
-    GLint objectColorLoc = glGetUniformLocation(gCubeProgramId, "objectColor");
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-
-    GLint UVScaleLoc = glGetUniformLocation(gCubeProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-
-    // Plane transformations (desk surface)
-    glm::mat4 planeModel =
-        glm::translate(glm::vec3(0.0f, -1.0f, 0.0f)) *
-        glm::rotate(0.0f, glm::vec3(1.0f, 1.0f, 1.0f)) *
-        glm::scale(glm::vec3(56.0f, 1.0f, 24.0f));
-    renderObject(gMeshPlane, planeModel, gTexture2, modelLoc);
-
-    // Pyramid transformations (testing)
-    glm::mat4 pyramidModel =
-        glm::translate(glm::vec3(20.0f, -0.96f, 0.0f)) *
-        glm::rotate(-0.5f, glm::vec3(0.0f, 1.0f, 0.0f)) *
-        glm::scale(glm::vec3(1.5f, 1.5f, 1.5f));
-    renderObject(gMeshPyramid, pyramidModel, gTexture1, modelLoc);
-
-    // Cylinder (battery)
-    // -----------------------
-    // Cylinder (battery body)
-    glm::mat4 cylinderModel =
-        glm::translate(glm::vec3(-1.2f, -0.47f, 2.0f)) *
-        glm::rotate(3.14f, glm::vec3(0.0f, 1.0f, 0.0f)) *
-        glm::scale(glm::vec3(1.0f, 1.0f, 1.0f));
-    renderObject(gMeshCylinder, cylinderModel, gTexture3, modelLoc);
-    // Cylinder (battery top face)
-    glm::mat4 cylinderModelTop =
-        glm::translate(glm::vec3(-1.2f, 0.032f, 2.0f)) *
-        glm::rotate(0.0f, glm::vec3(1.0f, 1.0f, 1.0f)) *
-        glm::scale(glm::vec3(0.98f, 0.01f, 0.98f));
-    renderObject(gMeshCylinderTop, cylinderModelTop, gTexture4, modelLoc);
-    // Cylinder (battery top positive terminal)
-    glm::mat4 cylinderModelCathode =
-        glm::translate(glm::vec3(-1.2f, 0.032f, 2.0f)) *
-        glm::rotate(0.0f, glm::vec3(1.0f, 1.0f, 1.0f)) *
-        glm::scale(glm::vec3(0.5f, 0.05f, 0.5f));
-    renderObject(gMeshCylinderCathode, cylinderModelCathode, gTexture4, modelLoc);
-
-    // cube transformations (Charging Adapter)
-    // ----------------------------------------------
-    // cube transformations (Charging Adapter's body)
-    glm::mat4 cubeModelChargerBody =
-        glm::translate(glm::vec3(2.0f, -0.5f, -0.1f)) *
-        glm::rotate(0.0f, glm::vec3(1.0f, 1.0f, 1.0f)) *
-        glm::scale(glm::vec3(0.55f, 1.0f, 0.7f));
-    renderObject(gMeshCubeChargerBody, cubeModelChargerBody, gTexture5, modelLoc);
-    // cube transformations (Charging Adapter's prong 1)
-    glm::mat4 cubeModelChargerProng1 =
-        glm::translate(cubeModelChargerBody, glm::vec3(0.0f, 0.65f, 0.22f)) *
-        glm::rotate(1.571f, glm::vec3(0.0f, 1.0f, 0.0f)) *
-        glm::scale(glm::vec3(0.01f, 0.30f, 0.2f));
-    renderObject(gMeshCubeChargerProng1, cubeModelChargerProng1, gTexture6, modelLoc);
-    // cube transformations (Charging Adapter's prong 2)
-    glm::mat4 cubeModelChargerProng2 =
-        glm::translate(cubeModelChargerBody, glm::vec3(0.0f, 0.65f, -0.22f)) *
-        glm::rotate(1.571f, glm::vec3(0.0f, 1.0f, 0.0f)) *
-        glm::scale(glm::vec3(0.01f, 0.30f, 0.2f));
-    renderObject(gMeshCubeChargerProng2, cubeModelChargerProng2, gTexture6, modelLoc);
-
-    // sphere transformations (Toy ball)
-    glm::mat4 sphereModel =
-        glm::translate(glm::vec3(-2.0f, -0.4f, 1.0f)) *
-        glm::rotate(1.5708f, glm::vec3(1.0f, 0.0f, 0.0f)) *
-        glm::scale(glm::vec3(0.6f, 0.6f, 0.6f));
-    renderObject(gMeshSphere, sphereModel, gTexture7, modelLoc);
-
-    // cube transformations (Toy puzzle)
-    glm::mat4 cubeModel =
-        glm::translate(glm::vec3(0.0f, -0.25f, 0.0f)) *
-        glm::rotate(0.769f, glm::vec3(0.0f, 1.0f, 0.0f)) *
-        glm::scale(glm::vec3(1.5f, 1.5f, 1.5f));
-    renderObject(gMeshCube, cubeModel, gTexture1, modelLoc);
+        return glm::ortho(-aspectRatio * 2.0f, aspectRatio * 2.0f, -2.0f, 2.0f, 0.1f, 100.0f);
+    }
+}
 
-    // Render each light
-    glUseProgram(gLampProgramId);
-    for (int i = 0; i < 3; ++i) {
-        glm::mat4 lampModel = glm::translate(lightPositions[i]) * glm::scale(gLightScale);
-        glUniformMatrix4fv(glGetUniformLocation(gLampProgramId, "model"), 1, GL_FALSE, glm::value_ptr(lampModel));
-        glUniformMatrix4fv(glGetUniformLocation(gLampProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(gLampProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glDrawElements(GL_TRIANGLES, gMeshCube.nVertices, GL_UNSIGNED_INT, 0);
+// Builds the frame packet for the current simulation state (runs on the main thread)
+void UBuildFramePacket(FramePacket& packet)
+{
+    // Interpolate the simulated state between the last two steps
+    gRenderCamera.SetPosition(glm::mix(gPreviousCameraPosition, gCamera.GetPosition(), gRenderAlpha));
+    gRenderCamera.SetOrientation(gCamera.GetOrientation());
+    gRenderCamera.SetProjection(UProjectionMatrix());
+    glm::vec3 lightPosition = glm::mix(gPreviousLightPosition, gLightPosition, gRenderAlpha);
+
+    packet.view = gRenderCamera.GetViewMatrix();
+    packet.projection = gRenderCamera.GetProjectionMatrix();
+    packet.viewPosition = gRenderCamera.GetPosition();
+
+    packet.lightPositions[0] = lightPosition;
+    packet.lightPositions[1] = gLightPosition2;
+    packet.lightPositions[2] = gLightPosition3;
+    packet.lightColors[0] = gLightColor;
+    packet.lightColors[1] = gLightColor2;
+    packet.lightColors[2] = gLightColor3;
+
+    packet.framebufferWidth = gFramebufferWidth;
+    packet.framebufferHeight = gFramebufferHeight;
+    packet.capture = gCaptureScreenshot || gCaptureRecording;
+    gCaptureScreenshot = false;
+
+    // Update the world matrices of any objects that moved, cull them against the view and collect what is visible
+    UUpdateTransforms(*gJobs, gTransforms);
+    UBuildDrawList(*gJobs, gSceneObjects, gTransforms, gSceneBVH, gRenderCamera.GetFrustum(), packet.drawItems);
+    if (gOcclusionCulling)
+        UCullOccluded(gRenderCamera.GetViewProjectionMatrix(), packet.framebufferWidth, packet.framebufferHeight, packet.drawItems);
+
+    // Shadows need every object, not only the visible ones; the static ones are only sent again after one moved
+    packet.staticCastersChanged = false;
+    packet.dynamicCasters.clear();
+    if (gShadowsEnabled)
+    {
+        packet.staticCastersChanged = !gStaticCastersSent;
+        for (const SceneObject& object : gSceneObjects)
+        {
+            if (object.dynamic)
+                packet.dynamicCasters.push_back({ object.mesh, object.texture, gTransforms.GetWorldMatrix(object.transform) });
+            else if (gTransforms.Changed(object.transform))
+                packet.staticCastersChanged = true;
+        }
+        if (packet.staticCastersChanged)
+        {
+            packet.staticCasters.clear();
+            for (const SceneObject& object : gSceneObjects)
+                if (!object.dynamic)
+                    packet.staticCasters.push_back({ object.mesh, object.texture, gTransforms.GetWorldMatrix(object.transform) });
+        }
+        gStaticCastersSent = true;
     }
+}
 
-    glBindVertexArray(0);
-    glUseProgram(0);
-    glfwSwapBuffers(gWindow);
+// World space ray through a point in normalized device coordinates, from the near plane towards the far plane
+void UViewRay(float ndcX, float ndcY, const glm::mat4& viewProjection, glm::vec3& origin, glm::vec3& direction)
+{
+    glm::mat4 inverse = glm::inverse(viewProjection);
+    glm::vec4 nearPoint = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverse * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    origin = glm::vec3(nearPoint) / nearPoint.w;
+    direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
 }
 
-// render given object with model matrix and texture
-void renderObject(const GLMesh& mesh, const glm::mat4& model, GLuint textureID, GLint modelLoc)
+// Nearest object along a world space ray: the scene BVH finds the objects whose boxes the ray crosses, nearest
+// first, and each is tested against its mesh's triangle BVH in object space. Returns -1 when nothing is hit
+// within distance, which is updated to the hit otherwise.
+int URaycastScene(const std::vector<SceneObject>& objects, const TransformHierarchy& transforms, const BVH& bvh, const glm::vec3& origin, const glm::vec3& direction, float& distance)
 {
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    return bvh.Raycast(origin, direction, distance, [&](int object, float maxDistance)
+    {
+        const PickMesh* mesh = objects[object].mesh->pick;
+        if (!mesh)
+            return -1.0f;
+
+        // an affine transform keeps the ray parameter, so the object space distance is the world space one
+        glm::mat4 toObject = glm::inverse(transforms.GetWorldMatrix(objects[object].transform));
+        float t = maxDistance;
+        if (mesh->Raycast(glm::vec3(toObject * glm::vec4(origin, 1.0f)), glm::vec3(toObject * glm::vec4(direction, 0.0f)), t) < 0)
+            return -1.0f;
+        return t;
+    });
+}
+
+// Selects the object under the crosshair. The cursor is captured for mouse look, so it is always the center
+// of the view, as last shown. Runs on the main thread, which owns gSceneBVH.
+void UPickObject()
+{
+    auto start = std::chrono::steady_clock::now();
+    glm::vec3 origin, direction;
+    UViewRay(0.0f, 0.0f, gRenderCamera.GetViewProjectionMatrix(), origin, direction);
+    float distance = 100.0f; // far plane
+    gSelectedObject = URaycastScene(gSceneObjects, gTransforms, gSceneBVH, origin, direction, distance);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    if (gSelectedObject >= 0)
+        ULOG_INFO << "Selected object " << gSelectedObject << " at distance " << distance << " (picked in " << us << " us)";
+    else
+        ULOG_INFO << "Nothing selected (picked in " << us << " us)";
+}
+
+// Render thread: owns the GL context and draws every packet published by the main thread
+void URenderThread()
+{
+    glfwMakeContextCurrent(gWindow);
+    glfwSwapInterval(gSwapInterval);
+    gFramePacer.Create(gMaxFramesInFlight, glfwGetTime);
+    gCapture.Create(gCaptureDirectory, gCaptureFormat);
+
+    // Input-to-photon latency, estimated as input poll to GPU completion and reported every few seconds
+    double statsStart = glfwGetTime();
+    double latencySum = 0.0;
+    double latencyMax = 0.0;
+    int latencyFrames = 0;
+    unsigned frameNumber = 0;
+
+    int viewportWidth = 0;
+    int viewportHeight = 0;
+    while (const FramePacket* packet = gFramePackets.Acquire())
+    {
+        // Don't let the GPU fall more than gMaxFramesInFlight frames behind
+        gFramePacer.WaitForFrameSlot();
+
+        if (packet->framebufferWidth != viewportWidth || packet->framebufferHeight != viewportHeight)
+        {
+            viewportWidth = packet->framebufferWidth;
+            viewportHeight = packet->framebufferHeight;
+            glViewport(0, 0, viewportWidth, viewportHeight);
+        }
+
+        URender(*packet);
+
+        // The back buffer is undefined after the swap, so the readback is queued first
+        if (packet->capture)
+            gCapture.Capture(packet->framebufferWidth, packet->framebufferHeight);
+        glfwSwapBuffers(gWindow);
+        gFramePacer.EndFrame(packet->inputTime);
+        gCapture.Poll();
+
+        FrameLatency latency;
+        while (gFramePacer.PopLatency(latency))
+        {
+            double milliseconds = 1000.0 * (latency.gpuDoneTime - latency.inputTime);
+            latencySum += milliseconds;
+            latencyMax = std::max(latencyMax, milliseconds);
+            ++latencyFrames;
+            if (gLatencyLog)
+                fprintf(gLatencyLog, "%u,%.3f,%.3f\n", frameNumber++, 1000.0 * (latency.submitTime - latency.inputTime), milliseconds);
+        }
+
+        double now = glfwGetTime();
+        if (now - statsStart >= 5.0 && latencyFrames > 0)
+        {
+            ULOG_INFO << "Latency: " << latencySum / latencyFrames << " ms average, " << latencyMax << " ms max (input to GPU done, "
+                << gFramePacer.Limit() << " frames in flight, swap interval " << gSwapInterval << ")";
+            statsStart = now;
+            latencySum = 0.0;
+            latencyMax = 0.0;
+            latencyFrames = 0;
+        }
+    }
+
+    if (gFramePacer.WaitCount() > 0)
+        ULOG_INFO << "Frames in flight limit waited for the GPU " << gFramePacer.WaitCount() << " times";
+    gFramePacer.Destroy();
+    gCapture.Destroy();
+    if (gShadowMaps.IsCreated())
+        ULOG_INFO << "Shadow maps: " << gShadowMaps.StaticPassCount() << " static and " << gShadowMaps.DynamicPassCount() << " dynamic passes";
+    gShadowMaps.Destroy();
+    if (gCapture.RequestedCount() > 0)
+        ULOG_INFO << "Captured " << gCapture.CapturedCount() << " of " << gCapture.RequestedCount() << " frames (" << gCapture.DroppedCount() << " dropped, "
+            << gCapture.FailedCount() << " failed to write, " << gCapture.StallCount() << " readback stalls)";
+    if (gLatencyLog)
+    {
+        fclose(gLatencyLog);
+        gLatencyLog = nullptr;
+    }
+    if (gFrameRing.StallCount() > 0)
+        ULOG_INFO << "Frame data ring buffer waited for the GPU " << gFrameRing.StallCount() << " times";
+    gFrameRing.Destroy();
+    glfwMakeContextCurrent(NULL);
+}
+
+// Rendering function for each frame (runs on the render thread); draws into the bound framebuffer without swapping
+void URender(const FramePacket& packet)
+{
+
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Frame constants, then one entry per visible object and per lamp
+    FrameUniforms frame;
+    frame.view = packet.view;
+    frame.projection = packet.projection;
+    frame.viewPosition = glm::vec4(packet.viewPosition, 1.0f);
+    for (int i = 0; i < 3; ++i)
+    {
+        frame.lightPositions[i] = glm::vec4(packet.lightPositions[i], 1.0f);
+        frame.lightColors[i] = glm::vec4(packet.lightColors[i], 1.0f);
+    }
+    frame.objectColor = glm::vec4(gObjectColor, 1.0f);
+    frame.uvScale = glm::vec4(gUVScale, 0.0f, 0.0f);
+
+    // Shadow maps of the static objects are only redrawn for lights that moved or after a static object moved
+    bool staticPasses[SHADOW_LIGHT_COUNT] = {};
+    bool anyStaticPass = false;
+    if (gShadowsEnabled)
+    {
+        if (!gShadowMaps.IsCreated())
+            gShadowMaps.Create(gShadowMapSize, SHADOW_FAR_PLANE, gShadowProgramId);
+        if (packet.staticCastersChanged)
+        {
+            gStaticCasters = packet.staticCasters;
+            gShadowMaps.InvalidateStatic();
+        }
+        for (int i = 0; i < SHADOW_LIGHT_COUNT; ++i)
+        {
+            staticPasses[i] = gShadowMaps.NeedsStaticPass(i, packet.lightPositions[i]);
+            anyStaticPass = anyStaticPass || staticPasses[i];
+        }
+    }
+
+    // Object entries: visible items, lamps, then the shadow casters drawn this frame
+    size_t itemCount = packet.drawItems.size();
+    size_t staticCasterCount = anyStaticPass ? gStaticCasters.size() : 0;
+    size_t dynamicCasterCount = gShadowsEnabled ? packet.dynamicCasters.size() : 0;
+    size_t staticCasterBase = itemCount + 3;
+    size_t dynamicCasterBase = staticCasterBase + staticCasterCount;
+    ObjectUniforms* objects = UBeginFrameData(frame, dynamicCasterBase + dynamicCasterCount);
+    if (!objects)
+    {
+        gRenderFailed = true;
+        glfwSetWindowShouldClose(gWindow, GLFW_TRUE);
+        return;
+    }
+    auto writeObject = [objects](size_t index, const DrawItem& item)
+    {
+        // Quantized positions are stored relative to each mesh's bounds
+        bool quantized = item.mesh->format == VERTEX_FORMAT_QUANTIZED;
+        ObjectUniforms object;
+        object.model = item.model;
+        object.positionOffset = glm::vec4(quantized ? item.mesh->boundsMin : glm::vec3(0.0f), 0.0f);
+        object.positionScale = glm::vec4(quantized ? item.mesh->boundsMax - item.mesh->boundsMin : glm::vec3(1.0f), 0.0f);
+        std::memcpy(&objects[index], &object, sizeof(object));
+    };
+    for (size_t i = 0; i < itemCount; ++i)
+        writeObject(i, packet.drawItems[i]);
+    for (size_t i = 0; i < staticCasterCount; ++i)
+        writeObject(staticCasterBase + i, gStaticCasters[i]);
+    for (size_t i = 0; i < dynamicCasterCount; ++i)
+        writeObject(dynamicCasterBase + i, packet.dynamicCasters[i]);
+    for (int i = 0; i < 3; ++i)
+    {
+        ObjectUniforms lamp;
+        lamp.model = glm::translate(packet.lightPositions[i]) * glm::scale(gLightScale) * UDequantizeMatrix(gMeshCube);
+        lamp.positionOffset = glm::vec4(0.0f);
+        lamp.positionScale = glm::vec4(1.0f);
+        std::memcpy(&objects[itemCount + i], &lamp, sizeof(lamp));
+    }
+
+    // Shadow passes: one layered draw per caster covers all six faces of a light's cube map
+    if (gShadowsEnabled)
+    {
+        glUseProgram(gShadowProgramId);
+        GLint casterIndexLoc = glGetUniformLocation(gShadowProgramId, "uObjectIndex");
+        auto drawCasters = [casterIndexLoc](const std::vector<DrawItem>& casters, size_t firstIndex)
+        {
+            for (size_t i = 0; i < casters.size(); ++i)
+            {
+                glUniform1i(casterIndexLoc, (GLint)(firstIndex + i));
+                glBindVertexArray(casters[i].mesh->vao);
+                glDrawElements(GL_TRIANGLES, casters[i].mesh->nVertices, casters[i].mesh->indexType, 0);
+            }
+        };
+        for (int i = 0; i < SHADOW_LIGHT_COUNT; ++i)
+        {
+            if (!staticPasses[i])
+                continue;
+            gShadowMaps.BeginStaticPass(i, packet.lightPositions[i]);
+            drawCasters(gStaticCasters, staticCasterBase);
+            gShadowMaps.EndPass();
+        }
+        for (int i = 0; i < SHADOW_LIGHT_COUNT && dynamicCasterCount > 0; ++i)
+        {
+            gShadowMaps.BeginDynamicPass(i, packet.lightPositions[i]);
+            drawCasters(packet.dynamicCasters, dynamicCasterBase);
+            gShadowMaps.EndPass();
+        }
+        gShadowMaps.Bind(SHADOW_TEXTURE_UNIT);
+    }
+
+    // Compact vertex layouts need the decoding vertex shader; lightmapped meshes use the baked lighting shader
+    bool full = gVertexFormat == VERTEX_FORMAT_FULL;
+    GLuint programIds[2] = { full ? gCubeProgramId : gCompactProgramId, full ? gLightmapProgramId : gCompactLightmapProgramId };
+    if (gLightmapTexture)
+    {
+        glActiveTexture(GL_TEXTURE0 + LIGHTMAP_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, gLightmapTexture);
+    }
+
+    // Draw the visible objects
+    int currentProgram = -1;
+    GLint objectIndexLoc = -1;
+    for (size_t i = 0; i < itemCount; ++i)
+    {
+        const DrawItem& item = packet.drawItems[i];
+        int program = item.mesh->lightmapVbo ? 1 : 0;
+        if (program != currentProgram)
+        {
+            currentProgram = program;
+            glUseProgram(programIds[program]);
+            objectIndexLoc = glGetUniformLocation(programIds[program], "uObjectIndex");
+        }
+        renderObject(*item.mesh, (GLint)i, item.texture, objectIndexLoc);
+    }
+
+    // Render each light
+    glUseProgram(gLampProgramId);
+    GLint lampIndexLoc = glGetUniformLocation(gLampProgramId, "uObjectIndex");
+    glBindVertexArray(gMeshCube.vao);
+    for (int i = 0; i < 3; ++i) {
+        glUniform1i(lampIndexLoc, (GLint)itemCount + i);
+        glDrawElements(GL_TRIANGLES, gMeshCube.nVertices, gMeshCube.indexType, 0);
+    }
+
+    // The GPU is done with this frame's data once the commands issued so far complete
+    gFrameRing.EndFrame();
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// Writes the frame constants into the next section of the frame ring buffer, binds the section to the shaders
+// and returns where the per-object data of objectCount objects goes. Call gFrameRing.EndFrame() after the draws.
+// Returns nullptr when the buffer can't be created.
+ObjectUniforms* UBeginFrameData(const FrameUniforms& frame, size_t objectCount)
+{
+    // grow (with headroom) when the scene no longer fits a section
+    size_t objectsOffset = gFrameRing.Align(sizeof(FrameUniforms));
+    size_t objectsSize = objectCount * sizeof(ObjectUniforms);
+    if (!gFrameRing.Buffer() || objectsOffset + objectsSize > gFrameRing.SectionSize())
+    {
+        if (!gFrameRing.Create(objectsOffset + objectsSize * 2))
+        {
+            ULOG_ERROR << "Failed to create the persistently mapped frame data buffer";
+            return nullptr;
+        }
+    }
+
+    unsigned char* section = gFrameRing.BeginFrame();
+    std::memcpy(section, &frame, sizeof(frame));
+
+    size_t sectionOffset = gFrameRing.SectionOffset();
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, gFrameRing.Buffer(), sectionOffset, sizeof(FrameUniforms));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, OBJECT_DATA_BINDING, gFrameRing.Buffer(), sectionOffset + objectsOffset, objectsSize > 0 ? objectsSize : sizeof(ObjectUniforms));
+    return (ObjectUniforms*)(section + objectsOffset);
+}
+
+// render given object with its entry in the object buffer and texture
+void renderObject(const GLMesh& mesh, GLint objectIndex, GLuint textureID, GLint objectIndexLoc)
+{
+    glUniform1i(objectIndexLoc, objectIndex);
     glBindVertexArray(mesh.vao);
 
     // bind textures on corresponding texture units
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, textureID);
 
-    glDrawElements(GL_TRIANGLES, mesh.nVertices, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, mesh.nVertices, mesh.indexType, 0);
     //glBindVertexArray(0);
 }
 
-// Implements the UCreateMesh function
-void UCreateMeshCube(GLMesh& mesh)
+// Builds the vertex and index data of a unit cube
+void UBuildMeshCube(MeshData& data)
 {
     // Vertex data for cube with texture coordinates
     GLfloat verts[] = {
@@ -764,40 +1908,12 @@ void UCreateMeshCube(GLMesh& mesh)
     };
 
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
-
-    mesh.nVertices = sizeof(indices) / sizeof(indices[0]);
-
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
-
-    // VBO
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
-
-    // EBO
-    glGenBuffers(1, &mesh.ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    data.vertices.assign(verts, verts + sizeof(verts) / sizeof(verts[0]));
+    data.indices.assign(indices, indices + sizeof(indices) / sizeof(indices[0]));
 }
 
 // plane shape (table surface)
-void UCreateMeshPlane(GLMesh& mesh)
+void UBuildMeshPlane(MeshData& data)
 {
     // Vertex data for plane
     GLfloat verts[] = {
@@ -812,39 +1928,11 @@ void UCreateMeshPlane(GLMesh& mesh)
         0, 1, 2, 0, 2, 3 // Base
     };
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
-
-    mesh.nVertices = sizeof(indices) / sizeof(indices[0]);
-
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
-
-    // VBO
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
-
-    // EBO
-    glGenBuffers(1, &mesh.ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    data.vertices.assign(verts, verts + sizeof(verts) / sizeof(verts[0]));
+    data.indices.assign(indices, indices + sizeof(indices) / sizeof(indices[0]));
 }
 
-void UCreateMeshPyramid(GLMesh& mesh)
+void UBuildMeshPyramid(MeshData& data)
 {
     // Vertex data for pyramid with texture coordinates and normals
     GLfloat verts[] = {
@@ -886,11 +1974,80 @@ void UCreateMeshPyramid(GLMesh& mesh)
         13, 14, 15  // Left
     };
 
+    data.vertices.assign(verts, verts + sizeof(verts) / sizeof(verts[0]));
+    data.indices.assign(indices, indices + sizeof(indices) / sizeof(indices[0]));
+}
+
+void UBuildMeshCylinder(MeshData& data) {
+    const int segments = 12; // cylinder sides
+    const float height = 1.0f;
+    const float radius = 0.15f;
+
+    GenMeshSize size = CylinderMeshSize(segments);
+    data.vertices.resize(size.vertexCount * MeshData::FLOATS_PER_VERTEX);
+    data.indices.resize(size.indexCount);
+    GenerateCylinder(segments, radius, height, data.vertices.data(), data.indices.data());
+}
+
+void UBuildMeshSphere(MeshData& data, int sectorCount, int stackCount) {
+    const float radius = 1.0f;
+
+    GenMeshSize size = SphereMeshSize(sectorCount, stackCount);
+    data.vertices.resize(size.vertexCount * MeshData::FLOATS_PER_VERTEX);
+    data.indices.resize(size.indexCount);
+    GenerateSphere(sectorCount, stackCount, radius, data.vertices.data(), data.indices.data());
+}
+
+// Converts mesh data to the bytes uploaded to the GPU: vertices in the requested layout and 16-bit indices
+// whenever the mesh has few enough vertices. header receives the counts, sizes and bounds.
+void UEncodeMesh(const MeshData& data, VertexFormat format, MeshFileHeader& header, std::vector<unsigned char>& vertexBytes, std::vector<unsigned char>& indexBytes)
+{
+    glm::vec3 boundsMin, boundsMax;
+    UComputeMeshBounds(data, boundsMin, boundsMax);
+    size_t vertexCount = data.vertices.size() / MeshData::FLOATS_PER_VERTEX;
+    EncodeVertices(data.vertices.data(), vertexCount, format, boundsMin, boundsMax, vertexBytes);
+
+    std::memset(&header, 0, sizeof(header));
+    header.vertexFormat = (uint32_t)format;
+    header.vertexStride = (uint32_t)VertexStride(format);
+    header.vertexCount = (uint32_t)vertexCount;
+    header.indexCount = (uint32_t)data.indices.size();
+    header.indexSize = vertexCount <= 65536 ? sizeof(GLushort) : sizeof(GLuint);
+    for (int i = 0; i < 3; ++i)
+    {
+        header.boundsMin[i] = boundsMin[i];
+        header.boundsMax[i] = boundsMax[i];
+    }
+
+    indexBytes.resize(data.indices.size() * header.indexSize);
+    if (header.indexSize == sizeof(GLushort))
+    {
+        GLushort* shortIndices = (GLushort*)indexBytes.data();
+        for (size_t i = 0; i < data.indices.size(); ++i)
+            shortIndices[i] = (GLushort)data.indices[i];
+    }
+    else if (!data.indices.empty())
+    {
+        std::memcpy(indexBytes.data(), data.indices.data(), indexBytes.size());
+    }
+}
+
+// Creates the GPU buffers of a mesh from already encoded vertices and indices (e.g. straight from a mapped mesh file)
+void UUploadMesh(GLMesh& mesh, const MeshFileHeader& header, const void* vertices, const void* indices)
+{
     const GLuint floatsPerVertex = 3;
     const GLuint floatsPerNormal = 3;
     const GLuint floatsPerUV = 2;
 
-    mesh.nVertices = sizeof(indices) / sizeof(indices[0]);
+    VertexFormat format = (VertexFormat)header.vertexFormat;
+    mesh.nVertices = header.indexCount;
+    mesh.format = format;
+    mesh.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    mesh.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    mesh.indexType = header.indexSize == sizeof(GLushort) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.raster = nullptr;
+    mesh.lightmapVbo = 0;
+    mesh.pick = nullptr;
 
     glGenVertexArrays(1, &mesh.vao);
     glBindVertexArray(mesh.vao);
@@ -898,197 +2055,343 @@ void UCreateMeshPyramid(GLMesh& mesh)
     // VBO
     glGenBuffers(1, &mesh.vbo);
     glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)header.vertexStride * header.vertexCount, vertices, GL_STATIC_DRAW);
 
     // EBO
     glGenBuffers(1, &mesh.ebo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)header.indexSize * header.indexCount, indices, GL_STATIC_DRAW);
 
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
+    GLint stride = (GLint)header.vertexStride; // The number of bytes before each
 
     // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+    if (format == VERTEX_FORMAT_FULL)
+    {
+        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+        glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+        glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
+    }
+    else if (format == VERTEX_FORMAT_COMPACT)
+    {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(CompactVertex, position));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, normal));
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(CompactVertex, uv));
+    }
+    else
+    {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(QuantizedVertex, position));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(QuantizedVertex, normal));
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(QuantizedVertex, uv));
+    }
     glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
     glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
     glEnableVertexAttribArray(2);
 }
 
-void UCreateMeshCylinder(GLMesh& mesh) {
-    int segments = 12; // cylinder sides
-    float height = 1.0f;
-    float radius = 0.15f;
-
-    std::vector<float> vertices;
-    std::vector<int> indices;
-    float segmentAngle = 2 * 3.14159 / segments;
+// Uploads mesh data to the GPU, converting the vertices to the requested layout
+void UCreateMesh(GLMesh& mesh, const MeshData& data, VertexFormat format)
+{
+    MeshFileHeader header;
+    std::vector<unsigned char> vertexBytes, indexBytes;
+    UEncodeMesh(data, format, header, vertexBytes, indexBytes);
+    UUploadMesh(mesh, header, vertexBytes.data(), indexBytes.data());
+}
 
-    // Generate vertices for the cylinder sides
-    for (int i = 0; i <= segments; ++i) {
-        float angle = i * segmentAngle;
-        float x = cos(angle) * radius;
-        float z = sin(angle) * radius;
+// Uploads a generated mesh from its cache file when there is a valid one; otherwise builds and optimizes
+// the mesh, uploads it and writes the cache file for the next run
+void UCreateMeshCached(GLMesh& mesh, const char* name, void (*build)(MeshData& data))
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.%s.mesh", MESH_CACHE_DIRECTORY, name, VERTEX_FORMAT_NAMES[gVertexFormat]);
 
-        // Top vertex
-        vertices.insert(vertices.end(), { x, height / 2, z, x, 0, z, (float)i / segments, 1.0f });
-        // Bottom vertex
-        vertices.insert(vertices.end(), { x, -height / 2, z, x, 0, z, (float)i / segments, 0.0f });
+    if (gUseMeshCache && !gSoftwareRendering && !gLightmapping && !gOcclusionCulling)
+    {
+        // the buffers are filled directly from the mapped file, which is unmapped once they are uploaded
+        MeshFile file;
+        if (file.Open(path) && file.Header().vertexFormat == (uint32_t)gVertexFormat)
+        {
+            UUploadMesh(mesh, file.Header(), file.Vertices(), file.Indices());
+            UCreatePickMesh(mesh, file.Vertices(), file.Header().vertexCount, gVertexFormat, file.Indices(), file.Header().indexSize, file.Header().indexCount);
+            ULOG_INFO << "Mesh " << name << ": loaded from " << path;
+            return;
+        }
     }
 
-    // Indices for the sides
-    for (int i = 0; i < segments; ++i) {
-        int base = i * 2;
-        indices.insert(indices.end(), { base, base + 1, base + 3, base, base + 3, base + 2 });
+    MeshData data;
+    build(data);
+    UOptimizeMesh(data, name);
+    if (gSoftwareRendering)
+    {
+        UCreateRasterMesh(mesh, data);
+        return;
     }
 
-    // Function to add cap vertices and indices
-    auto addCap = [&](float y, bool top) {
-        // Center vertex for the cap
-        int centerIndex = vertices.size() / 8;
-        vertices.insert(vertices.end(), { 0, y, 0, 0, top ? 1.0f : -1.0f, 0, 0.5f, 0.5f });
-
-        // Edge vertices for the cap
-        for (int i = 0; i <= segments; ++i) {
-            float angle = i * segmentAngle;
-            float x = cos(angle) * radius;
-            float z = sin(angle) * radius;
-            vertices.insert(vertices.end(), { x, y, z, 0, top ? 1.0f : -1.0f, 0, x * 0.5f + 0.5f, z * 0.5f + 0.5f });
-        }
+    MeshFileHeader header;
+    std::vector<unsigned char> vertexBytes, indexBytes;
+    UEncodeMesh(data, gVertexFormat, header, vertexBytes, indexBytes);
+    UUploadMesh(mesh, header, vertexBytes.data(), indexBytes.data());
+    UCreatePickMesh(mesh, vertexBytes.data(), header.vertexCount, gVertexFormat, indexBytes.data(), header.indexSize, header.indexCount);
+    if (gLightmapping || gOcclusionCulling)
+        mesh.raster = UKeepMeshData(data);
 
-        // Indices for the cap
-        for (int i = 0; i < segments; ++i) {
-            indices.push_back(centerIndex);
-            indices.push_back(centerIndex + i + 1);
-            indices.push_back(centerIndex + i + 2);
-        }
-    };
+    if (gUseMeshCache && !WriteMeshFile(path, header, vertexBytes.data(), indexBytes.data()))
+        ULOG_WARNING << "Failed to write mesh cache file " << path;
+}
 
-    // Add top and bottom caps
-    addCap(height / 2, true);  // Top cap
-    addCap(-height / 2, false); // Bottom cap
+// Returns the matrix that maps quantized positions back to local space (identity for float positions)
+glm::mat4 UDequantizeMatrix(const GLMesh& mesh)
+{
+    if (mesh.format != VERTEX_FORMAT_QUANTIZED)
+        return glm::mat4(1.0f);
+    return glm::translate(mesh.boundsMin) * glm::scale(mesh.boundsMax - mesh.boundsMin);
+}
 
-    // Setup mesh (VBO, VAO, EBO)
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
+// Computes the local space bounding box of the vertex positions
+void UComputeMeshBounds(const MeshData& data, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+    boundsMin = glm::vec3(0.0f);
+    boundsMax = glm::vec3(0.0f);
+    for (size_t i = 0; i < data.vertices.size(); i += MeshData::FLOATS_PER_VERTEX)
+    {
+        glm::vec3 position(data.vertices[i], data.vertices[i + 1], data.vertices[i + 2]);
+        boundsMin = i == 0 ? position : glm::min(boundsMin, position);
+        boundsMax = i == 0 ? position : glm::max(boundsMax, position);
+    }
+}
 
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+// Reorders triangles for the vertex cache and overdraw and vertices for fetch locality, printing the cache statistics
+void UOptimizeMesh(MeshData& data, const char* name)
+{
+    size_t vertexCount = data.vertices.size() / MeshData::FLOATS_PER_VERTEX;
+    VertexCacheStats before = AnalyzeVertexCache(data.indices, vertexCount);
 
-    glGenBuffers(1, &mesh.ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    OptimizeVertexCache(data.indices, vertexCount);
+    OptimizeOverdraw(data.indices, data.vertices.data(), MeshData::FLOATS_PER_VERTEX, vertexCount);
+    vertexCount = OptimizeVertexFetch(data.vertices, data.indices, MeshData::FLOATS_PER_VERTEX);
 
-    // Position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // Normal attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    // Texture coords attribute
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    VertexCacheStats after = AnalyzeVertexCache(data.indices, vertexCount);
+    ULOG_INFO << "Mesh " << name << ": " << vertexCount << " vertices, " << data.indices.size() / 3 << " triangles, ACMR "
+        << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr;
+}
 
-    mesh.nVertices = indices.size();
+void UCreateMeshCube(GLMesh& mesh)
+{
+    UCreateMeshCached(mesh, "cube", UBuildMeshCube);
 }
 
-void UCreateMeshSphere(GLMesh& mesh) {
-        int sectorCount = 24;
-        int stackCount = 12;
-        float radius = 1.0f;
-        float M_PI = 3.14159;
+void UCreateMeshPlane(GLMesh& mesh)
+{
+    UCreateMeshCached(mesh, "plane", UBuildMeshPlane);
+}
 
-        std::vector<float> vertices;
-        std::vector<int> indices;
+void UCreateMeshPyramid(GLMesh& mesh)
+{
+    UCreateMeshCached(mesh, "pyramid", UBuildMeshPyramid);
+}
 
-        float x, y, z, xy;                              // vertex position
-        float nx, ny, nz, lengthInv = 1.0f / radius;    // vertex normal
-        float s, t;                                     // vertex texCoord
+void UCreateMeshCylinder(GLMesh& mesh)
+{
+    UCreateMeshCached(mesh, "cylinder", UBuildMeshCylinder);
+}
 
-        float sectorStep = 2 * M_PI / sectorCount;
-        float stackStep = M_PI / stackCount;
-        float sectorAngle, stackAngle;
+void UCreateMeshSphere(GLMesh& mesh)
+{
+    UCreateMeshCached(mesh, "sphere", [](MeshData& data) { UBuildMeshSphere(data); });
+}
 
-        for (int i = 0; i <= stackCount; ++i) {
-            stackAngle = M_PI / 2 - i * stackStep;        // starting from pi/2 to -pi/2
-            xy = radius * cosf(stackAngle);             // r * cos(u)
-            z = radius * sinf(stackAngle);              // r * sin(u)
+// Loads an OBJ or glTF binary file, optimizes it like the generated meshes and uploads it
+bool UImportMesh(GLMesh& mesh, const char* path)
+{
+    MeshData data;
+    std::string error;
+    auto start = std::chrono::steady_clock::now();
+    if (!ImportMesh(path, *gJobs, data.vertices, data.indices, error))
+    {
+        ULOG_ERROR << "Failed to import " << path << ": " << error;
+        return false;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    ULOG_INFO << "Imported " << path << " in " << ms << " ms";
 
-            // add (sectorCount+1) vertices per stack
-            for (int j = 0; j <= sectorCount; ++j) {
-                sectorAngle = j * sectorStep;           // starting from 0 to 2pi
+    UOptimizeMesh(data, path);
+    if (gSoftwareRendering)
+    {
+        UCreateRasterMesh(mesh, data);
+        return true;
+    }
+    UCreateMesh(mesh, data, gVertexFormat);
+    UCreatePickMesh(mesh, data.vertices.data(), data.vertices.size() / MeshData::FLOATS_PER_VERTEX, VERTEX_FORMAT_FULL, data.indices.data(), sizeof(GLuint), data.indices.size());
+    if (gLightmapping || gOcclusionCulling)
+        mesh.raster = UKeepMeshData(data);
+    return true;
+}
 
-                // vertex position (x, y, z)
-                x = xy * cosf(sectorAngle);             // r * cos(u) * cos(v)
-                y = xy * sinf(sectorAngle);             // r * cos(u) * sin(v)
-                // normalized vertex normal (nx, ny, nz)
-                nx = x * lengthInv;
-                ny = y * lengthInv;
-                nz = z * lengthInv;
-                // vertex tex coord (s, t) range between [0, 1]
-                s = (float)j / sectorCount;
-                t = (float)i / stackCount;
+// Keeps the mesh on the CPU for the software rasterizer; the GL handles stay zero
+void UCreateRasterMesh(GLMesh& mesh, const MeshData& data)
+{
+    mesh.vao = mesh.vbo = mesh.ebo = mesh.lightmapVbo = 0;
+    mesh.nVertices = (GLuint)data.indices.size();
+    UComputeMeshBounds(data, mesh.boundsMin, mesh.boundsMax);
+    mesh.format = VERTEX_FORMAT_FULL;
+    mesh.indexType = GL_UNSIGNED_INT;
+    mesh.raster = UKeepMeshData(data);
+    mesh.pick = nullptr;
+    UCreatePickMesh(mesh, data.vertices.data(), data.vertices.size() / MeshData::FLOATS_PER_VERTEX, VERTEX_FORMAT_FULL, data.indices.data(), sizeof(GLuint), data.indices.size());
+}
 
-                vertices.insert(vertices.end(), { x, y, z, nx, ny, nz, s, t });
-            }
-        }
+// Keeps the positions of a mesh (in any vertex format) with a BVH over its triangles for picking
+void UCreatePickMesh(GLMesh& mesh, const void* vertices, size_t vertexCount, VertexFormat format, const void* indices, size_t indexSize, size_t indexCount)
+{
+    gPickMeshes.emplace_back();
+    gPickMeshes.back().Build(vertices, vertexCount, format, mesh.boundsMin, mesh.boundsMax, indices, indexSize, indexCount);
+    mesh.pick = &gPickMeshes.back();
+}
 
-        int k1, k2;
-        for (int i = 0; i < stackCount; ++i) {
-            k1 = i * (sectorCount + 1);     // beginning of current stack
-            k2 = k1 + sectorCount + 1;      // beginning of next stack
-
-            for (int j = 0; j < sectorCount; ++j, ++k1, ++k2) {
-                // 2 triangles per sector excluding 1st and last stacks
-                // k1 => k2 => k1+1
-                if (i != 0) {
-                    indices.push_back(k1);
-                    indices.push_back(k2);
-                    indices.push_back(k1 + 1);
-                }
+// Stores a CPU copy of mesh data that lives until the program exits
+const RasterMesh* UKeepMeshData(const MeshData& data)
+{
+    gRasterMeshes.emplace_back();
+    RasterMesh& raster = gRasterMeshes.back();
+    raster.vertices.assign(data.vertices.begin(), data.vertices.end());
+    raster.indices.assign(data.indices.begin(), data.indices.end());
+    return &raster;
+}
 
-                // k1+1 => k2 => k2+1
-                if (i != (stackCount - 1)) {
-                    indices.push_back(k1 + 1);
-                    indices.push_back(k2);
-                    indices.push_back(k2 + 1);
-                }
+// Bakes the ambient and diffuse lighting of every static scene object into a lightmap atlas, or loads it from the
+// cache when the scene, the lights and the settings are unchanged, then gives each object its own copy of its mesh
+// with lightmap coordinates. Lamp 0 can orbit, so only its light factor is baked and its color applied at runtime.
+// Dynamic objects keep their meshes and are lit per pixel; they neither receive nor occlude baked light.
+bool UBakeLightmap()
+{
+    gTransforms.Update();
+    LightmapBaker baker;
+    for (const SceneObject& object : gSceneObjects)
+    {
+        if (object.dynamic)
+            continue;
+        const RasterMesh& cpu = *object.mesh->raster;
+        const glm::mat4& model = gTransforms.GetWorldMatrix(object.transform);
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+        baker.BeginObject();
+        for (size_t i = 0; i + 2 < cpu.indices.size(); i += 3)
+        {
+            glm::vec3 positions[3], normals[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                const float* vertex = &cpu.vertices[(size_t)cpu.indices[i + k] * RASTER_FLOATS_PER_VERTEX];
+                positions[k] = glm::vec3(model * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f));
+                normals[k] = normalMatrix * glm::vec3(vertex[3], vertex[4], vertex[5]);
             }
+            baker.AddTriangle(positions, normals);
         }
+    }
+    baker.Pack(gLightmapSettings);
+
+    LightmapLight staticLights[2] = { { gLightPosition2, gLightColor2 }, { gLightPosition3, gLightColor3 } };
+    gLightmapLampPosition = gLightPosition;
+    uint64_t hash = baker.Hash(staticLights, 2, gLightmapLampPosition);
+    char path[256];
+    snprintf(path, sizeof(path), "%s/scene.lightmap", MESH_CACHE_DIRECTORY);
+    if (gUseMeshCache && ReadLightmapFile(path, hash, baker.Width(), baker.Height(), baker.Texels()))
+    {
+        ULOG_INFO << "Lightmap: " << baker.Width() << "x" << baker.Height() << " loaded from " << path;
+    }
+    else
+    {
+        auto start = std::chrono::steady_clock::now();
+        baker.Bake(staticLights, 2, gLightmapLampPosition, *gJobs);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        ULOG_INFO << "Lightmap: baked " << baker.TriangleCount() << " triangles into " << baker.Width() << "x" << baker.Height() << " in " << ms
+            << " ms on " << gJobs->ThreadCount() << " threads (" << gLightmapSettings.aoRays << " ambient occlusion rays per texel)";
+        if (gUseMeshCache && !WriteLightmapFile(path, hash, baker.Width(), baker.Height(), baker.Texels()))
+            ULOG_WARNING << "Failed to write lightmap cache file " << path;
+    }
 
-        // Setup mesh (VBO, VAO, EBO)
-        glGenVertexArrays(1, &mesh.vao);
-        glBindVertexArray(mesh.vao);
-
-        glGenBuffers(1, &mesh.vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
-
-        glGenBuffers(1, &mesh.ebo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+    glGenTextures(1, &gLightmapTexture);
+    glBindTexture(GL_TEXTURE_2D, gLightmapTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, baker.Width(), baker.Height(), 0, GL_RGBA, GL_HALF_FLOAT, baker.Texels().data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Neighbouring triangles have separate charts, so every corner becomes its own vertex
+    size_t triangle = 0;
+    for (SceneObject& object : gSceneObjects)
+    {
+        if (object.dynamic)
+            continue;
+        const RasterMesh& cpu = *object.mesh->raster;
+        MeshData data;
+        std::vector<glm::vec2> coordinates;
+        for (size_t i = 0; i < cpu.indices.size(); ++i)
+        {
+            const float* vertex = &cpu.vertices[(size_t)cpu.indices[i] * RASTER_FLOATS_PER_VERTEX];
+            data.vertices.insert(data.vertices.end(), vertex, vertex + RASTER_FLOATS_PER_VERTEX);
+            data.indices.push_back((GLuint)i);
+            coordinates.push_back(baker.TexCoord(triangle + i / 3, (int)(i % 3)));
+        }
+        triangle += cpu.indices.size() / 3;
+
+        gLightmapMeshes.emplace_back();
+        GLMesh& mesh = gLightmapMeshes.back();
+        UCreateMesh(mesh, data, gVertexFormat);
+        mesh.raster = object.mesh->raster;
+        mesh.pick = object.mesh->pick;
+
+        // the mesh's VAO is still bound after the upload
+        glGenBuffers(1, &mesh.lightmapVbo);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.lightmapVbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(sizeof(glm::vec2) * coordinates.size()), coordinates.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), 0);
+        glEnableVertexAttribArray(3);
+        glBindVertexArray(0);
+
+        object.mesh = &mesh;
+    }
+    return true;
+}
 
-        // Position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-        // Normal attribute
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-        // Texture coords attribute
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-        glEnableVertexAttribArray(2);
+// Generates a unit sphere straight into mapped GL buffers: full vertex format, no intermediate copy and no optimization pass
+void UCreateMeshSphereMapped(GLMesh& mesh, int sectorCount, int stackCount)
+{
+    GenMeshSize size = SphereMeshSize(sectorCount, stackCount);
+    MeshFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.vertexFormat = VERTEX_FORMAT_FULL;
+    header.vertexStride = (uint32_t)VertexStride(VERTEX_FORMAT_FULL);
+    header.vertexCount = (uint32_t)size.vertexCount;
+    header.indexCount = (uint32_t)size.indexCount;
+    header.indexSize = size.vertexCount <= 65536 ? sizeof(GLushort) : sizeof(GLuint);
+    for (int i = 0; i < 3; ++i)
+    {
+        header.boundsMin[i] = -1.0f;
+        header.boundsMax[i] = 1.0f;
+    }
 
-        mesh.nVertices = indices.size();
+    // allocate the buffers, then fill them in place (the mesh's VAO and buffers are still bound)
+    UUploadMesh(mesh, header, nullptr, nullptr);
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+    float* vertices = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, (GLsizeiptr)header.vertexStride * header.vertexCount, access);
+    void* indices = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, (GLsizeiptr)header.indexSize * header.indexCount, access);
+    if (vertices && indices)
+    {
+        if (header.indexSize == sizeof(GLushort))
+            GenerateSphere(sectorCount, stackCount, 1.0f, vertices, (GLushort*)indices);
+        else
+            GenerateSphere(sectorCount, stackCount, 1.0f, vertices, (GLuint*)indices);
+    }
+    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
 }
 
 void UDestroyMesh(GLMesh& mesh)
 {
     glDeleteVertexArrays(1, &mesh.vao);
     glDeleteBuffers(1, &mesh.vbo);
+    glDeleteBuffers(1, &mesh.ebo);
+    glDeleteBuffers(1, &mesh.lightmapVbo);
 }
 
 /*Generate and load the texture*/
@@ -1096,6 +2399,15 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
 {
     int width, height, channels;
     unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
+    if (image && gSoftwareRendering)
+    {
+        flipImageVertically(image, width, height, channels);
+        gRasterTextures.emplace_back();
+        bool created = gRasterTextures.back().Create(image, width, height, channels);
+        textureId = (GLuint)gRasterTextures.size();
+        stbi_image_free(image);
+        return created;
+    }
     if (image)
     {
         flipImageVertically(image, width, height, channels);
@@ -1116,7 +2428,7 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
         else
         {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
+            ULOG_ERROR << "Not implemented to handle image with " << channels << " channels";
             return false;
         }
 
@@ -1143,8 +2455,19 @@ void UDestroyTexture(GLuint textureId)
 }
 
 
+// Hands a shader's source to GL with the shared declarations inserted after its #version line
+void UShaderSource(GLuint shaderId, const char* source, bool objectData)
+{
+    const char* newline = strchr(source, '\n');
+    GLint versionLength = newline ? (GLint)(newline - source + 1) : 0;
+    const GLchar* strings[] = { source, frameDataShaderSource, objectData ? objectDataShaderSource : "", source + versionLength };
+    GLint lengths[] = { versionLength, -1, -1, -1 }; // negative: null terminated
+    glShaderSource(shaderId, 4, strings, lengths);
+}
+
+
 // Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId, const char* geomShaderSource)
 {
     // Compilation and linkage error reporting
     int success = 0;
@@ -1158,8 +2481,8 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
 
     // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+    UShaderSource(vertexShaderId, vtxShaderSource, true);
+    UShaderSource(fragmentShaderId, fragShaderSource, false);
 
     // Compile the vertex shader, and print compilation errors (if any)
     glCompileShader(vertexShaderId); // compile the vertex shader
@@ -1168,7 +2491,7 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+        ULOG_ERROR << "Vertex shader compilation failed:\n" << infoLog;
 
         return false;
     }
@@ -1179,11 +2502,28 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+        ULOG_ERROR << "Fragment shader compilation failed:\n" << infoLog;
 
         return false;
     }
 
+    // Optional geometry shader
+    if (geomShaderSource)
+    {
+        GLuint geometryShaderId = glCreateShader(GL_GEOMETRY_SHADER);
+        UShaderSource(geometryShaderId, geomShaderSource, false);
+        glCompileShader(geometryShaderId);
+        glGetShaderiv(geometryShaderId, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(geometryShaderId, sizeof(infoLog), NULL, infoLog);
+            ULOG_ERROR << "Geometry shader compilation failed:\n" << infoLog;
+
+            return false;
+        }
+        glAttachShader(programId, geometryShaderId);
+    }
+
     // Attached compiled shaders to the shader program
     glAttachShader(programId, vertexShaderId);
     glAttachShader(programId, fragmentShaderId);
@@ -1194,7 +2534,7 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        ULOG_ERROR << "Shader program linking failed:\n" << infoLog;
 
         return false;
     }
@@ -1209,3 +2549,882 @@ void UDestroyShaderProgram(GLuint programId)
 {
     glDeleteProgram(programId);
 }
+
+
+// Times TransformHierarchy::Update on a synthetic scene of parented objects (body + 2 prongs, like the charger)
+void UBenchmarkTransforms(int objectCount)
+{
+    const int frames = 200;
+    TransformHierarchy transforms;
+    std::vector<TransformHandle> handles;
+
+    for (int i = 0; i + 3 <= objectCount; i += 3)
+    {
+        glm::vec3 position((float)(i % 100), 0.0f, (float)(i / 100));
+        TransformHandle body = transforms.Create(position, 0.0f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.55f, 1.0f, 0.7f));
+        handles.push_back(body);
+        handles.push_back(transforms.Create(glm::vec3(0.0f, 0.65f, 0.22f), 1.571f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.01f, 0.30f, 0.2f), body));
+        handles.push_back(transforms.Create(glm::vec3(0.0f, 0.65f, -0.22f), 1.571f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.01f, 0.30f, 0.2f), body));
+    }
+    transforms.Update();
+
+    // Every object animated each frame
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        for (size_t i = 0; i < handles.size(); ++i)
+            transforms.SetRotation(handles[i], frame * 0.01f + i, glm::vec3(0.0f, 1.0f, 0.0f));
+        transforms.Update();
+    }
+    double allMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / frames;
+
+    // Only the parents animated; children are updated through the hierarchy
+    start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        for (size_t i = 0; i < handles.size(); i += 3)
+            transforms.SetRotation(handles[i], frame * 0.01f + i, glm::vec3(0.0f, 1.0f, 0.0f));
+        transforms.Update();
+    }
+    double parentsMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / frames;
+
+    // Nothing moved
+    start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < frames; ++frame)
+        transforms.Update();
+    double staticMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / frames;
+
+    ULOG_INFO << "Transform update, " << transforms.Count() << " objects:";
+    ULOG_INFO << "  all animated:     " << allMs << " ms/frame";
+    ULOG_INFO << "  parents animated: " << parentsMs << " ms/frame";
+    ULOG_INFO << "  static:           " << staticMs << " ms/frame";
+}
+
+
+// Measures how transform updates, culling and draw list building scale from 1 to N threads
+// on a large synthetic scene made from the generated meshes
+void UBenchmarkJobs(int objectCount)
+{
+    const int frames = 100;
+
+    // Only the bounds of the generated meshes are needed, so no GL buffers are created
+    MeshData meshData[5];
+    UBuildMeshCube(meshData[0]);
+    UBuildMeshPlane(meshData[1]);
+    UBuildMeshPyramid(meshData[2]);
+    UBuildMeshCylinder(meshData[3]);
+    UBuildMeshSphere(meshData[4]);
+    GLMesh meshes[5] = {};
+    for (int i = 0; i < 5; ++i)
+        UComputeMeshBounds(meshData[i], meshes[i].boundsMin, meshes[i].boundsMax);
+
+    // Objects scattered over a large desk, every third one a parent with two children
+    TransformHierarchy transforms;
+    std::vector<SceneObject> objects;
+    std::vector<TransformHandle> parents;
+    int side = (int)std::sqrt((float)objectCount) + 1;
+    for (int i = 0; i < objectCount; ++i)
+    {
+        TransformHandle parent = i % 3 == 0 ? INVALID_TRANSFORM : parents.back();
+        glm::vec3 position = parent == INVALID_TRANSFORM ? glm::vec3((float)(i % side) - side * 0.5f, 0.0f, (float)(i / side) - side * 0.5f) : glm::vec3(0.0f, 0.65f, i % 3 == 1 ? 0.22f : -0.22f);
+        TransformHandle handle = transforms.Create(position, 0.0f, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.5f), parent);
+        if (parent == INVALID_TRANSFORM)
+            parents.push_back(handle);
+        objects.push_back({ &meshes[i % 5], 0, handle });
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 20.0f, side * 0.5f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+    Frustum frustum = ExtractFrustum(projection * view);
+    std::vector<DrawItem> drawList;
+    BVH bvh;
+
+    ULOG_INFO << "Transform update + BVH refit + culling + draw list, " << objectCount << " objects:";
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    double singleThreadMs = 0.0;
+    for (unsigned threads = 1; threads <= maxThreads; threads = threads * 2 > maxThreads && threads != maxThreads ? maxThreads : threads * 2)
+    {
+        JobSystem jobs(threads);
+        auto runFrame = [&](int frame)
+        {
+            // Animate every parent; the children follow through the hierarchy
+            jobs.ParallelFor((int)parents.size(), 4096, [&](int first, int last)
+            {
+                for (int i = first; i < last; ++i)
+                    transforms.SetRotation(parents[i], frame * 0.02f + i, glm::vec3(0.0f, 1.0f, 0.0f));
+            });
+            UUpdateTransforms(jobs, transforms);
+            UBuildDrawList(jobs, objects, transforms, bvh, frustum, drawList);
+        };
+
+        runFrame(0); // warm up
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int frame = 1; frame <= frames; ++frame)
+            runFrame(frame);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / frames;
+        if (threads == 1)
+            singleThreadMs = ms;
+
+        ULOG_INFO << "  " << threads << " thread(s): " << ms << " ms/frame, speedup " << singleThreadMs / ms << "x, " << drawList.size() << " visible";
+    }
+}
+
+
+// Times building and refitting a BVH over random boxes and the frustum, ray and light queries against it,
+// each compared with a brute force loop over every box
+void UBenchmarkBVH(int objectCount)
+{
+    int count = std::max(objectCount, 1);
+    const int passes = 10;
+    auto elapsedMs = [](std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    // Boxes of 0.2 to 1 units scattered through a cube holding about one box per 8 cubic units
+    srand(1);
+    auto random = [](float low, float high) { return low + (high - low) * (float)rand() / (float)RAND_MAX; };
+    float side = 2.0f * std::cbrt((float)count);
+    std::vector<glm::vec3> boundsMin(count), boundsMax(count);
+    for (int i = 0; i < count; ++i)
+    {
+        glm::vec3 center(random(-0.5f, 0.5f) * side, random(-0.5f, 0.5f) * side, random(-0.5f, 0.5f) * side);
+        glm::vec3 halfSize(random(0.1f, 0.5f), random(0.1f, 0.5f), random(0.1f, 0.5f));
+        boundsMin[i] = center - halfSize;
+        boundsMax[i] = center + halfSize;
+    }
+    ULOG_INFO << "BVH over " << count << " boxes:";
+
+    BVH bvh;
+    auto start = std::chrono::high_resolution_clock::now();
+    bvh.Build(boundsMin.data(), boundsMax.data(), count);
+    double buildMs = elapsedMs(start);
+    ULOG_INFO << "  build: " << buildMs << " ms, " << bvh.NodeCount() << " nodes, depth " << bvh.Depth() << ", SAH cost " << bvh.BuiltCost();
+
+    // Frustum of a camera on the edge of the cube looking at its center
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, side)
+        * glm::lookAt(glm::vec3(0.0f, 0.0f, side * 0.5f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = ExtractFrustum(viewProjection);
+    size_t treeVisible = 0, bruteVisible = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        treeVisible = 0;
+        bvh.QueryFrustum(frustum, [&treeVisible](int) { ++treeVisible; });
+    }
+    double treeMs = elapsedMs(start) / passes;
+    start = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        bruteVisible = 0;
+        for (int i = 0; i < count; ++i)
+            bruteVisible += FrustumIntersectsBox(frustum, boundsMin[i], boundsMax[i]) ? 1 : 0;
+    }
+    double bruteMs = elapsedMs(start) / passes;
+    ULOG_INFO << "  frustum: " << treeMs << " ms, brute force " << bruteMs << " ms (" << bruteMs / treeMs << "x), " << treeVisible << " visible"
+        << (treeVisible == bruteVisible ? "" : ", MISMATCH");
+
+    // Refit after moving every 100th box, then after moving all of them
+    auto moveBox = [&](int i)
+    {
+        glm::vec3 offset(random(-1.0f, 1.0f), random(-1.0f, 1.0f), random(-1.0f, 1.0f));
+        boundsMin[i] += offset;
+        boundsMax[i] += offset;
+        bvh.SetObjectBounds(i, boundsMin[i], boundsMax[i]);
+    };
+    std::vector<int> moved;
+    for (int i = 0; i < count; i += 100)
+    {
+        moveBox(i);
+        moved.push_back(i);
+    }
+    start = std::chrono::high_resolution_clock::now();
+    bvh.Refit(moved.data(), moved.size());
+    double partialMs = elapsedMs(start);
+    moved.clear();
+    for (int i = 0; i < count; ++i)
+    {
+        moveBox(i);
+        moved.push_back(i);
+    }
+    start = std::chrono::high_resolution_clock::now();
+    bvh.Refit(moved.data(), moved.size());
+    double fullMs = elapsedMs(start);
+    ULOG_INFO << "  refit: " << partialMs << " ms for " << (count + 99) / 100 << " moved boxes, " << fullMs << " ms for all, SAH cost "
+        << bvh.Cost() << " after refitting (rebuilding takes " << buildMs << " ms)";
+
+    // Nearest box along random rays starting inside the cube
+    const int rayCount = 100000;
+    const int bruteRayCount = std::max(1, std::min(rayCount, 200000000 / count));
+    std::vector<glm::vec3> origins(rayCount), directions(rayCount);
+    for (int i = 0; i < rayCount; ++i)
+    {
+        origins[i] = glm::vec3(random(-0.5f, 0.5f) * side, random(-0.5f, 0.5f) * side, random(-0.5f, 0.5f) * side);
+        directions[i] = glm::normalize(glm::vec3(random(-1.0f, 1.0f), random(-1.0f, 1.0f), random(-1.0f, 1.0f)) + glm::vec3(0.0f, 0.0f, 1e-4f));
+    }
+    std::vector<float> treeDistances(rayCount);
+    int hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < rayCount; ++r)
+    {
+        const glm::vec3& origin = origins[r];
+        glm::vec3 inverse = 1.0f / directions[r];
+        float distance = side;
+        int object = bvh.Raycast(origin, directions[r], distance, [&](int candidate, float maxDistance)
+        {
+            float entry;
+            return BVH::slab(origin, inverse, boundsMin[candidate], boundsMax[candidate], maxDistance, entry) ? entry : -1.0f;
+        });
+        treeDistances[r] = distance;
+        hits += object >= 0 ? 1 : 0;
+    }
+    double treeRayUs = elapsedMs(start) * 1000.0 / rayCount;
+    int mismatches = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < bruteRayCount; ++r)
+    {
+        glm::vec3 inverse = 1.0f / directions[r];
+        float distance = side, entry;
+        for (int i = 0; i < count; ++i)
+            if (BVH::slab(origins[r], inverse, boundsMin[i], boundsMax[i], distance, entry))
+                distance = entry;
+        mismatches += distance == treeDistances[r] ? 0 : 1;
+    }
+    double bruteRayUs = elapsedMs(start) * 1000.0 / bruteRayCount;
+    ULOG_INFO << "  rays: " << treeRayUs << " us per ray, " << hits << " of " << rayCount << " hit; brute force " << bruteRayUs << " us per ray ("
+        << bruteRayUs / treeRayUs << "x), " << mismatches << " of " << bruteRayCount << " checked rays differ";
+
+    // Light assignment: the boxes within reach of each point light
+    const int lightCount = 1000;
+    const float lightRadius = 4.0f;
+    const int bruteLightCount = std::max(1, std::min(lightCount, 100000000 / count));
+    std::vector<glm::vec3> lights(lightCount);
+    for (glm::vec3& light : lights)
+        light = glm::vec3(random(-0.5f, 0.5f) * side, random(-0.5f, 0.5f) * side, random(-0.5f, 0.5f) * side);
+    std::vector<size_t> treeCounts(lightCount, 0);
+    start = std::chrono::high_resolution_clock::now();
+    for (int l = 0; l < lightCount; ++l)
+        bvh.QuerySphere(lights[l], lightRadius, [&treeCounts, l](int) { ++treeCounts[l]; });
+    double treeLightUs = elapsedMs(start) * 1000.0 / lightCount;
+    size_t pairs = 0;
+    for (size_t n : treeCounts)
+        pairs += n;
+    mismatches = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int l = 0; l < bruteLightCount; ++l)
+    {
+        size_t n = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            glm::vec3 d = glm::max(glm::max(boundsMin[i] - lights[l], lights[l] - boundsMax[i]), glm::vec3(0.0f));
+            n += glm::dot(d, d) <= lightRadius * lightRadius ? 1 : 0;
+        }
+        mismatches += n == treeCounts[l] ? 0 : 1;
+    }
+    double bruteLightUs = elapsedMs(start) * 1000.0 / bruteLightCount;
+    ULOG_INFO << "  lights: " << treeLightUs << " us per light of radius " << lightRadius << ", " << pairs << " object-light pairs; brute force "
+        << bruteLightUs << " us per light (" << bruteLightUs / treeLightUs << "x), " << mismatches << " of " << bruteLightCount << " checked lights differ";
+}
+
+
+// Times picking rays through random points of the view against a 4x4 grid of spheres of trianglesPerMesh
+// triangles each, and checks a few of them against testing every triangle of every object
+void UBenchmarkPicking(int trianglesPerMesh)
+{
+    const int rayCount = 10000;
+    const int bruteRayCount = 5;
+    auto elapsedMs = [](std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    int sectors = std::max(8, (int)std::sqrt((float)std::max(trianglesPerMesh, 1)));
+    MeshData sphere;
+    UBuildMeshSphere(sphere, sectors, sectors / 2);
+    auto start = std::chrono::high_resolution_clock::now();
+    GLMesh mesh = {};
+    UComputeMeshBounds(sphere, mesh.boundsMin, mesh.boundsMax);
+    UCreatePickMesh(mesh, sphere.vertices.data(), sphere.vertices.size() / MeshData::FLOATS_PER_VERTEX, VERTEX_FORMAT_FULL, sphere.indices.data(), sizeof(GLuint), sphere.indices.size());
+    double buildMs = elapsedMs(start);
+
+    TransformHierarchy transforms;
+    std::vector<SceneObject> objects;
+    for (int i = 0; i < 16; ++i)
+        objects.push_back({ &mesh, 0, transforms.Create(glm::vec3((i % 4) * 2.5f - 3.75f, (i / 4) * 2.5f - 3.75f, 0.0f), 0.3f * i, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f)) });
+    transforms.Update();
+    std::vector<glm::vec3> boundsMin(objects.size()), boundsMax(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i)
+        TransformBounds(mesh.boundsMin, mesh.boundsMax, transforms.GetWorldMatrix(objects[i].transform), boundsMin[i], boundsMax[i]);
+    BVH bvh;
+    bvh.Build(boundsMin.data(), boundsMax.data(), (int)objects.size());
+
+    size_t triangles = mesh.pick->TriangleCount() * objects.size();
+    ULOG_INFO << "Picking in a scene of " << objects.size() << " spheres, " << triangles << " triangles (triangle BVH built in " << buildMs << " ms):";
+
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f)
+        * glm::lookAt(glm::vec3(0.0f, 0.0f, 14.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    srand(1);
+    auto random = [](float low, float high) { return low + (high - low) * (float)rand() / (float)RAND_MAX; };
+    std::vector<glm::vec3> origins(rayCount), directions(rayCount);
+    std::vector<int> picked(rayCount);
+    std::vector<float> distances(rayCount);
+    for (int r = 0; r < rayCount; ++r)
+        UViewRay(random(-1.0f, 1.0f), random(-1.0f, 1.0f), viewProjection, origins[r], directions[r]);
+
+    double slowestUs = 0.0;
+    int hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < rayCount; ++r)
+    {
+        auto rayStart = std::chrono::high_resolution_clock::now();
+        distances[r] = 100.0f;
+        picked[r] = URaycastScene(objects, transforms, bvh, origins[r], directions[r], distances[r]);
+        slowestUs = std::max(slowestUs, elapsedMs(rayStart) * 1000.0);
+        hits += picked[r] >= 0 ? 1 : 0;
+    }
+    double averageUs = elapsedMs(start) * 1000.0 / rayCount;
+
+    // Brute force: every triangle of every object, in world space
+    std::vector<glm::vec3> world(sphere.vertices.size() / MeshData::FLOATS_PER_VERTEX);
+    int mismatches = 0;
+    double bruteMs = 0.0;
+    for (int r = 0; r < bruteRayCount; ++r)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        int nearest = -1;
+        float distance = 100.0f;
+        for (size_t o = 0; o < objects.size(); ++o)
+        {
+            const glm::mat4& model = transforms.GetWorldMatrix(objects[o].transform);
+            for (size_t v = 0; v < world.size(); ++v)
+                world[v] = glm::vec3(model * glm::vec4(sphere.vertices[v * MeshData::FLOATS_PER_VERTEX], sphere.vertices[v * MeshData::FLOATS_PER_VERTEX + 1], sphere.vertices[v * MeshData::FLOATS_PER_VERTEX + 2], 1.0f));
+            for (size_t i = 0; i + 2 < sphere.indices.size(); i += 3)
+            {
+                float t = IntersectRayTriangle(origins[r], directions[r], world[sphere.indices[i]], world[sphere.indices[i + 1]], world[sphere.indices[i + 2]]);
+                if (t >= 0.0f && t < distance)
+                {
+                    distance = t;
+                    nearest = (int)o;
+                }
+            }
+        }
+        bruteMs += elapsedMs(start);
+        if (nearest != picked[r] || std::fabs(distance - distances[r]) > 1e-3f)
+            ++mismatches;
+    }
+
+    ULOG_INFO << "  " << averageUs << " us per pick on average, " << slowestUs << " us slowest, " << hits << " of " << rayCount << " rays hit";
+    ULOG_INFO << "  brute force: " << bruteMs / bruteRayCount << " ms per pick, " << mismatches << " of " << bruteRayCount << " checked picks differ";
+}
+
+
+// Compares the per-fragment ShadePhong with the ShadePhongBatch kernel on random fragments lit by the scene's lights
+void UBenchmarkPhong(int fragmentCount)
+{
+    const int passes = 20;
+    size_t count = (size_t)std::max(fragmentCount, 1);
+
+    PhongLights lights;
+    lights.viewPosition = glm::vec3(0.0f, 6.0f, 12.0f);
+    lights.lightPositions[0] = gLightPosition;
+    lights.lightPositions[1] = gLightPosition2;
+    lights.lightPositions[2] = gLightPosition3;
+    lights.lightColors[0] = gLightColor;
+    lights.lightColors[1] = gLightColor2;
+    lights.lightColors[2] = gLightColor3;
+
+    // Fragments on the desk area with random normals facing up-ish, SoA like the rasterizer gathers them
+    std::vector<float> attributes[9];
+    for (std::vector<float>& attribute : attributes)
+        attribute.resize(count);
+    srand(1);
+    auto random = [](float low, float high) { return low + (high - low) * (float)rand() / (float)RAND_MAX; };
+    for (size_t i = 0; i < count; ++i)
+    {
+        attributes[0][i] = random(-5.0f, 5.0f);
+        attributes[1][i] = random(0.0f, 2.0f);
+        attributes[2][i] = random(-5.0f, 5.0f);
+        attributes[3][i] = random(-1.0f, 1.0f);
+        attributes[4][i] = random(0.1f, 1.0f);
+        attributes[5][i] = random(-1.0f, 1.0f);
+        for (int c = 6; c < 9; ++c)
+            attributes[c][i] = random(0.0f, 1.0f);
+    }
+    PhongFragments fragments = {
+        attributes[0].data(), attributes[1].data(), attributes[2].data(),
+        attributes[3].data(), attributes[4].data(), attributes[5].data(),
+        attributes[6].data(), attributes[7].data(), attributes[8].data() };
+
+    std::vector<glm::vec3> reference(count);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            reference[i] = ShadePhong(lights, glm::vec3(fragments.positionX[i], fragments.positionY[i], fragments.positionZ[i]),
+                glm::vec3(fragments.normalX[i], fragments.normalY[i], fragments.normalZ[i]),
+                glm::vec3(fragments.colorR[i], fragments.colorG[i], fragments.colorB[i]));
+        }
+    }
+    double scalarSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / passes;
+
+    std::vector<float> r(count), g(count), b(count);
+    PhongOutput output = { r.data(), g.data(), b.data() };
+    start = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < passes; ++pass)
+        ShadePhongBatch(lights, fragments, count, output);
+    double batchSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / passes;
+
+    // Error against the reference, on the 0-1 scale the framebuffer quantizes to 1/255 steps
+    float maxError = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+    {
+        maxError = std::max(maxError, std::abs(r[i] - reference[i].x));
+        maxError = std::max(maxError, std::abs(g[i] - reference[i].y));
+        maxError = std::max(maxError, std::abs(b[i] - reference[i].z));
+    }
+
+    ULOG_INFO << "Phong shading, " << count << " fragments:";
+    ULOG_INFO << "  ShadePhong:      " << count / scalarSeconds * 1e-6 << " M fragments/s";
+    ULOG_INFO << "  ShadePhongBatch: " << count / batchSeconds * 1e-6 << " M fragments/s (" << PhongKernelName() << "), speedup " << scalarSeconds / batchSeconds << "x";
+    ULOG_INFO << "  max difference:  " << maxError << " (" << maxError * 255.0f << " of a color step)";
+}
+
+
+// Compares the vertex throughput of the vertex layouts by drawing a finely tessellated sphere many times
+// into a tiny viewport, so the cost is dominated by vertex fetch and shading
+void UBenchmarkVertexFormats()
+{
+    const int frames = 20;
+    const int drawsPerFrame = 50;
+    const VertexFormat formats[] = { VERTEX_FORMAT_FULL, VERTEX_FORMAT_COMPACT, VERTEX_FORMAT_QUANTIZED };
+    const char* names[] = { "full", "compact", "quantized" };
+
+    MeshData sphere;
+    UBuildMeshSphere(sphere, 255, 255); // 65536 vertices, the most that still fits 16-bit indices
+    UOptimizeMesh(sphere, "benchmark sphere");
+    size_t vertexCount = sphere.vertices.size() / MeshData::FLOATS_PER_VERTEX;
+
+    FrameUniforms frame = {};
+    frame.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    frame.projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    frame.viewPosition = glm::vec4(0.0f, 0.0f, 3.0f, 1.0f);
+    frame.objectColor = glm::vec4(1.0f);
+    frame.uvScale = glm::vec4(1.0f);
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glViewport(0, 0, 8, 8);
+    glEnable(GL_DEPTH_TEST);
+
+    ULOG_INFO << "Vertex throughput, sphere with " << vertexCount << " vertices and " << sphere.indices.size() / 3 << " triangles:";
+    for (int f = 0; f < 3; ++f)
+    {
+        GLMesh mesh;
+        UCreateMesh(mesh, sphere, formats[f]);
+
+        GLuint programId = formats[f] == VERTEX_FORMAT_FULL ? gCubeProgramId : gCompactProgramId;
+        glUseProgram(programId);
+        ObjectUniforms object;
+        object.model = glm::mat4(1.0f);
+        object.positionOffset = glm::vec4(formats[f] == VERTEX_FORMAT_QUANTIZED ? mesh.boundsMin : glm::vec3(0.0f), 0.0f);
+        object.positionScale = glm::vec4(formats[f] == VERTEX_FORMAT_QUANTIZED ? mesh.boundsMax - mesh.boundsMin : glm::vec3(1.0f), 0.0f);
+        ObjectUniforms* objects = UBeginFrameData(frame, 1);
+        if (!objects)
+        {
+            UDestroyMesh(mesh);
+            break;
+        }
+        std::memcpy(objects, &object, sizeof(object));
+        glUniform1i(glGetUniformLocation(programId, "uObjectIndex"), 0);
+        glBindVertexArray(mesh.vao);
+
+        // warm up, then time the GPU work
+        glDrawElements(GL_TRIANGLES, mesh.nVertices, mesh.indexType, 0);
+        glFinish();
+
+        GLuint64 totalNs = 0;
+        for (int frame = 0; frame < frames; ++frame)
+        {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            for (int draw = 0; draw < drawsPerFrame; ++draw)
+                glDrawElements(GL_TRIANGLES, mesh.nVertices, mesh.indexType, 0);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            totalNs += ns;
+        }
+
+        double seconds = totalNs * 1e-9;
+        double verticesPerSecond = (double)vertexCount * drawsPerFrame * frames / seconds;
+        ULOG_INFO << "  " << names[f] << ": " << VertexStride(formats[f]) << " bytes/vertex, "
+            << (mesh.indexType == GL_UNSIGNED_SHORT ? 16 : 32) << "-bit indices, "
+            << vertexCount * VertexStride(formats[f]) / 1024 << " KB, "
+            << 1000.0 * seconds / frames << " ms/frame, " << verticesPerSecond / 1e6 << " Mvertices/s";
+
+        gFrameRing.EndFrame();
+        UDestroyMesh(mesh);
+    }
+
+    glDeleteQueries(1, &query);
+    gFrameRing.Destroy();
+}
+
+// Times the sphere and cylinder kernels at very high tessellation: the previous push_back/sin/cos style as a
+// baseline, the kernels writing into a presized vector, and the sphere written straight into mapped GL buffers
+void UBenchmarkGenerators()
+{
+    const int sectors = 2048;
+    const int stacks = 1024;
+    const int cylinderSegments = 1 << 20;
+    const int runs = 5;
+    typedef std::chrono::steady_clock Clock;
+    auto elapsedMs = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+
+    GenMeshSize sphereSize = SphereMeshSize(sectors, stacks);
+    ULOG_INFO << "Generators, sphere " << sectors << "x" << stacks << " (" << sphereSize.vertexCount << " vertices), cylinder "
+        << cylinderSegments << " segments, best of " << runs << " runs:";
+
+    // baseline: growing vectors and sin/cos for every vertex
+    double baselineMs = 1e30;
+    for (int run = 0; run < runs; ++run)
+    {
+        Clock::time_point start = Clock::now();
+        MeshData data;
+        for (int i = 0; i <= stacks; ++i)
+        {
+            float stackAngle = 3.14159265f / 2 - i * 3.14159265f / stacks;
+            float xy = cosf(stackAngle), z = sinf(stackAngle);
+            for (int j = 0; j <= sectors; ++j)
+            {
+                float sectorAngle = j * 2 * 3.14159265f / sectors;
+                float x = xy * cosf(sectorAngle), y = xy * sinf(sectorAngle);
+                data.vertices.insert(data.vertices.end(), { x, y, z, x, y, z, (float)j / sectors, (float)i / stacks });
+            }
+        }
+        for (int i = 0; i < stacks; ++i)
+        {
+            GLuint k1 = i * (sectors + 1), k2 = k1 + sectors + 1;
+            for (int j = 0; j < sectors; ++j, ++k1, ++k2)
+            {
+                if (i != 0)
+                    data.indices.insert(data.indices.end(), { k1, k2, k1 + 1 });
+                if (i != stacks - 1)
+                    data.indices.insert(data.indices.end(), { k1 + 1, k2, k2 + 1 });
+            }
+        }
+        baselineMs = std::min(baselineMs, elapsedMs(start));
+    }
+
+    // kernels into memory sized up front (the single allocation is included in the timing)
+    double sphereMs = 1e30, cylinderMs = 1e30;
+    float maxError = 0.0f;
+    for (int run = 0; run < runs; ++run)
+    {
+        Clock::time_point start = Clock::now();
+        MeshData sphere;
+        UBuildMeshSphere(sphere, sectors, stacks);
+        sphereMs = std::min(sphereMs, elapsedMs(start));
+
+        start = Clock::now();
+        GenMeshSize size = CylinderMeshSize(cylinderSegments);
+        std::vector<float> vertices(size.vertexCount * GEN_FLOATS_PER_VERTEX);
+        std::vector<GLuint> indices(size.indexCount);
+        GenerateCylinder(cylinderSegments, 0.15f, 1.0f, vertices.data(), indices.data());
+        cylinderMs = std::min(cylinderMs, elapsedMs(start));
+
+        // incremental rotation error against direct evaluation, on the last vertex of the widest ring before the seam
+        if (run == 0)
+        {
+            int i = stacks / 2;
+            const float* v = &sphere.vertices[((size_t)i * (sectors + 1) + sectors - 1) * MeshData::FLOATS_PER_VERTEX];
+            double stackAngle = GEN_PI / 2 - i * GEN_PI / stacks, sectorAngle = (sectors - 1) * 2 * GEN_PI / sectors;
+            maxError = glm::max(std::fabs(v[0] - (float)(cos(stackAngle) * cos(sectorAngle))), std::fabs(v[1] - (float)(cos(stackAngle) * sin(sectorAngle))));
+        }
+    }
+
+    // sphere kernel writing straight into mapped GL buffers
+    double mappedMs = 1e30;
+    for (int run = 0; run < runs; ++run)
+    {
+        Clock::time_point start = Clock::now();
+        GLMesh mesh;
+        UCreateMeshSphereMapped(mesh, sectors, stacks);
+        glFinish();
+        mappedMs = std::min(mappedMs, elapsedMs(start));
+        UDestroyMesh(mesh);
+    }
+
+    ULOG_INFO << "  sphere, vector growth + sin/cos per vertex: " << baselineMs << " ms";
+    ULOG_INFO << "  sphere, kernel into presized vector: " << sphereMs << " ms (" << baselineMs / sphereMs << "x), max error vs sin/cos " << maxError;
+    ULOG_INFO << "  sphere, kernel into mapped GL buffer: " << mappedMs << " ms";
+    ULOG_INFO << "  cylinder, kernel into presized vector: " << cylinderMs << " ms";
+}
+
+
+// Renders every regression viewpoint into an offscreen framebuffer and either writes the results as the new
+// reference images or compares them against the stored ones. Reports GPU and CPU frame times per view.
+// Returns false if any view differs from its reference or has none, or if nothing could be rendered.
+bool URunRegressionTest(bool record)
+{
+    const int width = WINDOW_WIDTH;
+    const int height = WINDOW_HEIGHT;
+    const size_t pixelCount = (size_t)width * height;
+
+    // Without references there is nothing to compare against; say how to get them instead of failing every view
+    if (!record)
+    {
+        bool missing = false;
+        for (const RegressionView& view : REGRESSION_VIEWS)
+        {
+            char path[256];
+            snprintf(path, sizeof(path), "%s/%s.png", REGRESSION_DIRECTORY, view.name);
+            FILE* reference = fopen(path, "rb");
+            if (reference)
+                fclose(reference);
+            else
+            {
+                ULOG_ERROR << "Regression test: reference image " << path << " is missing";
+                missing = true;
+            }
+        }
+        if (missing)
+        {
+            ULOG_ERROR << "Regression test: record the reference images first by running with --regression-record on a known good build";
+            return false;
+        }
+    }
+
+    // Fixed size offscreen target, so results don't depend on the window
+    GLuint framebuffer, colorBuffer, depthBuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &colorBuffer);
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        ULOG_ERROR << "Regression test: offscreen framebuffer is incomplete";
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        return false;
+    }
+    bool passed = true;
+    glViewport(0, 0, width, height);
+
+    if (record)
+        CreateDirectoryIfMissing(REGRESSION_DIRECTORY);
+    ULOG_INFO << "Regression test, " << width << "x" << height << " offscreen, " << REGRESSION_TIMED_FRAMES << " timed frames per view:";
+
+    GLuint query;
+    glGenQueries(1, &query);
+    Camera savedCamera = gCamera;
+    bool savedPerspective = isPerspective;
+    std::vector<unsigned char> pixels(pixelCount * 4);
+    std::vector<unsigned char> encoded;
+    std::vector<unsigned char> diffImage;
+
+    for (const RegressionView& view : REGRESSION_VIEWS)
+    {
+        // Same state for every run: camera at the viewpoint, no interpolation
+        gCamera = Camera(view.position, glm::vec3(0.0f, 1.0f, 0.0f), view.yaw, view.pitch);
+        isPerspective = view.perspective;
+        gPreviousCameraPosition = gCamera.GetPosition();
+        gPreviousLightPosition = gLightPosition;
+        gRenderAlpha = 1.0f;
+
+        FramePacket packet;
+        UBuildFramePacket(packet);
+        packet.framebufferWidth = width;
+        packet.framebufferHeight = height;
+        packet.inputTime = 0.0;
+        packet.capture = false;
+
+        // warm up, then time the frame on the GPU (query) and the CPU (submission only)
+        URender(packet);
+        glFinish();
+        if (gRenderFailed)
+        {
+            passed = false;
+            break;
+        }
+        GLuint64 gpuNs = 0;
+        double cpuSeconds = 0.0;
+        for (int frame = 0; frame < REGRESSION_TIMED_FRAMES; ++frame)
+        {
+            double cpuStart = glfwGetTime();
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            URender(packet);
+            glEndQuery(GL_TIME_ELAPSED);
+            cpuSeconds += glfwGetTime() - cpuStart;
+
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            gpuNs += ns;
+        }
+
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s.png", REGRESSION_DIRECTORY, view.name);
+        LogLine report(LOG_LEVEL_INFO); // finished below, written when the view is done
+        report << "  " << view.name << ": " << gpuNs * 1e-6 / REGRESSION_TIMED_FRAMES << " ms GPU, "
+            << 1000.0 * cpuSeconds / REGRESSION_TIMED_FRAMES << " ms CPU";
+
+        if (record)
+        {
+            EncodePng(pixels.data(), width, height, encoded);
+            FILE* out = fopen(path, "wb");
+            bool written = out && fwrite(encoded.data(), 1, encoded.size(), out) == encoded.size();
+            if (out)
+                fclose(out);
+            report << (written ? ", recorded " : ", could not write ") << path;
+            passed = passed && written;
+            continue;
+        }
+
+        // References are stored top-down like any PNG; readback rows are bottom-up
+        int referenceWidth = 0, referenceHeight = 0, referenceChannels = 0;
+        unsigned char* reference = stbi_load(path, &referenceWidth, &referenceHeight, &referenceChannels, 4);
+        if (!reference || referenceWidth != width || referenceHeight != height)
+        {
+            report << ", no usable reference image " << path << " (run with --regression-record)";
+            stbi_image_free(reference);
+            passed = false;
+            continue;
+        }
+        flipImageVertically(reference, width, height, 4);
+
+        double diffStart = glfwGetTime();
+        ImageDiffResult diff = DiffImages(pixels.data(), reference, pixelCount, REGRESSION_TOLERANCE);
+        double diffSeconds = glfwGetTime() - diffStart;
+        bool matches = diff.differingPixels <= pixelCount * REGRESSION_MAX_DIFFERING;
+        report << ", " << diff.differingPixels << " pixels differ (max " << diff.maxDistance << ", mean " << diff.meanDistance
+            << ", diff " << 1000.0 * diffSeconds << " ms): " << (matches ? "pass" : "FAIL");
+
+        // Keep what was rendered and where it differs next to the reference
+        if (!matches)
+        {
+            BuildDiffImage(pixels.data(), reference, pixelCount, REGRESSION_TOLERANCE, diffImage);
+            const std::vector<unsigned char>* images[] = { &pixels, &diffImage };
+            const char* suffixes[] = { "actual", "diff" };
+            for (int k = 0; k < 2; ++k)
+            {
+                snprintf(path, sizeof(path), "%s/%s.%s.png", REGRESSION_DIRECTORY, view.name, suffixes[k]);
+                EncodePng(images[k]->data(), width, height, encoded);
+                if (FILE* out = fopen(path, "wb"))
+                {
+                    fwrite(encoded.data(), 1, encoded.size(), out);
+                    fclose(out);
+                }
+            }
+            passed = false;
+        }
+        stbi_image_free(reference);
+    }
+
+    gCamera = savedCamera;
+    isPerspective = savedPerspective;
+    glDeleteQueries(1, &query);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+    gFrameRing.Destroy();
+
+    ULOG_INFO << "Regression test " << (record ? "recording " : "") << (passed ? "passed" : "failed");
+    return passed;
+}
+
+
+// Renders the scene from the current camera with the software rasterizer: frameCount timed frames, the last one
+// written to outputPath as a PNG
+bool URenderSoftware(int frameCount, const char* outputPath)
+{
+    SoftwareRasterizer rasterizer;
+    rasterizer.Resize(WINDOW_WIDTH, WINDOW_HEIGHT);
+    gPreviousCameraPosition = gCamera.GetPosition();
+    gPreviousLightPosition = gLightPosition;
+    gRenderAlpha = 1.0f;
+
+    ULOG_INFO << "Software rendering " << WINDOW_WIDTH << "x" << WINDOW_HEIGHT << " on " << gJobs->ThreadCount() << " threads";
+    FramePacket packet;
+    double totalMs = 0.0, setupMs = 0.0, binMs = 0.0, rasterMs = 0.0;
+    for (int frame = 0; frame < std::max(frameCount, 1); ++frame)
+    {
+        auto start = std::chrono::steady_clock::now();
+        UBuildFramePacket(packet);
+
+        RasterFrame constants;
+        constants.viewProjection = packet.projection * packet.view;
+        constants.lights.viewPosition = packet.viewPosition;
+        for (int i = 0; i < 3; ++i)
+        {
+            constants.lights.lightPositions[i] = packet.lightPositions[i];
+            constants.lights.lightColors[i] = packet.lightColors[i];
+        }
+        constants.uvScale = gUVScale;
+
+        rasterizer.BeginFrame(constants);
+        for (const DrawItem& item : packet.drawItems)
+        {
+            const RasterTexture* texture = item.texture > 0 && item.texture <= gRasterTextures.size() ? &gRasterTextures[item.texture - 1] : nullptr;
+            rasterizer.Draw(item.mesh->raster, texture, item.model);
+        }
+        for (int i = 0; i < 3; ++i)
+            rasterizer.Draw(gMeshCube.raster, nullptr, glm::translate(packet.lightPositions[i]) * glm::scale(gLightScale));
+        rasterizer.Render(*gJobs);
+
+        totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        setupMs += rasterizer.Stats().setupMs;
+        binMs += rasterizer.Stats().binMs;
+        rasterMs += rasterizer.Stats().rasterMs;
+    }
+
+    int frames = std::max(frameCount, 1);
+    ULOG_INFO << "  " << frames << " frames, " << totalMs / frames << " ms/frame (" << 1000.0 * frames / totalMs << " fps), "
+        << rasterizer.Stats().triangles << " triangles after clipping";
+    ULOG_INFO << "  setup " << setupMs / frames << " ms, binning " << binMs / frames << " ms, raster and shading " << rasterMs / frames << " ms";
+    if (gOcclusionCulling)
+        ULOG_INFO << "  occlusion culling: " << (double)gOcclusionCulled / frames << " of " << (double)gOcclusionTested / frames << " objects culled per frame";
+
+    std::vector<unsigned char> encoded;
+    EncodePng(rasterizer.Pixels(), rasterizer.Width(), rasterizer.Height(), encoded);
+    FILE* out = fopen(outputPath, "wb");
+    bool written = out && fwrite(encoded.data(), 1, encoded.size(), out) == encoded.size();
+    if (out)
+        fclose(out);
+    ULOG_INFO << (written ? "  wrote " : "  could not write ") << outputPath;
+    return written;
+}
+
+
+// Returns true if the flag was passed on the command line
+bool UHasArgument(int argc, char* argv[], const char* name)
+{
+    for (int i = 1; i < argc; ++i)
+        if (strcmp(argv[i], name) == 0)
+            return true;
+    return false;
+}
+
+// Returns the value following an option on the command line, or nullptr if it is missing
+const char* UGetArgument(int argc, char* argv[], const char* name)
+{
+    for (int i = 1; i + 1 < argc; ++i)
+        if (strcmp(argv[i], name) == 0)
+            return argv[i + 1];
+    return nullptr;
+}
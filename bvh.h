@@ -0,0 +1,497 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "culling.h" // Frustum
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// Bounding volume hierarchy over world space object boxes. Built top-down with binned surface area heuristic
+// splits; the object indices of every subtree are stored contiguously, so a subtree found completely inside a
+// frustum is accepted without testing its objects. When objects move, SetObjectBounds records their new boxes
+// and Refit grows or shrinks only the ancestors of the moved objects (or every node when many moved), keeping
+// the topology. Refitting degrades the tree as objects drift apart; Cost compared with the cost right after
+// Build tells when a rebuild pays off.
+
+struct BVHNode
+{
+    glm::vec3 boundsMin;
+    int firstOrLeft;    // leaf: first entry in the object list; inner node: left child, the right child follows it
+    glm::vec3 boundsMax;
+    int count;          // objects in a leaf, 0 for inner nodes
+};
+
+class BVH
+{
+public:
+    static const int MAX_LEAF_OBJECTS = 4;     // nodes this small always stay leaves
+    static const int MAX_SAH_LEAF_OBJECTS = 8;  // nodes up to this size stay leaves when no split is cheaper
+    static const int BIN_COUNT = 12;
+    static const int MAX_DEPTH = 64;        // traversal stack size; nodes this deep stay leaves
+    static const int MAX_SAH_DEPTH = 36;    // below this, nodes are halved at the median to bound the depth
+
+    // builds the tree over boxes indexed 0..objectCount-1
+    void Build(const glm::vec3* boundsMin, const glm::vec3* boundsMax, int objectCount)
+    {
+        objectMin.assign(boundsMin, boundsMin + objectCount);
+        objectMax.assign(boundsMax, boundsMax + objectCount);
+        entries.resize(objectCount);
+        for (int i = 0; i < objectCount; ++i)
+            entries[i] = { boundsMin[i], i, boundsMax[i], (boundsMin[i] + boundsMax[i]) * 0.5f };
+        objectLeaf.assign(objectCount, 0);
+
+        nodes.clear();
+        parents.clear();
+        nodes.reserve(std::max(objectCount * 2, 1));
+        parents.reserve(nodes.capacity());
+        nodes.push_back({ glm::vec3(FLT_MAX), 0, glm::vec3(-FLT_MAX), objectCount });
+        parents.push_back(-1);
+        depth = 1;
+
+        // children are always appended after their parent, which lets Refit walk the nodes backwards
+        struct Pending { int node; int level; };
+        std::vector<Pending> pending(1, Pending{ 0, 1 });
+        while (!pending.empty())
+        {
+            Pending next = pending.back();
+            pending.pop_back();
+            depth = std::max(depth, next.level);
+            int left = subdivide(next.node, next.level);
+            if (left >= 0)
+            {
+                pending.push_back({ left, next.level + 1 });
+                pending.push_back({ left + 1, next.level + 1 });
+            }
+        }
+
+        objects.resize(objectCount);
+        for (int i = 0; i < objectCount; ++i)
+            objects[i] = entries[i].object;
+        std::vector<BuildEntry>().swap(entries);
+        builtCost = Cost();
+    }
+
+    // builds again from the current object boxes, once refitting has made the tree too loose
+    void Rebuild()
+    {
+        std::vector<glm::vec3> boundsMin = objectMin, boundsMax = objectMax;
+        Build(boundsMin.data(), boundsMax.data(), (int)boundsMin.size());
+    }
+
+    int ObjectCount() const { return (int)objectMin.size(); }
+    int NodeCount() const { return (int)nodes.size(); }
+    int Depth() const { return depth; }
+
+    // new box of a moved object, applied by the next Refit; safe to call from several threads for different objects
+    void SetObjectBounds(int object, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+    {
+        objectMin[object] = boundsMin;
+        objectMax[object] = boundsMax;
+    }
+
+    // updates the ancestors of the moved objects, stopping at the first node whose box is unchanged
+    void Refit(const int* moved, size_t movedCount)
+    {
+        if (movedCount * 8 > objectMin.size())
+        {
+            RefitAll();
+            return;
+        }
+        for (size_t i = 0; i < movedCount; ++i)
+        {
+            for (int node = objectLeaf[moved[i]]; node >= 0; node = parents[node])
+            {
+                BVHNode& n = nodes[node];
+                glm::vec3 oldMin = n.boundsMin, oldMax = n.boundsMax;
+                computeNodeBounds(n);
+                if (n.boundsMin == oldMin && n.boundsMax == oldMax)
+                    break;
+            }
+        }
+    }
+
+    // recomputes every node, children before parents
+    void RefitAll()
+    {
+        for (int node = (int)nodes.size() - 1; node >= 0; --node)
+            computeNodeBounds(nodes[node]);
+    }
+
+    // surface area heuristic cost of the tree relative to its root box (traversal and intersection weighted equally)
+    float Cost() const
+    {
+        if (nodes.empty())
+            return 0.0f;
+        float rootArea = std::max(surfaceArea(nodes[0].boundsMin, nodes[0].boundsMax), FLT_MIN);
+        float cost = 0.0f;
+        for (const BVHNode& node : nodes)
+            cost += surfaceArea(node.boundsMin, node.boundsMax) / rootArea * (node.count ? (float)node.count : 1.0f);
+        return cost;
+    }
+
+    float BuiltCost() const { return builtCost; }
+
+    // calls visit(object) for every object whose box intersects the frustum
+    template <typename Visit>
+    void QueryFrustum(const Frustum& frustum, Visit visit) const
+    {
+        if (objectMin.empty())
+            return;
+        struct Entry { int node; int planeMask; };
+        Entry stack[MAX_DEPTH + 1];
+        int top = 0;
+        stack[top++] = { 0, 0x3f };
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const BVHNode& node = nodes[entry.node];
+            int mask = entry.planeMask;
+            if (!classifyBox(frustum, node.boundsMin, node.boundsMax, mask))
+                continue;
+
+            if (mask == 0)
+            {
+                // completely inside: the subtree's objects are one contiguous range
+                int first, end;
+                subtreeRange(entry.node, first, end);
+                for (int i = first; i < end; ++i)
+                    visit(objects[i]);
+            }
+            else if (node.count > 0)
+            {
+                for (int i = node.firstOrLeft; i < node.firstOrLeft + node.count; ++i)
+                {
+                    int objectMask = mask;
+                    if (classifyBox(frustum, objectMin[objects[i]], objectMax[objects[i]], objectMask))
+                        visit(objects[i]);
+                }
+            }
+            else
+            {
+                stack[top++] = { node.firstOrLeft, mask };
+                stack[top++] = { node.firstOrLeft + 1, mask };
+            }
+        }
+    }
+
+    // calls visit(object) for every object whose box intersects the sphere, e.g. the objects a light can reach
+    template <typename Visit>
+    void QuerySphere(const glm::vec3& center, float radius, Visit visit) const
+    {
+        if (objectMin.empty())
+            return;
+        float radiusSquared = radius * radius;
+        int stack[MAX_DEPTH + 1];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const BVHNode& node = nodes[stack[--top]];
+            if (distanceSquared(center, node.boundsMin, node.boundsMax) > radiusSquared)
+                continue;
+            if (node.count > 0)
+            {
+                for (int i = node.firstOrLeft; i < node.firstOrLeft + node.count; ++i)
+                    if (distanceSquared(center, objectMin[objects[i]], objectMax[objects[i]]) <= radiusSquared)
+                        visit(objects[i]);
+            }
+            else
+            {
+                stack[top++] = node.firstOrLeft;
+                stack[top++] = node.firstOrLeft + 1;
+            }
+        }
+    }
+
+    // Finds the nearest hit along a ray. hit(object, maxDistance) tests the object itself and returns its hit
+    // distance, or a negative value (or one >= maxDistance) for a miss. distance limits the ray on input and
+    // holds the nearest hit on output. Returns the object that was hit, or -1.
+    template <typename Hit>
+    int Raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, Hit hit) const
+    {
+        if (objectMin.empty())
+            return -1;
+        glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        int nearest = -1;
+        int stack[MAX_DEPTH + 1];
+        int top = 0;
+        float entry;
+        if (!slab(origin, inverse, nodes[0].boundsMin, nodes[0].boundsMax, distance, entry))
+            return -1;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const BVHNode& node = nodes[stack[--top]];
+            if (!slab(origin, inverse, node.boundsMin, node.boundsMax, distance, entry))
+                continue; // the box was entered before the ray was shortened by a closer hit
+            if (node.count > 0)
+            {
+                for (int i = node.firstOrLeft; i < node.firstOrLeft + node.count; ++i)
+                {
+                    int object = objects[i];
+                    if (!slab(origin, inverse, objectMin[object], objectMax[object], distance, entry))
+                        continue;
+                    float t = hit(object, distance);
+                    if (t >= 0.0f && t < distance)
+                    {
+                        distance = t;
+                        nearest = object;
+                    }
+                }
+                continue;
+            }
+
+            // visit the nearer child first: push it last
+            int left = node.firstOrLeft, right = left + 1;
+            float leftEntry, rightEntry;
+            bool hitLeft = slab(origin, inverse, nodes[left].boundsMin, nodes[left].boundsMax, distance, leftEntry);
+            bool hitRight = slab(origin, inverse, nodes[right].boundsMin, nodes[right].boundsMax, distance, rightEntry);
+            if (hitLeft && hitRight)
+            {
+                stack[top++] = leftEntry < rightEntry ? right : left;
+                stack[top++] = leftEntry < rightEntry ? left : right;
+            }
+            else if (hitLeft)
+                stack[top++] = left;
+            else if (hitRight)
+                stack[top++] = right;
+        }
+        return nearest;
+    }
+
+    // ray against a box (inverse = 1 / direction); entry is where the ray enters, clamped to 0
+    static bool slab(const glm::vec3& origin, const glm::vec3& inverse, const glm::vec3& boxMin, const glm::vec3& boxMax, float maxDistance, float& entry)
+    {
+        float tMin = 0.0f, tMax = maxDistance;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float t0 = (boxMin[axis] - origin[axis]) * inverse[axis];
+            float t1 = (boxMax[axis] - origin[axis]) * inverse[axis];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            // NaN (origin on a slab plane of a parallel ray) leaves the interval unchanged
+            tMin = t0 > tMin ? t0 : tMin;
+            tMax = t1 < tMax ? t1 : tMax;
+        }
+        entry = tMin;
+        return tMin <= tMax;
+    }
+
+private:
+    std::vector<BVHNode> nodes;
+    std::vector<int> parents;           // per node, -1 for the root
+    std::vector<int> objects;           // object indices, every leaf references a range
+    std::vector<int> objectLeaf;        // leaf of every object, where Refit starts
+    std::vector<glm::vec3> objectMin;
+    std::vector<glm::vec3> objectMax;
+
+    // objects are partitioned as copies of their boxes while building, so every pass reads memory in order
+    struct BuildEntry
+    {
+        glm::vec3 boundsMin;
+        int object;
+        glm::vec3 boundsMax;
+        glm::vec3 centroid;
+    };
+    std::vector<BuildEntry> entries;
+    int depth = 0;
+    float builtCost = 0.0f;
+
+    static float surfaceArea(const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        glm::vec3 e = glm::max(boxMax - boxMin, glm::vec3(0.0f));
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    static float distanceSquared(const glm::vec3& point, const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        glm::vec3 d = glm::max(glm::max(boxMin - point, point - boxMax), glm::vec3(0.0f));
+        return glm::dot(d, d);
+    }
+
+    // false when the box is outside a plane; clears the bits of the planes the box is completely inside of
+    static bool classifyBox(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax, int& mask)
+    {
+        for (int p = 0; p < 6; ++p)
+        {
+            if (!(mask & (1 << p)))
+                continue;
+            const glm::vec4& plane = frustum.planes[p];
+            glm::vec3 farCorner(plane.x >= 0.0f ? boxMax.x : boxMin.x, plane.y >= 0.0f ? boxMax.y : boxMin.y, plane.z >= 0.0f ? boxMax.z : boxMin.z);
+            if (plane.x * farCorner.x + plane.y * farCorner.y + plane.z * farCorner.z + plane.w < 0.0f)
+                return false;
+            glm::vec3 nearCorner(plane.x >= 0.0f ? boxMin.x : boxMax.x, plane.y >= 0.0f ? boxMin.y : boxMax.y, plane.z >= 0.0f ? boxMin.z : boxMax.z);
+            if (plane.x * nearCorner.x + plane.y * nearCorner.y + plane.z * nearCorner.z + plane.w >= 0.0f)
+                mask &= ~(1 << p);
+        }
+        return true;
+    }
+
+    // object list range of a subtree: from its leftmost leaf to the end of its rightmost leaf
+    void subtreeRange(int node, int& first, int& end) const
+    {
+        int left = node;
+        while (nodes[left].count == 0)
+            left = nodes[left].firstOrLeft;
+        int right = node;
+        while (nodes[right].count == 0)
+            right = nodes[right].firstOrLeft + 1;
+        first = nodes[left].firstOrLeft;
+        end = nodes[right].firstOrLeft + nodes[right].count;
+    }
+
+    void computeNodeBounds(BVHNode& node) const
+    {
+        glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+        if (node.count > 0)
+        {
+            for (int i = node.firstOrLeft; i < node.firstOrLeft + node.count; ++i)
+            {
+                boundsMin = glm::min(boundsMin, objectMin[objects[i]]);
+                boundsMax = glm::max(boundsMax, objectMax[objects[i]]);
+            }
+        }
+        else
+        {
+            const BVHNode& left = nodes[node.firstOrLeft];
+            const BVHNode& right = nodes[node.firstOrLeft + 1];
+            boundsMin = glm::min(left.boundsMin, right.boundsMin);
+            boundsMax = glm::max(left.boundsMax, right.boundsMax);
+        }
+        node.boundsMin = boundsMin;
+        node.boundsMax = boundsMax;
+    }
+
+    // splits a node into two children and returns the left one, or -1 when it stays a leaf
+    int subdivide(int nodeIndex, int level)
+    {
+        BVHNode& node = nodes[nodeIndex];
+        int first = node.firstOrLeft, count = node.count;
+        BuildEntry* begin = entries.data() + first;
+        BuildEntry* end = begin + count;
+
+        glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX), centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+        for (const BuildEntry* entry = begin; entry != end; ++entry)
+        {
+            boundsMin = glm::min(boundsMin, entry->boundsMin);
+            boundsMax = glm::max(boundsMax, entry->boundsMax);
+            centroidMin = glm::min(centroidMin, entry->centroid);
+            centroidMax = glm::max(centroidMax, entry->centroid);
+        }
+        node.boundsMin = boundsMin;
+        node.boundsMax = boundsMax;
+
+        int bestAxis = -1, bestSplit = 0;
+        bool leaf = count <= MAX_LEAF_OBJECTS || level >= MAX_DEPTH;
+        if (!leaf && level < MAX_SAH_DEPTH)
+        {
+            findSahSplit(begin, end, boundsMin, boundsMax, centroidMin, centroidMax, bestAxis, bestSplit);
+            leaf = bestAxis < 0 && count <= MAX_SAH_LEAF_OBJECTS;
+        }
+        if (leaf)
+        {
+            for (const BuildEntry* entry = begin; entry != end; ++entry)
+                objectLeaf[entry->object] = nodeIndex;
+            return -1;
+        }
+
+        BuildEntry* middle = nullptr;
+        if (bestAxis >= 0)
+        {
+            float scale = BIN_COUNT / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+            float offset = centroidMin[bestAxis];
+            middle = std::partition(begin, end, [&](const BuildEntry& entry)
+            {
+                return std::min((int)((entry.centroid[bestAxis] - offset) * scale), BIN_COUNT - 1) < bestSplit;
+            });
+        }
+        if (!middle || middle == begin || middle == end)
+        {
+            // no split beats a leaf of this size, or too deep: halve the objects along the longest centroid axis
+            glm::vec3 extent = centroidMax - centroidMin;
+            int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+            middle = begin + count / 2;
+            std::nth_element(begin, middle, end, [axis](const BuildEntry& a, const BuildEntry& b) { return a.centroid[axis] < b.centroid[axis]; });
+        }
+
+        int leftCount = (int)(middle - begin);
+        int left = (int)nodes.size();
+        nodes.push_back({ glm::vec3(0.0f), first, glm::vec3(0.0f), leftCount });
+        nodes.push_back({ glm::vec3(0.0f), first + leftCount, glm::vec3(0.0f), count - leftCount });
+        parents.push_back(nodeIndex);
+        parents.push_back(nodeIndex);
+        nodes[nodeIndex].firstOrLeft = left;
+        nodes[nodeIndex].count = 0;
+        return left;
+    }
+
+    // cheapest bin boundary over all axes by the surface area heuristic, weighted like Cost(); axis stays -1 when
+    // nothing beats a leaf, which costs count * area against area (the extra node) plus the children's costs
+    void findSahSplit(const BuildEntry* begin, const BuildEntry* end, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+        const glm::vec3& centroidMin, const glm::vec3& centroidMax, int& bestAxis, int& bestSplit) const
+    {
+        // one pass over the objects fills the bins of all three axes
+        struct Bin { glm::vec3 boundsMin, boundsMax; int count; };
+        Bin bins[3][BIN_COUNT];
+        for (int axis = 0; axis < 3; ++axis)
+            for (Bin& bin : bins[axis])
+                bin = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), 0 };
+        glm::vec3 extent = centroidMax - centroidMin;
+        glm::vec3 scale(extent.x > 0.0f ? BIN_COUNT / extent.x : 0.0f, extent.y > 0.0f ? BIN_COUNT / extent.y : 0.0f, extent.z > 0.0f ? BIN_COUNT / extent.z : 0.0f);
+        for (const BuildEntry* entry = begin; entry != end; ++entry)
+        {
+            glm::vec3 position = (entry->centroid - centroidMin) * scale;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                Bin& bin = bins[axis][std::min((int)position[axis], BIN_COUNT - 1)];
+                bin.boundsMin = glm::min(bin.boundsMin, entry->boundsMin);
+                bin.boundsMax = glm::max(bin.boundsMax, entry->boundsMax);
+                ++bin.count;
+            }
+        }
+
+        float bestCost = surfaceArea(boundsMin, boundsMax) * (float)((end - begin) - 1);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (extent[axis] <= 0.0f)
+                continue;
+
+            // sweep from the right to get the area and count right of every boundary, then from the left
+            float rightArea[BIN_COUNT];
+            int rightCount[BIN_COUNT];
+            glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+            int sweepCount = 0;
+            for (int b = BIN_COUNT - 1; b > 0; --b)
+            {
+                sweepMin = glm::min(sweepMin, bins[axis][b].boundsMin);
+                sweepMax = glm::max(sweepMax, bins[axis][b].boundsMax);
+                sweepCount += bins[axis][b].count;
+                rightArea[b] = surfaceArea(sweepMin, sweepMax);
+                rightCount[b] = sweepCount;
+            }
+            sweepMin = glm::vec3(FLT_MAX);
+            sweepMax = glm::vec3(-FLT_MAX);
+            sweepCount = 0;
+            for (int b = 1; b < BIN_COUNT; ++b)
+            {
+                sweepMin = glm::min(sweepMin, bins[axis][b - 1].boundsMin);
+                sweepMax = glm::max(sweepMax, bins[axis][b - 1].boundsMax);
+                sweepCount += bins[axis][b - 1].count;
+                if (sweepCount == 0 || rightCount[b] == 0)
+                    continue;
+                float cost = surfaceArea(sweepMin, sweepMax) * sweepCount + rightArea[b] * rightCount[b];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+    }
+};
+#endif
@@ -18,8 +18,11 @@ https://creativecommons.org/licenses/by-nc/4.0/legalcode
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
-#include <vector>
+#include "culling.h" // Frustum
+
+#include <cmath>
 
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
 enum Camera_Movement {
@@ -39,57 +42,121 @@ const float SENSITIVITY =  0.1f;
 const float ZOOM        =  45.0f;
 
 
-// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
+// An abstract camera class that processes input and calculates the corresponding orientation, vectors and matrices for use in OpenGL.
+// The orientation is a quaternion built from the yaw and pitch of mouse look; it, the direction vectors, the view,
+// view-projection and frustum are derived on demand and cached, so mouse events only add up angles, the
+// trigonometry runs at most once per frame, and a camera that did not move answers every query from the cache.
 class Camera
 {
 public:
-    // camera Attributes
-    glm::vec3 Position;
-    glm::vec3 Front;
-    glm::vec3 Up;
-    glm::vec3 Right;
-    glm::vec3 WorldUp;
-    // euler Angles
-    float Yaw;
-    float Pitch;
     // camera options
     float MovementSpeed;
     float MouseSensitivity;
     float Zoom;
-    // camera perspective
-    //glm::mat4 orthographicPerspective;
 
     // constructor with vectors
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
     {
         Position = position;
         WorldUp = up;
         Yaw = yaw;
         Pitch = pitch;
-        updateCameraVectors();
     }
     // constructor with scalar values
-    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
     {
         Position = glm::vec3(posX, posY, posZ);
         WorldUp = glm::vec3(upX, upY, upZ);
         Yaw = yaw;
         Pitch = pitch;
-        updateCameraVectors();
     }
 
-    // returns the view matrix calculated using Euler Angles and the LookAt Matrix
-    glm::mat4 GetViewMatrix() const
+    const glm::vec3& GetPosition() const { return Position; }
+
+    void SetPosition(const glm::vec3& position)
     {
-        return glm::lookAt(Position, Position + Front, Up);
+        if (position == Position)
+            return;
+        Position = position;
+        viewDirty = true;
     }
 
+    const glm::quat& GetOrientation() const { updateOrientation(); return Orientation; }
+
+    // takes over an orientation, e.g. another camera's; yaw and pitch are recovered from its front vector
+    void SetOrientation(const glm::quat& orientation)
+    {
+        updateOrientation();
+        if (orientation.w == Orientation.w && orientation.x == Orientation.x && orientation.y == Orientation.y && orientation.z == Orientation.z)
+            return;
+        Orientation = orientation;
+        Front = Orientation * glm::vec3(0.0f, 0.0f, -1.0f);
+        Right = Orientation * glm::vec3(1.0f, 0.0f, 0.0f);
+        Up = Orientation * glm::vec3(0.0f, 1.0f, 0.0f);
+        Pitch = glm::degrees(std::asin(glm::clamp(Front.y, -1.0f, 1.0f)));
+        Yaw = glm::degrees(std::atan2(Front.z, Front.x));
+        viewDirty = true;
+    }
 
+    const glm::vec3& GetFront() const { updateOrientation(); return Front; }
+    const glm::vec3& GetRight() const { updateOrientation(); return Right; }
+    const glm::vec3& GetUp() const { updateOrientation(); return Up; }
 
+    // returns the view matrix, rebuilt from the orientation and position only after either changed
+    const glm::mat4& GetViewMatrix() const
+    {
+        updateOrientation();
+        if (viewDirty)
+        {
+            // lookAt(Position, Position + Front, Up) without recomputing the basis it already has
+            View = glm::mat4(1.0f);
+            View[0][0] = Right.x;  View[1][0] = Right.y;  View[2][0] = Right.z;
+            View[0][1] = Up.x;     View[1][1] = Up.y;     View[2][1] = Up.z;
+            View[0][2] = -Front.x; View[1][2] = -Front.y; View[2][2] = -Front.z;
+            View[3][0] = -glm::dot(Right, Position);
+            View[3][1] = -glm::dot(Up, Position);
+            View[3][2] = glm::dot(Front, Position);
+            viewDirty = false;
+            viewProjectionDirty = true;
+        }
+        return View;
+    }
+
+    // the projection is chosen by the application; setting an unchanged one keeps the cached matrices
+    void SetProjection(const glm::mat4& projection)
+    {
+        if (projection == Projection)
+            return;
+        Projection = projection;
+        viewProjectionDirty = true;
+    }
+
+    const glm::mat4& GetProjectionMatrix() const { return Projection; }
+
+    // projection * view
+    const glm::mat4& GetViewProjectionMatrix() const
+    {
+        GetViewMatrix();
+        if (viewProjectionDirty)
+        {
+            ViewProjection = Projection * View;
+            CameraFrustum = ExtractFrustum(ViewProjection);
+            viewProjectionDirty = false;
+        }
+        return ViewProjection;
+    }
+
+    // world space planes of GetViewProjectionMatrix, for culling
+    const Frustum& GetFrustum() const
+    {
+        GetViewProjectionMatrix();
+        return CameraFrustum;
+    }
 
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {    
+        updateOrientation();
         float velocity = MovementSpeed * deltaTime;
         if (direction == FORWARD)
             Position += Front * velocity;
@@ -103,9 +170,11 @@ public:
             Position += Up * velocity;
         if (direction == DOWN)
             Position -= Up * velocity;
+        viewDirty = true;
     }
 
     // processes input received from a mouse input system. Expects the offset value in both the x and y direction.
+    // Only the angles change here; the orientation follows when it is next needed.
     void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true)
     {
         xoffset *= MouseSensitivity;
@@ -123,8 +192,7 @@ public:
                 Pitch = -89.0f;
         }
 
-        // update Front, Right and Up Vectors using the updated Euler angles
-        updateCameraVectors();
+        orientationDirty = true;
     }
 
     // Process mouse scroll inputs for movement speed
@@ -143,18 +211,37 @@ public:
     }
 
 private:
-    // calculates the front vector from the Camera's (updated) Euler Angles
-    void updateCameraVectors()
+    glm::vec3 Position;
+    glm::vec3 WorldUp;
+    // euler Angles, in degrees
+    float Yaw;
+    float Pitch;
+
+    // derived state, rebuilt on demand by the const queries
+    mutable glm::quat Orientation;
+    mutable glm::vec3 Front;
+    mutable glm::vec3 Up;
+    mutable glm::vec3 Right;
+    mutable glm::mat4 View;
+    glm::mat4 Projection = glm::mat4(1.0f);
+    mutable glm::mat4 ViewProjection;
+    mutable Frustum CameraFrustum;
+    mutable bool orientationDirty = true;
+    mutable bool viewDirty = true;
+    mutable bool viewProjectionDirty = true;
+
+    // rebuilds the orientation and the Front, Right and Up vectors after the Euler angles changed
+    void updateOrientation() const
     {
-        // calculate the new Front vector
-        glm::vec3 front;
-        front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-        front.y = sin(glm::radians(Pitch));
-        front.z = sin(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-        Front = glm::normalize(front);
-        // also re-calculate the Right and Up vector
-        Right = glm::normalize(glm::cross(Front, WorldUp));  // normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower movement.
-        Up    = glm::normalize(glm::cross(Right, Front));
+        if (!orientationDirty)
+            return;
+        // yaw turns around the world up axis (-90 degrees looks down -z), pitch then tilts around the camera's right axis
+        Orientation = glm::normalize(glm::angleAxis(glm::radians(-90.0f - Yaw), WorldUp) * glm::angleAxis(glm::radians(Pitch), glm::vec3(1.0f, 0.0f, 0.0f)));
+        Front = Orientation * glm::vec3(0.0f, 0.0f, -1.0f);
+        Right = Orientation * glm::vec3(1.0f, 0.0f, 0.0f);
+        Up    = Orientation * glm::vec3(0.0f, 1.0f, 0.0f);
+        orientationDirty = false;
+        viewDirty = true;
     }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,398 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <GL/glew.h>
+
+#include "logger.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum CaptureFormat
+{
+    CAPTURE_FORMAT_PNG,     // uncompressed (stored deflate) RGB PNG
+    CAPTURE_FORMAT_RAW,     // bare top-down RGBA8 rows, size in the file name (ffmpeg -f rawvideo -pix_fmt rgba)
+};
+
+
+// CRC-32 as used by PNG chunks
+inline uint32_t CaptureCrc32(uint32_t crc, const unsigned char* data, size_t size)
+{
+    struct Table
+    {
+        uint32_t entries[256];
+        Table()
+        {
+            for (uint32_t n = 0; n < 256; ++n)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                entries[n] = c;
+            }
+        }
+    };
+    static const Table table; // thread-safe one-time initialization
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline void CapturePutBigEndian(unsigned char* out, uint32_t value)
+{
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+// Encodes bottom-up RGBA rows (as glReadPixels returns them) into an RGB PNG. The image data is zlib
+// "stored" blocks: no compression, so encoding is a copy and two checksums, which keeps a capture worker
+// ahead of the render loop. out is reused between frames to avoid reallocating.
+inline void EncodePng(const unsigned char* rgba, int width, int height, std::vector<unsigned char>& out)
+{
+    const size_t rowBytes = (size_t)width * 3 + 1; // filter byte + RGB
+    const size_t rawBytes = rowBytes * height;
+    const size_t blockSize = 65535;
+    const size_t blockCount = rawBytes == 0 ? 1 : (rawBytes + blockSize - 1) / blockSize;
+    const size_t zlibBytes = 2 + blockCount * 5 + rawBytes + 4;
+
+    out.resize(8 + (12 + 13) + (12 + zlibBytes) + 12);
+    unsigned char* p = out.data();
+
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::memcpy(p, signature, 8);
+    p += 8;
+
+    // IHDR: 8-bit RGB, no interlacing
+    CapturePutBigEndian(p, 13);
+    std::memcpy(p + 4, "IHDR", 4);
+    CapturePutBigEndian(p + 8, (uint32_t)width);
+    CapturePutBigEndian(p + 12, (uint32_t)height);
+    p[16] = 8; p[17] = 2; p[18] = 0; p[19] = 0; p[20] = 0;
+    CapturePutBigEndian(p + 21, CaptureCrc32(0, p + 4, 17));
+    p += 25;
+
+    // IDAT: zlib header, stored blocks that split the rows wherever 64 KB are full, Adler-32
+    CapturePutBigEndian(p, (uint32_t)zlibBytes);
+    std::memcpy(p + 4, "IDAT", 4);
+    unsigned char* chunkType = p + 4;
+    unsigned char* z = p + 8;
+    *z++ = 0x78;
+    *z++ = 0x01;
+    uint32_t adlerA = 1, adlerB = 0;
+    size_t blockLeft = 0, written = 0;
+    auto put = [&](unsigned char value)
+    {
+        if (blockLeft == 0)
+        {
+            size_t length = rawBytes - written < blockSize ? rawBytes - written : blockSize;
+            *z++ = written + length == rawBytes ? 1 : 0; // BFINAL on the last block, BTYPE 00
+            *z++ = (unsigned char)length;
+            *z++ = (unsigned char)(length >> 8);
+            *z++ = (unsigned char)~length;
+            *z++ = (unsigned char)(~length >> 8);
+            blockLeft = length;
+        }
+        *z++ = value;
+        --blockLeft;
+        ++written;
+        adlerA += value;
+        adlerB += adlerA;
+        if ((written & 4095) == 0) // modulo well before the sums can overflow
+        {
+            adlerA %= 65521;
+            adlerB %= 65521;
+        }
+    };
+    for (int y = height - 1; y >= 0; --y)
+    {
+        const unsigned char* row = rgba + (size_t)y * width * 4;
+        put(0);
+        for (int x = 0; x < width; ++x)
+        {
+            put(row[x * 4]);
+            put(row[x * 4 + 1]);
+            put(row[x * 4 + 2]);
+        }
+    }
+    if (rawBytes == 0)
+    {
+        const unsigned char empty[5] = { 1, 0, 0, 0xFF, 0xFF };
+        std::memcpy(z, empty, 5);
+        z += 5;
+    }
+    adlerA %= 65521;
+    adlerB %= 65521;
+    CapturePutBigEndian(z, (adlerB << 16) | adlerA);
+    z += 4;
+    CapturePutBigEndian(z, CaptureCrc32(0, chunkType, 4 + zlibBytes));
+    p = z + 4;
+
+    CapturePutBigEndian(p, 0);
+    std::memcpy(p + 4, "IEND", 4);
+    CapturePutBigEndian(p + 8, CaptureCrc32(0, p + 4, 4));
+}
+
+
+// Reads frames back from the GPU without stalling the render loop and writes them to disk on a worker thread.
+// Capture copies the back buffer into the next pixel buffer object of a small ring and fences it; Poll maps
+// PBOs whose fence has signaled (normally a couple of frames later), copies the pixels into a pooled buffer
+// and queues it for the worker. If the worker falls too far behind, frames are dropped and counted instead
+// of blocking the render thread. All methods except the worker run on the thread that owns the GL context.
+class FrameCapture
+{
+public:
+    static const int PBO_COUNT = 3;
+    static const size_t MAX_QUEUED_FRAMES = 8;
+
+    FrameCapture() {}
+    ~FrameCapture() { Destroy(); }
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // directory must exist; file names are <directory>/frame_<number>.png or frame_<number>_<w>x<h>.rgba
+    void Create(const char* directory, CaptureFormat captureFormat)
+    {
+        Destroy();
+        std::snprintf(outputDirectory, sizeof(outputDirectory), "%s", directory);
+        format = captureFormat;
+        glGenBuffers(PBO_COUNT, pbos);
+        stopping = false;
+        worker = std::thread(&FrameCapture::workerLoop, this);
+    }
+
+    // finishes every pending readback and write, then releases the buffers and the worker
+    void Destroy()
+    {
+        if (!pbos[0])
+            return;
+        while (pending > 0)
+            retire(true);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        worker.join();
+        glDeleteBuffers(PBO_COUNT, pbos);
+        pbos[0] = 0;
+    }
+
+    // queues an asynchronous readback of the current back buffer; call before swapping
+    void Capture(int width, int height)
+    {
+        if (width <= 0 || height <= 0)
+            return;
+        if (pending == PBO_COUNT)
+            retire(true); // every PBO is still in flight: the oldest is at least PBO_COUNT frames old by now
+
+        size_t bytes = (size_t)width * height * 4;
+        int index = (first + pending) % PBO_COUNT;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[index]);
+        if (pboBytes[index] != bytes)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)bytes, NULL, GL_STREAM_READ);
+            pboBytes[index] = bytes;
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadBuffer(GL_BACK);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        Readback& slot = readbacks[index];
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.width = width;
+        slot.height = height;
+        slot.number = nextNumber++;
+        ++pending;
+    }
+
+    // hands finished readbacks to the worker without waiting for the GPU; call once per frame
+    void Poll()
+    {
+        while (pending > 0 && glClientWaitSync(readbacks[first].fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+            retire(false);
+    }
+
+    unsigned RequestedCount() const { return nextNumber; }
+    unsigned CapturedCount() const { return written.load(); }     // frames whose file was written completely
+    unsigned DroppedCount() const { return dropped; }               // frames the worker could not keep up with
+    unsigned FailedCount() const { return failed.load(); }          // frames whose file could not be written
+    unsigned StallCount() const { return stalls; }
+
+private:
+    struct Readback
+    {
+        GLsync fence;
+        int width;
+        int height;
+        unsigned number;
+    };
+
+    struct Frame
+    {
+        std::vector<unsigned char> pixels;
+        int width;
+        int height;
+        unsigned number;
+    };
+
+    GLuint pbos[PBO_COUNT] = {};
+    size_t pboBytes[PBO_COUNT] = {};
+    Readback readbacks[PBO_COUNT] = {};
+    int first = 0;
+    int pending = 0;
+    unsigned nextNumber = 0;
+    unsigned dropped = 0;
+    unsigned stalls = 0;
+    std::atomic<unsigned> written{ 0 };     // updated by the worker
+    std::atomic<unsigned> failed{ 0 };
+    char outputDirectory[256] = {};
+    CaptureFormat format = CAPTURE_FORMAT_PNG;
+
+    // render thread -> worker; frames are recycled through the free list so steady capture doesn't allocate
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Frame> queue;
+    std::vector<Frame> freeFrames;
+    bool stopping = false;
+
+    // maps the oldest PBO, copies it out and queues it for writing
+    void retire(bool wait)
+    {
+        Readback& readback = readbacks[first];
+        if (wait)
+        {
+            GLenum result = glClientWaitSync(readback.fence, 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED)
+            {
+                ++stalls;
+                do
+                    result = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+                while (result == GL_TIMEOUT_EXPIRED);
+            }
+        }
+        glDeleteSync(readback.fence);
+        readback.fence = 0;
+
+        Frame frame;
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            full = queue.size() >= MAX_QUEUED_FRAMES;
+            if (!full && !freeFrames.empty())
+            {
+                frame = std::move(freeFrames.back());
+                freeFrames.pop_back();
+            }
+        }
+
+        if (full)
+        {
+            ++dropped;
+        }
+        else
+        {
+            size_t bytes = (size_t)readback.width * readback.height * 4;
+            frame.pixels.resize(bytes);
+            frame.width = readback.width;
+            frame.height = readback.height;
+            frame.number = readback.number;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[first]);
+            const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)bytes, GL_MAP_READ_BIT);
+            if (mapped)
+            {
+                std::memcpy(frame.pixels.data(), mapped, bytes);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            if (mapped)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push_back(std::move(frame));
+                }
+                condition.notify_one();
+            }
+            else
+            {
+                ++dropped;
+            }
+        }
+
+        first = (first + 1) % PBO_COUNT;
+        --pending;
+    }
+
+    void workerLoop()
+    {
+        std::vector<unsigned char> encoded;
+        for (;;)
+        {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return !queue.empty() || stopping; });
+                if (queue.empty())
+                    return; // stopping and everything written
+                frame = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            write(frame, encoded);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            freeFrames.push_back(std::move(frame));
+        }
+    }
+
+    // writes one frame; a file that could not be written completely (e.g. the disk is full) is removed
+    void write(const Frame& frame, std::vector<unsigned char>& encoded)
+    {
+        char path[512];
+        FILE* out = nullptr;
+        bool ok = false;
+        if (format == CAPTURE_FORMAT_PNG)
+        {
+            std::snprintf(path, sizeof(path), "%s/frame_%06u.png", outputDirectory, frame.number);
+            EncodePng(frame.pixels.data(), frame.width, frame.height, encoded);
+            out = std::fopen(path, "wb");
+            ok = out && std::fwrite(encoded.data(), 1, encoded.size(), out) == encoded.size();
+        }
+        else
+        {
+            // flip to top-down rows so the file plays back upright
+            std::snprintf(path, sizeof(path), "%s/frame_%06u_%dx%d.rgba", outputDirectory, frame.number, frame.width, frame.height);
+            out = std::fopen(path, "wb");
+            size_t rowBytes = (size_t)frame.width * 4;
+            ok = out != nullptr;
+            for (int y = frame.height - 1; ok && y >= 0; --y)
+                ok = std::fwrite(frame.pixels.data() + y * rowBytes, 1, rowBytes, out) == rowBytes;
+        }
+        if (out)
+            ok = std::fclose(out) == 0 && ok;
+
+        if (ok)
+        {
+            ++written;
+            return;
+        }
+        if (out)
+            std::remove(path);
+        ++failed;
+        ULOG_ERROR << "Could not write capture " << path;
+    }
+};
+#endif
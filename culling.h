@@ -0,0 +1,73 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+// The six planes of a view frustum (xyz = inward facing normal, w = distance), in world space
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+
+// extracts the frustum planes from a combined projection * view matrix (Gribb/Hartmann)
+inline Frustum ExtractFrustum(const glm::mat4& viewProjection)
+{
+    // rows of the matrix (glm stores columns)
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; ++i)
+        row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0]; // left
+    frustum.planes[1] = row[3] - row[0]; // right
+    frustum.planes[2] = row[3] + row[1]; // bottom
+    frustum.planes[3] = row[3] - row[1]; // top
+    frustum.planes[4] = row[3] + row[2]; // near
+    frustum.planes[5] = row[3] - row[2]; // far
+
+    for (glm::vec4& plane : frustum.planes)
+    {
+        float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        plane /= length;
+    }
+    return frustum;
+}
+
+
+// computes the world space box enclosing a transformed local space box (Arvo's method)
+inline void TransformBounds(const glm::vec3& localMin, const glm::vec3& localMax, const glm::mat4& model, glm::vec3& worldMin, glm::vec3& worldMax)
+{
+    worldMin = glm::vec3(model[3]);
+    worldMax = worldMin;
+    for (int column = 0; column < 3; ++column)
+    {
+        for (int row = 0; row < 3; ++row)
+        {
+            float a = model[column][row] * localMin[column];
+            float b = model[column][row] * localMax[column];
+            worldMin[row] += a < b ? a : b;
+            worldMax[row] += a < b ? b : a;
+        }
+    }
+}
+
+
+// returns false only when the box is completely outside one of the frustum planes
+inline bool FrustumIntersectsBox(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    for (const glm::vec4& plane : frustum.planes)
+    {
+        // test the corner furthest along the plane normal
+        glm::vec3 corner(
+            plane.x >= 0.0f ? boxMax.x : boxMin.x,
+            plane.y >= 0.0f ? boxMax.y : boxMin.y,
+            plane.z >= 0.0f ? boxMax.z : boxMin.z);
+        if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+#endif
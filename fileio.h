@@ -0,0 +1,55 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <cstdio>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Writes a file through a temporary file next to it. write(FILE*) returns false on a short write; the temporary
+// file replaces the target only once every write and the close succeeded, so neither a crash nor a failed write
+// ever leaves a truncated file behind or loses the file that was there before.
+template <typename Write>
+inline bool WriteFileAtomically(const char* path, Write write)
+{
+    char temporaryPath[512];
+    if (std::snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path) >= (int)sizeof(temporaryPath))
+        return false;
+    FILE* out = std::fopen(temporaryPath, "wb");
+    if (!out)
+        return false;
+    bool ok = write(out);
+    ok = std::fclose(out) == 0 && ok;
+
+    // rename replaces an existing target in one step on POSIX; Windows needs MoveFileEx for that
+#ifdef _WIN32
+    ok = ok && MoveFileExA(temporaryPath, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    ok = ok && std::rename(temporaryPath, path) == 0;
+#endif
+    if (!ok)
+        std::remove(temporaryPath);
+    return ok;
+}
+
+
+// creates a directory for output files (mesh cache, captures, regression images) if it does not exist yet
+inline void CreateDirectoryIfMissing(const char* path)
+{
+#ifdef _WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+}
+#endif
@@ -0,0 +1,212 @@
+#ifndef FRAMEPACING_H
+#define FRAMEPACING_H
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <thread>
+
+// Caps the frame rate by waiting for a fixed deadline each frame. Sleeping wakes up late by up to a
+// scheduler tick, so it only sleeps until shortly before the deadline and yields for the rest; the margin
+// follows the worst oversleep seen recently, so the spin stays short where the scheduler is precise.
+class FrameLimiter
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit FrameLimiter(double framesPerSecond = 0.0) { SetRate(framesPerSecond); }
+
+    // 0 or less disables the cap
+    void SetRate(double framesPerSecond)
+    {
+        period = framesPerSecond > 0.0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond)) : Clock::duration::zero();
+        deadline = Clock::time_point();
+    }
+
+    // waits until the next frame is due
+    void Wait()
+    {
+        if (period == Clock::duration::zero())
+            return;
+
+        Clock::time_point now = Clock::now();
+        if (deadline == Clock::time_point())
+            deadline = now;
+        deadline += period;
+        if (deadline < now)
+        {
+            // more than a frame behind: start over instead of rushing to catch up
+            deadline = now;
+            return;
+        }
+
+        Clock::time_point wakeUp = deadline - margin;
+        if (now < wakeUp)
+        {
+            std::this_thread::sleep_until(wakeUp);
+            Clock::duration oversleep = Clock::now() - wakeUp;
+            margin -= margin / 16; // let the margin shrink again once the scheduler behaves
+            if (oversleep + std::chrono::microseconds(200) > margin)
+                margin = oversleep + std::chrono::microseconds(200);
+        }
+        while (Clock::now() < deadline)
+            std::this_thread::yield();
+    }
+
+private:
+    Clock::duration period = Clock::duration::zero();
+    Clock::time_point deadline;
+    Clock::duration margin = std::chrono::milliseconds(2);
+};
+
+
+// Latency of one frame, in seconds of the glfwGetTime clock
+struct FrameLatency
+{
+    double inputTime;   // when the input this frame reflects was sampled
+    double submitTime;  // when the frame was handed to SwapBuffers
+    double gpuDoneTime; // when the GPU finished the frame, the earliest it can reach the screen
+};
+
+// Limits how many frames the GPU may queue up and measures when each of them finished.
+// Every frame ends with a fence and a timestamp query; before a new frame is recorded, the oldest frame
+// is waited for when maxFramesInFlight frames are still pending. GPU timestamps are mapped onto the CPU
+// clock through an offset that is recalibrated about once a second, so finished frames can be compared
+// with the time their input was sampled. The estimate excludes the display's own scanout delay.
+class FramePacer
+{
+public:
+    static const int MAX_FRAMES_IN_FLIGHT = 4;
+
+    FramePacer() {}
+    ~FramePacer() { Destroy(); }
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    // clock returns the CPU time in seconds that latencies are measured against
+    void Create(int maxFramesInFlight, double (*clock)())
+    {
+        Destroy();
+        limit = maxFramesInFlight < 1 ? 1 : (maxFramesInFlight > MAX_FRAMES_IN_FLIGHT ? MAX_FRAMES_IN_FLIGHT : maxFramesInFlight);
+        now = clock;
+        glGenQueries(MAX_FRAMES_IN_FLIGHT, queries);
+        first = count = 0;
+        calibrate();
+    }
+
+    void Destroy()
+    {
+        if (!queries[0])
+            return;
+        for (; count > 0; --count, first = (first + 1) % MAX_FRAMES_IN_FLIGHT)
+        {
+            glClientWaitSync(frames[first].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            glDeleteSync(frames[first].fence);
+        }
+        glDeleteQueries(MAX_FRAMES_IN_FLIGHT, queries);
+        queries[0] = 0;
+    }
+
+    // blocks until fewer than maxFramesInFlight frames are pending on the GPU
+    void WaitForFrameSlot()
+    {
+        while (count >= limit)
+        {
+            GLenum result = glClientWaitSync(frames[first].fence, 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED)
+            {
+                ++waits;
+                do
+                    result = glClientWaitSync(frames[first].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+                while (result == GL_TIMEOUT_EXPIRED);
+            }
+            retire();
+        }
+    }
+
+    // call right after SwapBuffers; inputTime is when the frame's input was sampled
+    void EndFrame(double inputTime)
+    {
+        Frame& frame = frames[(first + count) % MAX_FRAMES_IN_FLIGHT];
+        frame.query = queries[(first + count) % MAX_FRAMES_IN_FLIGHT];
+        glQueryCounter(frame.query, GL_TIMESTAMP);
+        frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        frame.inputTime = inputTime;
+        frame.submitTime = now();
+        ++count;
+        if (frame.submitTime - calibratedAt > 1.0)
+            calibrate();
+    }
+
+    // returns the oldest finished frame that has not been returned yet, without waiting for the GPU
+    bool PopLatency(FrameLatency& latency)
+    {
+        while (count > 0 && glClientWaitSync(frames[first].fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+            retire();
+        if (completedCount == 0)
+            return false;
+        latency = completed[completedFirst];
+        completedFirst = (completedFirst + 1) % MAX_FRAMES_IN_FLIGHT;
+        --completedCount;
+        return true;
+    }
+
+    // number of frames that had to wait for the GPU before they could start
+    unsigned WaitCount() const { return waits; }
+    int Limit() const { return limit; }
+
+private:
+    struct Frame
+    {
+        GLsync fence;
+        GLuint query;
+        double inputTime;
+        double submitTime;
+    };
+
+    Frame frames[MAX_FRAMES_IN_FLIGHT] = {};
+    GLuint queries[MAX_FRAMES_IN_FLIGHT] = {};
+    int first = 0;
+    int count = 0;
+    int limit = 2;
+    double (*now)() = nullptr;
+    double gpuToCpu = 0.0;  // add to a GPU timestamp in seconds to get CPU time
+    double calibratedAt = 0.0;
+    FrameLatency completed[MAX_FRAMES_IN_FLIGHT] = {}; // finished frames not yet returned by PopLatency
+    int completedFirst = 0;
+    int completedCount = 0;
+    unsigned waits = 0;
+
+    void calibrate()
+    {
+        GLint64 gpuTime = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+        calibratedAt = now();
+        gpuToCpu = calibratedAt - gpuTime * 1e-9;
+    }
+
+    // the oldest frame's fence has signaled: read its timestamp and free its slot
+    void retire()
+    {
+        Frame& frame = frames[first];
+        GLuint64 gpuTime = 0;
+        glGetQueryObjectui64v(frame.query, GL_QUERY_RESULT, &gpuTime);
+        glDeleteSync(frame.fence);
+        frame.fence = 0;
+
+        if (completedCount == MAX_FRAMES_IN_FLIGHT) // nobody is reading them: drop the oldest
+        {
+            completedFirst = (completedFirst + 1) % MAX_FRAMES_IN_FLIGHT;
+            --completedCount;
+        }
+        FrameLatency& latency = completed[(completedFirst + completedCount++) % MAX_FRAMES_IN_FLIGHT];
+        latency.inputTime = frame.inputTime;
+        latency.submitTime = frame.submitTime;
+        latency.gpuDoneTime = gpuTime * 1e-9 + gpuToCpu;
+
+        first = (first + 1) % MAX_FRAMES_IN_FLIGHT;
+        --count;
+    }
+};
+#endif
@@ -0,0 +1,72 @@
+#ifndef FRAMEPACKET_H
+#define FRAMEPACKET_H
+
+#include <condition_variable>
+#include <mutex>
+
+// Hands frame packets from the simulation thread to the render thread through two slots.
+// The producer fills one slot while the consumer draws from the other; the producer never gets more
+// than one frame ahead, so updating frame N+1 overlaps with submitting frame N.
+template <typename Packet>
+class FramePacketBuffer
+{
+public:
+    // waits until the consumer has picked up the previously published packet, then returns the free slot to fill
+    Packet& BeginWrite()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return !pending || stopped; });
+        return slots[writeIndex];
+    }
+
+    // makes the slot returned by BeginWrite available to the consumer
+    void Publish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            readyIndex = writeIndex;
+            writeIndex ^= 1;
+            pending = true;
+        }
+        condition.notify_all();
+    }
+
+    // waits for the next published packet; the previous packet must no longer be in use.
+    // Returns nullptr once Stop has been called.
+    const Packet* Acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return pending || stopped; });
+        if (stopped)
+            return nullptr;
+        pending = false;
+        condition.notify_all();
+        return &slots[readyIndex];
+    }
+
+    // wakes up both sides so the threads can exit
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        condition.notify_all();
+    }
+
+    bool IsStopped()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stopped;
+    }
+
+private:
+    Packet slots[2];
+    int writeIndex = 0;
+    int readyIndex = 0;
+    bool pending = false;   // a published packet has not been picked up yet
+    bool stopped = false;
+    std::mutex mutex;
+    std::condition_variable condition;
+};
+#endif
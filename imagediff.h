@@ -0,0 +1,120 @@
+#ifndef IMAGEDIFF_H
+#define IMAGEDIFF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// SSE2 is always available on x64 (and on x86 builds compiled with /arch:SSE2)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGEDIFF_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Perceptual distance between two RGBA8 pixels: absolute channel differences weighted like luma
+// (0.297 R + 0.586 G + 0.117 B, in 128ths), so 0-255 where a change in green counts five times a change in blue.
+// Alpha is ignored.
+inline unsigned PixelDistance(const unsigned char* a, const unsigned char* b)
+{
+    int dr = std::abs(a[0] - b[0]);
+    int dg = std::abs(a[1] - b[1]);
+    int db = std::abs(a[2] - b[2]);
+    return (unsigned)(38 * dr + 75 * dg + 15 * db) >> 7;
+}
+
+struct ImageDiffResult
+{
+    unsigned maxDistance;       // largest PixelDistance in the image
+    double meanDistance;
+    size_t differingPixels;     // pixels whose distance exceeds the tolerance
+    size_t pixelCount;
+};
+
+
+// Compares two RGBA8 images of pixelCount pixels; a pixel differs when its distance exceeds tolerance
+inline ImageDiffResult DiffImages(const unsigned char* a, const unsigned char* b, size_t pixelCount, unsigned tolerance)
+{
+    ImageDiffResult result = { 0, 0.0, 0, pixelCount };
+    uint64_t distanceSum = 0;
+    size_t i = 0;
+
+#ifdef IMAGEDIFF_USE_SSE2
+    // 4 pixels per iteration: |a - b| per byte, weighted sums with two multiply-adds, compare against the tolerance
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights = _mm_setr_epi16(38, 75, 15, 0, 38, 75, 15, 0);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i threshold = _mm_set1_epi32((int)tolerance);
+    __m128i maxDistance = zero;
+    while (i + 4 <= pixelCount)
+    {
+        // the 32-bit lane sums are flushed every 2^20 pixels, long before they could overflow
+        size_t blockEnd = pixelCount - i > ((size_t)1 << 20) ? i + ((size_t)1 << 20) : pixelCount;
+        __m128i sum = zero;
+        for (; i + 4 <= blockEnd; i += 4)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i * 4));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + i * 4));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+
+            // per pixel (38 dr + 75 dg) and (15 db), at most 28815 so they pack into 16 bits
+            __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(d, zero), weights);
+            __m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(d, zero), weights);
+            __m128i distance = _mm_srli_epi32(_mm_madd_epi16(_mm_packs_epi32(low, high), ones), 7);
+
+            sum = _mm_add_epi32(sum, distance);
+            maxDistance = _mm_max_epi16(maxDistance, distance); // distances fit the low 16 bits of each lane
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(distance, threshold)));
+            result.differingPixels += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+        }
+
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, sum);
+        distanceSum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        if (blockEnd == pixelCount)
+            break;
+    }
+    uint32_t maxLanes[4];
+    _mm_storeu_si128((__m128i*)maxLanes, maxDistance);
+    for (int k = 0; k < 4; ++k)
+        result.maxDistance = maxLanes[k] > result.maxDistance ? maxLanes[k] : result.maxDistance;
+#endif
+
+    for (; i < pixelCount; ++i)
+    {
+        unsigned distance = PixelDistance(a + i * 4, b + i * 4);
+        distanceSum += distance;
+        result.maxDistance = distance > result.maxDistance ? distance : result.maxDistance;
+        if (distance > tolerance)
+            ++result.differingPixels;
+    }
+
+    result.meanDistance = pixelCount ? (double)distanceSum / pixelCount : 0.0;
+    return result;
+}
+
+
+// Visualizes a diff as RGBA8: differing pixels in red (brighter for larger distances), the rest as a faded gray copy of a
+inline void BuildDiffImage(const unsigned char* a, const unsigned char* b, size_t pixelCount, unsigned tolerance, std::vector<unsigned char>& out)
+{
+    out.resize(pixelCount * 4);
+    for (size_t i = 0; i < pixelCount; ++i)
+    {
+        const unsigned char* pa = a + i * 4;
+        unsigned char* po = out.data() + i * 4;
+        unsigned distance = PixelDistance(pa, b + i * 4);
+        if (distance > tolerance)
+        {
+            po[0] = (unsigned char)(128 + (distance > 127 ? 127 : distance));
+            po[1] = 0;
+            po[2] = 0;
+        }
+        else
+        {
+            unsigned char gray = (unsigned char)(((38 * pa[0] + 75 * pa[1] + 15 * pa[2]) >> 7) / 4 + 32);
+            po[0] = po[1] = po[2] = gray;
+        }
+        po[3] = 255;
+    }
+}
+#endif
@@ -0,0 +1,106 @@
+#ifndef INPUTQUEUE_H
+#define INPUTQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Input events recorded by the GLFW callbacks and handled once per frame by the simulation. The callbacks only
+// copy their arguments into the queue, so they never block, print or touch the camera; whoever drains the queue
+// owns all input state. The queue holds one producer and one consumer: each side only writes its own index
+// and reads the other's, so neither needs a lock however the two are spread over threads.
+
+enum InputEventType : uint8_t
+{
+    INPUT_KEY,          // code is the GLFW key, action GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT
+    INPUT_MOUSE_MOVE,   // x and y are the cursor position
+    INPUT_SCROLL,       // x and y are the scroll offsets
+    INPUT_MOUSE_BUTTON  // code is the GLFW mouse button, action GLFW_PRESS or GLFW_RELEASE
+};
+
+struct InputEvent
+{
+    InputEventType type;
+    uint8_t action;
+    int16_t code;
+    float x;
+    float y;
+};
+
+
+// Fixed capacity single producer, single consumer ring; Capacity must be a power of two
+template <typename Event, size_t Capacity>
+class SPSCQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "SPSCQueue capacity must be a power of two");
+
+public:
+    // producer side; false (and the event is dropped) when the consumer has fallen Capacity events behind
+    bool Push(const Event& event)
+    {
+        size_t tail = writeIndex.load(std::memory_order_relaxed);
+        if (tail - cachedReadIndex == Capacity)
+        {
+            cachedReadIndex = readIndex.load(std::memory_order_acquire);
+            if (tail - cachedReadIndex == Capacity)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        events[tail & (Capacity - 1)] = event;
+        writeIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // producer side; pushes all count events, published together, or none of them when there is not room for all
+    bool PushAll(const Event* batch, size_t count)
+    {
+        size_t tail = writeIndex.load(std::memory_order_relaxed);
+        if (tail - cachedReadIndex + count > Capacity)
+        {
+            cachedReadIndex = readIndex.load(std::memory_order_acquire);
+            if (tail - cachedReadIndex + count > Capacity)
+            {
+                dropped.fetch_add((unsigned)count, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        for (size_t i = 0; i < count; ++i)
+            events[(tail + i) & (Capacity - 1)] = batch[i];
+        writeIndex.store(tail + count, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side; false when the queue is empty
+    bool Pop(Event& event)
+    {
+        size_t head = readIndex.load(std::memory_order_relaxed);
+        if (head == cachedWriteIndex)
+        {
+            cachedWriteIndex = writeIndex.load(std::memory_order_acquire);
+            if (head == cachedWriteIndex)
+                return false;
+        }
+        event = events[head & (Capacity - 1)];
+        readIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    unsigned DroppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    // The indices only grow. Padding keeps each side's index, with its copy of the other side's, a cache line
+    // away from the other side's (padding rather than alignas, so queues can be allocated with new before C++17)
+    static const size_t CACHE_LINE = 64;
+    Event events[Capacity];
+    char eventsPadding[CACHE_LINE];
+    std::atomic<size_t> writeIndex{ 0 };
+    size_t cachedReadIndex = 0;     // producer's last view of readIndex
+    char producerPadding[CACHE_LINE];
+    std::atomic<size_t> readIndex{ 0 };
+    size_t cachedWriteIndex = 0;    // consumer's last view of writeIndex
+    char consumerPadding[CACHE_LINE];
+    std::atomic<unsigned> dropped{ 0 };
+};
+#endif
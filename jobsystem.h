@@ -0,0 +1,204 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the unfinished jobs of a batch; JobSystem::Wait returns once it reaches zero
+typedef std::atomic<int> JobCounter;
+
+
+// A small work-stealing thread pool. Every thread owns a queue: it pushes and pops work at the back
+// of its own queue and steals from the front of the others' when it runs dry. The thread that
+// created the system takes part as worker 0 whenever it waits for a batch.
+class JobSystem
+{
+public:
+    // threadCount includes the calling thread; 0 uses every hardware thread
+    explicit JobSystem(unsigned threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::thread::hardware_concurrency();
+        if (threadCount == 0)
+            threadCount = 1;
+
+        for (unsigned i = 0; i < threadCount; ++i)
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        for (unsigned i = 1; i < threadCount; ++i)
+            threads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        sleepCondition.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // number of threads executing jobs, including the caller of Wait
+    unsigned ThreadCount() const
+    {
+        return (unsigned)queues.size();
+    }
+
+    // queues a job; counter is incremented now and decremented when the job finishes
+    void Run(JobCounter& counter, std::function<void()> task)
+    {
+        counter.fetch_add(1);
+        Queue& queue = *queues[currentThreadIndex()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(Job{ std::move(task), &counter });
+        }
+        pendingJobs.fetch_add(1);
+
+        // taking the sleep lock makes sure a worker between its check and its wait still gets woken
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        sleepCondition.notify_one();
+    }
+
+    // executes queued jobs on the calling thread until every job of the counter has finished
+    void Wait(JobCounter& counter)
+    {
+        unsigned index = currentThreadIndex();
+        while (counter.load() > 0)
+        {
+            Job job;
+            if (findJob(index, job))
+                execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    // calls func(begin, end) over [0, count) split into chunks of at least grainSize and waits for all of them
+    template <typename Func>
+    void ParallelFor(int count, int grainSize, Func func)
+    {
+        if (count <= 0)
+            return;
+        if (grainSize < 1)
+            grainSize = 1;
+
+        // a few chunks per thread so faster threads can steal the remainder
+        int chunkSize = count / (int)(ThreadCount() * 4);
+        if (chunkSize < grainSize)
+            chunkSize = grainSize;
+        if (chunkSize >= count)
+        {
+            func(0, count);
+            return;
+        }
+
+        JobCounter counter(0);
+        for (int begin = chunkSize; begin < count; begin += chunkSize)
+        {
+            int end = begin + chunkSize < count ? begin + chunkSize : count;
+            Run(counter, [&func, begin, end]() { func(begin, end); });
+        }
+        func(0, chunkSize);
+        Wait(counter);
+    }
+
+private:
+    struct Job
+    {
+        std::function<void()> task;
+        JobCounter* counter;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> pendingJobs{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    bool stopping = false;
+
+    // index of the queue owned by the current thread (0 for any thread that is not a worker)
+    static unsigned& currentThreadIndex()
+    {
+        thread_local unsigned index = 0;
+        return index;
+    }
+
+    bool findJob(unsigned index, Job& job)
+    {
+        if (pendingJobs.load() == 0)
+            return false;
+
+        // newest job of our own queue first, it is most likely still in cache
+        {
+            Queue& own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty())
+            {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                pendingJobs.fetch_sub(1);
+                return true;
+            }
+        }
+
+        // otherwise steal the oldest job of another thread
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            Queue& victim = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty())
+            {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                pendingJobs.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void execute(Job& job)
+    {
+        job.task();
+        job.counter->fetch_sub(1);
+    }
+
+    void workerLoop(unsigned index)
+    {
+        currentThreadIndex() = index;
+        for (;;)
+        {
+            Job job;
+            if (findJob(index, job))
+            {
+                execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCondition.wait(lock, [this]() { return stopping || pendingJobs.load() > 0; });
+            if (stopping)
+                return;
+        }
+    }
+};
+#endif
@@ -0,0 +1,360 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <glm/glm.hpp>
+
+#include "fileio.h"         // WriteFileAtomically
+#include "jobsystem.h"
+#include "phong.h"          // PHONG_AMBIENT_STRENGTH
+#include "vertexformat.h"   // FloatToHalf
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Bakes the view independent part of the Phong model (ambient + diffuse) of static geometry into an RGBA16F atlas.
+// Every triangle gets its own square chart; the triangle covers the lower-left half of the chart and every texel of
+// the chart, padding included, is baked from the closest point of the triangle, so bilinear filtering at the edges
+// never reads another chart. Charts are sized by world space edge length and packed into shelves.
+//   rgb: ambient + diffuse of the static lights, multiplied by their colors
+//   a:   ambient + diffuse factor of the one light that may move (the orbiting lamp), without its color
+// Optional ambient occlusion casts cosine distributed rays against all triangles and darkens both; optional
+// shadows trace one ray from every texel to every light.
+
+const int LIGHTMAP_PADDING = 1;         // texels around each triangle inside its chart
+const int LIGHTMAP_MIN_CHART = 4;       // texels per triangle leg, without padding
+const int LIGHTMAP_MAX_CHART = 512;
+const char LIGHTMAP_FILE_MAGIC[4] = { 'L', 'M', 'A', 'P' };
+const uint32_t LIGHTMAP_FILE_VERSION = 3; // bump whenever the layout or the baked terms change
+
+struct LightmapSettings
+{
+    float texelsPerUnit;    // along the longer leg of each triangle, clamped to the chart size limits
+    int atlasWidth;
+    int aoRays;             // per texel, 0 disables ambient occlusion
+    float aoDistance;       // occluders farther away than this are ignored
+    int shadows;            // 1 traces shadow rays towards the lights
+};
+
+struct LightmapLight
+{
+    glm::vec3 position;
+    glm::vec3 color;
+};
+
+class LightmapBaker
+{
+public:
+    // starts the triangles of a new object; objects are the bounding boxes ambient occlusion rays are tested against first
+    void BeginObject()
+    {
+        objects.push_back({ triangles.size(), triangles.size(), glm::vec3(0.0f), glm::vec3(0.0f) });
+    }
+
+    // adds a world space triangle to the current object
+    void AddTriangle(const glm::vec3 positions[3], const glm::vec3 normals[3])
+    {
+        if (objects.empty())
+            BeginObject();
+        Object& object = objects.back();
+        Triangle triangle;
+        for (int i = 0; i < 3; ++i)
+        {
+            triangle.position[i] = positions[i];
+            triangle.normal[i] = normals[i];
+            object.boundsMin = object.end == object.begin && i == 0 ? positions[i] : glm::min(object.boundsMin, positions[i]);
+            object.boundsMax = object.end == object.begin && i == 0 ? positions[i] : glm::max(object.boundsMax, positions[i]);
+        }
+        triangles.push_back(triangle);
+        ++object.end;
+    }
+
+    size_t TriangleCount() const { return triangles.size(); }
+
+    // sizes the charts of all triangles and packs them into shelves, largest first; sets Width and Height
+    void Pack(const LightmapSettings& lightmapSettings)
+    {
+        settings = lightmapSettings;
+        width = std::max(settings.atlasWidth, LIGHTMAP_MAX_CHART + 2 * LIGHTMAP_PADDING);
+
+        std::vector<uint32_t> order(triangles.size());
+        for (size_t t = 0; t < triangles.size(); ++t)
+        {
+            Triangle& triangle = triangles[t];
+            float leg = std::max(glm::length(triangle.position[1] - triangle.position[0]), glm::length(triangle.position[2] - triangle.position[0]));
+            int texels = (int)std::ceil(leg * settings.texelsPerUnit);
+            triangle.chartInner = std::min(std::max(texels, LIGHTMAP_MIN_CHART), LIGHTMAP_MAX_CHART);
+            order[t] = (uint32_t)t;
+        }
+        std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return triangles[a].chartInner > triangles[b].chartInner; });
+
+        int x = 0, y = 0, shelfHeight = 0;
+        for (uint32_t t : order)
+        {
+            Triangle& triangle = triangles[t];
+            int size = triangle.chartInner + 2 * LIGHTMAP_PADDING;
+            if (x + size > width)
+            {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            triangle.chartX = x;
+            triangle.chartY = y;
+            x += size;
+            shelfHeight = std::max(shelfHeight, size);
+        }
+        height = (y + shelfHeight + 3) & ~3;
+    }
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    // lightmap texture coordinate of a corner of a triangle, valid after Pack
+    glm::vec2 TexCoord(size_t triangle, int corner) const
+    {
+        const Triangle& t = triangles[triangle];
+        glm::vec2 texel((float)(t.chartX + LIGHTMAP_PADDING), (float)(t.chartY + LIGHTMAP_PADDING));
+        if (corner == 1)
+            texel.x += (float)t.chartInner;
+        else if (corner == 2)
+            texel.y += (float)t.chartInner;
+        return texel / glm::vec2((float)width, (float)height);
+    }
+
+    // FNV-1a over everything the baked texels depend on, to validate a cached lightmap; valid after Pack
+    uint64_t Hash(const LightmapLight* staticLights, int staticLightCount, const glm::vec3& movableLight) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&hash](const void* data, size_t size)
+        {
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < size; ++i)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+        };
+        add(&LIGHTMAP_FILE_VERSION, sizeof(LIGHTMAP_FILE_VERSION));
+        add(&settings, sizeof(settings));
+        add(staticLights, sizeof(LightmapLight) * staticLightCount);
+        add(&movableLight, sizeof(movableLight));
+        for (const Triangle& triangle : triangles)
+            add(&triangle, sizeof(triangle));
+        return hash;
+    }
+
+    // bakes every chart; rows of the atlas are spread across the job system
+    void Bake(const LightmapLight* staticLights, int staticLightCount, const glm::vec3& movableLight, JobSystem& jobs)
+    {
+        std::vector<int32_t> chartOf((size_t)width * height, -1);
+        for (size_t t = 0; t < triangles.size(); ++t)
+        {
+            const Triangle& triangle = triangles[t];
+            int size = triangle.chartInner + 2 * LIGHTMAP_PADDING;
+            for (int y = triangle.chartY; y < triangle.chartY + size; ++y)
+                std::fill(&chartOf[(size_t)y * width + triangle.chartX], &chartOf[(size_t)y * width + triangle.chartX] + size, (int32_t)t);
+        }
+
+        texels.assign((size_t)width * height * 4, 0);
+        jobs.ParallelFor(height, 4, [&](int firstRow, int lastRow)
+        {
+            for (int y = firstRow; y < lastRow; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    size_t texel = (size_t)y * width + x;
+                    if (chartOf[texel] < 0)
+                        continue;
+                    glm::vec4 value = bakeTexel(triangles[chartOf[texel]], x, y, staticLights, staticLightCount, movableLight);
+                    for (int c = 0; c < 4; ++c)
+                        texels[texel * 4 + c] = FloatToHalf(value[c]);
+                }
+            }
+        });
+    }
+
+    // RGBA half floats, bottom row first
+    std::vector<unsigned short>& Texels() { return texels; }
+    const std::vector<unsigned short>& Texels() const { return texels; }
+
+private:
+    struct Triangle
+    {
+        glm::vec3 position[3];
+        glm::vec3 normal[3];
+        int chartX = 0;
+        int chartY = 0;
+        int chartInner = 0;     // texels along each leg
+    };
+
+    struct Object
+    {
+        size_t begin;
+        size_t end;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
+
+    LightmapSettings settings = {};
+    std::vector<Triangle> triangles;
+    std::vector<Object> objects;
+    std::vector<unsigned short> texels;
+    int width = 0;
+    int height = 0;
+
+    glm::vec4 bakeTexel(const Triangle& t, int x, int y, const LightmapLight* staticLights, int staticLightCount, const glm::vec3& movableLight) const
+    {
+        // barycentrics of the texel center, moved to the closest point of the triangle for padding and the
+        // upper-right half: b1 and b2 are texel axes at the same scale, so this is the closest point in the chart
+        float b1 = std::max((x + 0.5f - t.chartX - LIGHTMAP_PADDING) / t.chartInner, 0.0f);
+        float b2 = std::max((y + 0.5f - t.chartY - LIGHTMAP_PADDING) / t.chartInner, 0.0f);
+        float excess = b1 + b2 - 1.0f;
+        if (excess > 0.0f)
+        {
+            // perpendicular onto the hypotenuse, then onto its end points
+            b1 = glm::clamp(b1 - excess * 0.5f, 0.0f, 1.0f);
+            b2 = 1.0f - b1;
+        }
+        float b0 = 1.0f - b1 - b2;
+        glm::vec3 position = t.position[0] * b0 + t.position[1] * b1 + t.position[2] * b2;
+        glm::vec3 normal = t.normal[0] * b0 + t.normal[1] * b1 + t.normal[2] * b2;
+        float normalLength = glm::length(normal);
+        normal = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        glm::vec4 value(0.0f);
+        for (int i = 0; i < staticLightCount; ++i)
+            value += glm::vec4((PHONG_AMBIENT_STRENGTH + diffuse(position, normal, staticLights[i].position)) * staticLights[i].color, 0.0f);
+        value.w = PHONG_AMBIENT_STRENGTH + diffuse(position, normal, movableLight);
+
+        if (settings.aoRays > 0)
+            value *= ambientOcclusion(position, normal, (uint32_t)(y * width + x));
+        return value;
+    }
+
+    // Lambert factor of a light, 0 when shadows are enabled and a triangle blocks the light
+    float diffuse(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& light) const
+    {
+        glm::vec3 toLight = light - position;
+        float distance = glm::length(toLight);
+        glm::vec3 direction = toLight / distance;
+        float impact = std::max(glm::dot(normal, direction), 0.0f);
+        if (impact > 0.0f && settings.shadows && occluded(position + normal * 1e-3f, direction, distance))
+            return 0.0f;
+        return impact;
+    }
+
+    // fraction of cosine weighted rays that escape within aoDistance; rays are stratified and rotated per texel
+    float ambientOcclusion(const glm::vec3& position, const glm::vec3& normal, uint32_t seed) const
+    {
+        glm::vec3 tangent = std::abs(normal.x) > 0.5f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        tangent = glm::normalize(glm::cross(tangent, normal));
+        glm::vec3 bitangent = glm::cross(normal, tangent);
+        glm::vec3 origin = position + normal * 1e-3f;
+
+        seed = seed * 747796405u + 2891336453u;
+        float rotation = (float)(seed >> 8) * (1.0f / 16777216.0f);
+        int open = 0;
+        for (int k = 0; k < settings.aoRays; ++k)
+        {
+            float u = (k + 0.5f) / settings.aoRays;
+            float angle = 6.2831853f * (k * 0.618034f + rotation);
+            float radius = std::sqrt(u);
+            glm::vec3 direction = tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + normal * std::sqrt(1.0f - u);
+            if (!occluded(origin, direction, settings.aoDistance))
+                ++open;
+        }
+        return (float)open / settings.aoRays;
+    }
+
+    bool occluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+    {
+        glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        for (const Object& object : objects)
+        {
+            // slab test of the ray segment against the object's bounds
+            glm::vec3 t0 = (object.boundsMin - origin) * inverse;
+            glm::vec3 t1 = (object.boundsMax - origin) * inverse;
+            glm::vec3 nearest = glm::min(t0, t1), farthest = glm::max(t0, t1);
+            float enter = std::max(std::max(nearest.x, nearest.y), std::max(nearest.z, 0.0f));
+            float exit = std::min(std::min(farthest.x, farthest.y), std::min(farthest.z, maxDistance));
+            if (enter > exit)
+                continue;
+
+            for (size_t i = object.begin; i < object.end; ++i)
+                if (intersects(triangles[i], origin, direction, maxDistance))
+                    return true;
+        }
+        return false;
+    }
+
+    // Moller-Trumbore, counting hits from either side
+    static bool intersects(const Triangle& t, const glm::vec3& origin, const glm::vec3& direction, float maxDistance)
+    {
+        glm::vec3 edge1 = t.position[1] - t.position[0];
+        glm::vec3 edge2 = t.position[2] - t.position[0];
+        glm::vec3 p = glm::cross(direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (std::abs(determinant) < 1e-12f)
+            return false;
+        float inverseDeterminant = 1.0f / determinant;
+        glm::vec3 s = origin - t.position[0];
+        float u = glm::dot(s, p) * inverseDeterminant;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(direction, q) * inverseDeterminant;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        float distance = glm::dot(edge2, q) * inverseDeterminant;
+        return distance > 0.0f && distance < maxDistance;
+    }
+};
+
+
+// Lightmap cache files: header, then width * height RGBA half floats
+struct LightmapFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint64_t hash;          // LightmapBaker::Hash of the inputs the texels were baked from
+};
+
+inline bool WriteLightmapFile(const char* path, uint64_t hash, int width, int height, const std::vector<unsigned short>& texels)
+{
+    LightmapFileHeader header;
+    std::memcpy(header.magic, LIGHTMAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = LIGHTMAP_FILE_VERSION;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.hash = hash;
+
+    return WriteFileAtomically(path, [&](FILE* out)
+    {
+        return std::fwrite(&header, sizeof(header), 1, out) == 1
+            && std::fwrite(texels.data(), sizeof(unsigned short), texels.size(), out) == texels.size();
+    });
+}
+
+// succeeds only when the file was baked from the same inputs at the same size
+inline bool ReadLightmapFile(const char* path, uint64_t hash, int width, int height, std::vector<unsigned short>& texels)
+{
+    FILE* in = std::fopen(path, "rb");
+    if (!in)
+        return false;
+    LightmapFileHeader header;
+    bool ok = std::fread(&header, sizeof(header), 1, in) == 1
+        && std::memcmp(header.magic, LIGHTMAP_FILE_MAGIC, sizeof(header.magic)) == 0
+        && header.version == LIGHTMAP_FILE_VERSION
+        && header.hash == hash && header.width == (uint32_t)width && header.height == (uint32_t)height;
+    if (ok)
+    {
+        texels.resize((size_t)width * height * 4);
+        ok = std::fread(texels.data(), sizeof(unsigned short), texels.size(), in) == texels.size();
+    }
+    std::fclose(in);
+    return ok;
+}
+#endif
@@ -0,0 +1,279 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "inputqueue.h" // SPSCQueue
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Asynchronous logging. A log line is formatted into fixed buffers on the calling thread and pushed, whole, into
+// that thread's own queue when it is finished, so logging never takes a lock, allocates or waits for the console;
+// a background thread drains every queue a few hundred times a second, merges the lines it received by the
+// order they were finished and writes them with one flush per batch. When a thread logs faster than the writer
+// keeps up, its queue fills and further lines are dropped and counted instead of stalling the frame.
+//
+//     ULOG_INFO << "Mesh " << name << ": " << vertexCount << " vertices";
+//
+// Debug lines are compiled out unless LOG_DEBUG_ENABLED is 1, which Debug builds (_DEBUG) default to.
+
+#ifndef LOG_DEBUG_ENABLED
+#ifdef _DEBUG
+#define LOG_DEBUG_ENABLED 1
+#else
+#define LOG_DEBUG_ENABLED 0
+#endif
+#endif
+
+enum LogLevel : uint8_t
+{
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,  // written to stderr with a "Warning: " prefix
+    LOG_LEVEL_ERROR     // written to stderr with an "Error: " prefix
+};
+
+// One queue entry; lines longer than TEXT_SIZE are split over several entries with the same sequence number,
+// which are pushed together so the writer never sees part of a line
+struct LogMessage
+{
+    static const size_t TEXT_SIZE = 240;
+
+    uint64_t sequence;  // order the lines were finished in, across all threads
+    LogLevel level;
+    bool continued;     // more of the line follows in the next entry
+    uint16_t length;
+    char text[TEXT_SIZE];
+};
+
+
+class Logger
+{
+public:
+    static const size_t QUEUE_CAPACITY = 1024;  // entries per logging thread
+
+    // the process wide logger; its writer thread starts with the first line
+    static Logger& Instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    ~Logger()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (writer.joinable())
+            writer.join();
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    uint64_t NextSequence() { return sequence.fetch_add(1, std::memory_order_relaxed); }
+
+    // queues the entries of one line from the calling thread; false when the thread's queue has no room for all
+    // of them and the line was dropped
+    bool Push(const LogMessage* messages, size_t count)
+    {
+        if (threadQueue()->PushAll(messages, count))
+            return true;
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // waits until every line queued before the call has been written
+    void Flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!writer.joinable())
+            return;
+        uint64_t target = ++flushRequests;
+        wake.notify_all();
+        flushed.wait(lock, [&]() { return flushesDone >= target; });
+    }
+
+    unsigned DroppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    typedef SPSCQueue<LogMessage, QUEUE_CAPACITY> Queue;
+
+    std::atomic<uint64_t> sequence{ 0 };
+    std::atomic<unsigned> dropped{ 0 };
+    std::mutex mutex;                       // guards queues and the writer state below
+    std::condition_variable wake;
+    std::condition_variable flushed;
+    std::vector<std::unique_ptr<Queue>> queues; // one per thread that ever logged, kept until exit
+    std::thread writer;
+    bool stopping = false;
+    uint64_t flushRequests = 0;
+    uint64_t flushesDone = 0;
+    bool lineStarted = false;               // the last entry written was continued (writer thread only)
+
+    Logger() {}
+
+    // registers a queue the first time a thread logs; later calls don't lock
+    Queue* threadQueue()
+    {
+        static thread_local Queue* queue = nullptr;
+        if (!queue)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+            queue = queues.back().get();
+            if (!writer.joinable())
+                writer = std::thread(&Logger::writerLoop, this);
+        }
+        return queue;
+    }
+
+    void writerLoop()
+    {
+        std::vector<LogMessage> batch;
+        unsigned reportedDrops = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait_for(lock, std::chrono::milliseconds(5), [&]() { return stopping || flushRequests > flushesDone; });
+            bool stop = stopping;
+            uint64_t flushTarget = flushRequests;
+
+            // a queue's lines are in order and always complete; merging by sequence interleaves the threads
+            batch.clear();
+            LogMessage message;
+            for (const std::unique_ptr<Queue>& queue : queues)
+                while (queue->Pop(message))
+                    batch.push_back(message);
+            lock.unlock();
+
+            std::stable_sort(batch.begin(), batch.end(), [](const LogMessage& a, const LogMessage& b) { return a.sequence < b.sequence; });
+            for (const LogMessage& entry : batch)
+                write(entry);
+            unsigned drops = DroppedCount();
+            if (drops != reportedDrops)
+            {
+                fprintf(stderr, "Warning: %u log lines dropped\n", drops - reportedDrops);
+                reportedDrops = drops;
+            }
+            if (!batch.empty())
+            {
+                fflush(stdout);
+                fflush(stderr);
+            }
+
+            lock.lock();
+            flushesDone = std::max(flushesDone, flushTarget);
+            flushed.notify_all();
+            if (stop)
+                return;
+        }
+    }
+
+    void write(const LogMessage& entry)
+    {
+        FILE* stream = entry.level >= LOG_LEVEL_WARNING ? stderr : stdout;
+        if (!lineStarted)
+        {
+            static const char* prefixes[] = { "Debug: ", "", "Warning: ", "Error: " };
+            fputs(prefixes[entry.level], stream);
+        }
+        fwrite(entry.text, 1, entry.length, stream);
+        if (!entry.continued)
+            fputc('\n', stream);
+        lineStarted = entry.continued;
+    }
+};
+
+
+// Formats one line with operator<< like an ostream and queues it when it goes out of scope
+class LogLine
+{
+public:
+    static const size_t MAX_FRAGMENTS = 8;  // text past MAX_FRAGMENTS * TEXT_SIZE characters is cut off
+
+    explicit LogLine(LogLevel level)
+    {
+        fragments[0].level = level;
+        fragments[0].length = 0;
+    }
+
+    ~LogLine()
+    {
+        uint64_t sequence = Logger::Instance().NextSequence();
+        for (size_t i = 0; i < fragmentCount; ++i)
+        {
+            fragments[i].sequence = sequence;
+            fragments[i].continued = i + 1 < fragmentCount;
+        }
+        Logger::Instance().Push(fragments, fragmentCount);
+    }
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    LogLine& operator<<(const char* text) { append(text ? text : "(null)", text ? strlen(text) : 6); return *this; }
+    LogLine& operator<<(const unsigned char* text) { return *this << (const char*)text; }
+    LogLine& operator<<(const std::string& text) { append(text.data(), text.size()); return *this; }
+    LogLine& operator<<(char c) { append(&c, 1); return *this; }
+    LogLine& operator<<(bool value) { return *this << (value ? '1' : '0'); }
+    LogLine& operator<<(int value) { return format("%d", value); }
+    LogLine& operator<<(unsigned value) { return format("%u", value); }
+    LogLine& operator<<(long value) { return format("%ld", value); }
+    LogLine& operator<<(unsigned long value) { return format("%lu", value); }
+    LogLine& operator<<(long long value) { return format("%lld", value); }
+    LogLine& operator<<(unsigned long long value) { return format("%llu", value); }
+    LogLine& operator<<(double value) { return format("%g", value); } // what ostream prints by default
+    LogLine& operator<<(float value) { return format("%g", (double)value); }
+
+private:
+    LogMessage fragments[MAX_FRAGMENTS];
+    size_t fragmentCount = 1;
+
+    template <typename T>
+    LogLine& format(const char* pattern, T value)
+    {
+        char text[32];
+        int length = snprintf(text, sizeof(text), pattern, value);
+        append(text, (size_t)std::max(length, 0));
+        return *this;
+    }
+
+    void append(const char* text, size_t length)
+    {
+        while (length > 0)
+        {
+            LogMessage* message = &fragments[fragmentCount - 1];
+            if (message->length == LogMessage::TEXT_SIZE)
+            {
+                if (fragmentCount == MAX_FRAGMENTS)
+                    return;
+                fragments[fragmentCount].level = message->level;
+                fragments[fragmentCount].length = 0;
+                message = &fragments[fragmentCount++];
+            }
+            size_t count = std::min(length, LogMessage::TEXT_SIZE - message->length);
+            memcpy(message->text + message->length, text, count);
+            message->length = (uint16_t)(message->length + count);
+            text += count;
+            length -= count;
+        }
+    }
+};
+
+// Statement starters; the dangling else keeps them safe inside an unbraced if
+#define ULOG_DEBUG if (!LOG_DEBUG_ENABLED) ; else LogLine(LOG_LEVEL_DEBUG)
+#define ULOG_INFO LogLine(LOG_LEVEL_INFO)
+#define ULOG_WARNING LogLine(LOG_LEVEL_WARNING)
+#define ULOG_ERROR LogLine(LOG_LEVEL_ERROR)
+#endif
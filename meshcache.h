@@ -0,0 +1,224 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "fileio.h" // WriteFileAtomically
+#include "vertexformat.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Binary mesh files hold a mesh exactly as it is uploaded to the GPU: already optimized, encoded in its
+// vertex format and with its final index type, so loading is a file mapping and two buffer uploads.
+// Layout: MeshFileHeader, vertex block, index block (both blocks 16-byte aligned).
+const char MESH_FILE_MAGIC[4] = { 'M', 'E', 'S', 'H' };
+const uint32_t MESH_FILE_VERSION = 2; // bump whenever the layout or the mesh generators change
+
+struct MeshFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexFormat;      // VertexFormat the vertex block is encoded in
+    uint32_t vertexStride;      // bytes per vertex
+    uint32_t vertexCount;
+    uint32_t indexSize;         // 2 or 4 bytes per index
+    uint32_t indexCount;
+    uint32_t reserved;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint64_t vertexOffset;      // from the start of the file
+    uint64_t indexOffset;
+};
+
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const char* path)
+    {
+        Close();
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+        {
+            Close();
+            return false;
+        }
+        data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (data == NULL)
+        {
+            Close();
+            return false;
+        }
+        size = (size_t)fileSize.QuadPart;
+#else
+        descriptor = open(path, O_RDONLY);
+        if (descriptor < 0)
+            return false;
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+        {
+            Close();
+            return false;
+        }
+        void* address = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address == MAP_FAILED)
+        {
+            Close();
+            return false;
+        }
+        data = (const unsigned char*)address;
+        size = (size_t)status.st_size;
+#endif
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap((void*)data, size);
+        if (descriptor >= 0)
+            close(descriptor);
+        descriptor = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    const unsigned char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int descriptor = -1;
+#endif
+};
+
+
+// A mapped mesh file; the vertex and index pointers point straight into the mapping
+class MeshFile
+{
+public:
+    // maps the file and validates it; fails for missing, truncated, outdated or corrupt files
+    bool Open(const char* path)
+    {
+        if (!file.Open(path))
+            return false;
+        if (file.Size() < sizeof(MeshFileHeader))
+            return fail();
+
+        std::memcpy(&header, file.Data(), sizeof(header));
+        if (std::memcmp(header.magic, MESH_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != MESH_FILE_VERSION)
+            return fail();
+        if (header.indexSize != 2 && header.indexSize != 4)
+            return fail();
+        if (header.vertexFormat > VERTEX_FORMAT_QUANTIZED || header.vertexStride != VertexStride((VertexFormat)header.vertexFormat))
+            return fail();
+
+        // the offsets come from the file, so the ranges are checked without sums that could wrap around
+        uint64_t size = file.Size();
+        uint64_t vertexBytes = (uint64_t)header.vertexStride * header.vertexCount;
+        uint64_t indexBytes = (uint64_t)header.indexSize * header.indexCount;
+        if (header.vertexOffset < sizeof(MeshFileHeader) || header.vertexOffset > size || vertexBytes > size - header.vertexOffset
+            || header.indexOffset < sizeof(MeshFileHeader) || header.indexOffset > size || indexBytes > size - header.indexOffset
+            || header.vertexOffset % 16 != 0 || header.indexOffset % 16 != 0)
+            return fail();
+
+        // every index has to name a vertex; the indices feed the picking BVH as well as the GPU
+        for (uint32_t i = 0; i < header.indexCount; ++i)
+        {
+            uint32_t index = header.indexSize == 2 ? ((const uint16_t*)Indices())[i] : ((const uint32_t*)Indices())[i];
+            if (index >= header.vertexCount)
+                return fail();
+        }
+        return true;
+    }
+
+    const MeshFileHeader& Header() const { return header; }
+    const void* Vertices() const { return file.Data() + header.vertexOffset; }
+    const void* Indices() const { return file.Data() + header.indexOffset; }
+    size_t VertexBytes() const { return (size_t)header.vertexStride * header.vertexCount; }
+    size_t IndexBytes() const { return (size_t)header.indexSize * header.indexCount; }
+
+private:
+    MappedFile file;
+    MeshFileHeader header;
+
+    bool fail()
+    {
+        file.Close();
+        return false;
+    }
+};
+
+
+// Writes a mesh file; header supplies everything but the magic, version and block offsets
+inline bool WriteMeshFile(const char* path, MeshFileHeader header, const void* vertices, const void* indices)
+{
+    const unsigned char padding[16] = {};
+    size_t vertexBytes = (size_t)header.vertexStride * header.vertexCount;
+    size_t indexBytes = (size_t)header.indexSize * header.indexCount;
+    size_t vertexPadding = (16 - sizeof(MeshFileHeader) % 16) % 16;
+    size_t indexPadding = (16 - vertexBytes % 16) % 16;
+
+    std::memcpy(header.magic, MESH_FILE_MAGIC, sizeof(header.magic));
+    header.version = MESH_FILE_VERSION;
+    header.vertexOffset = sizeof(MeshFileHeader) + vertexPadding;
+    header.indexOffset = header.vertexOffset + vertexBytes + indexPadding;
+
+    return WriteFileAtomically(path, [&](FILE* out)
+    {
+        return std::fwrite(&header, sizeof(header), 1, out) == 1
+            && std::fwrite(padding, 1, vertexPadding, out) == vertexPadding
+            && std::fwrite(vertices, 1, vertexBytes, out) == vertexBytes
+            && std::fwrite(padding, 1, indexPadding, out) == indexPadding
+            && std::fwrite(indices, 1, indexBytes, out) == indexBytes;
+    });
+}
+#endif
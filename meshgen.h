@@ -0,0 +1,172 @@
+#ifndef MESHGEN_H
+#define MESHGEN_H
+
+#include <cmath>
+#include <cstddef>
+#include <initializer_list>
+
+// Procedural mesh kernels. Each generator has a size function giving the exact vertex and index counts,
+// and a kernel that writes 8 floats per vertex (position, normal, texture coordinate) and the indices into
+// caller-provided memory, e.g. a std::vector sized up front or a mapped GL buffer. Trigonometry is done by
+// incremental rotation, so a ring of N vertices costs two sin/cos calls instead of N.
+
+const int GEN_FLOATS_PER_VERTEX = 8;
+const double GEN_PI = 3.14159265358979323846;
+
+struct GenMeshSize
+{
+    size_t vertexCount;
+    size_t indexCount;
+};
+
+
+// Walks the angles start, start + step, ... by rotating (cos, sin) with a complex multiplication.
+// Doubles keep the accumulated error far below float precision even after millions of steps.
+class AngleStepper
+{
+public:
+    AngleStepper(double start, double step)
+        : c(std::cos(start)), s(std::sin(start)), stepCos(std::cos(step)), stepSin(std::sin(step)) {}
+
+    float Cos() const { return (float)c; }
+    float Sin() const { return (float)s; }
+
+    void Next()
+    {
+        double nextCos = c * stepCos - s * stepSin;
+        s = s * stepCos + c * stepSin;
+        c = nextCos;
+    }
+
+private:
+    double c, s;
+    double stepCos, stepSin;
+};
+
+
+inline void GenWriteVertex(float* v, float x, float y, float z, float nx, float ny, float nz, float s, float t)
+{
+    v[0] = x; v[1] = y; v[2] = z;
+    v[3] = nx; v[4] = ny; v[5] = nz;
+    v[6] = s; v[7] = t;
+}
+
+
+// Open cylinder sides plus a top and a bottom cap (fan around a center vertex), along the y axis
+inline GenMeshSize CylinderMeshSize(int segments)
+{
+    GenMeshSize size;
+    size.vertexCount = (size_t)2 * (segments + 1) + (size_t)2 * (segments + 2);
+    size.indexCount = (size_t)12 * segments;
+    return size;
+}
+
+// Vertex order: side top/bottom pairs, top cap center and ring, bottom cap center and ring
+template <typename Index>
+void GenerateCylinder(int segments, float radius, float height, float* vertices, Index* indices)
+{
+    float top = height * 0.5f;
+    float bottom = -height * 0.5f;
+    size_t topCenter = (size_t)2 * (segments + 1);
+    size_t bottomCenter = topCenter + segments + 2;
+
+    GenWriteVertex(vertices + topCenter * GEN_FLOATS_PER_VERTEX, 0.0f, top, 0.0f, 0.0f, 1.0f, 0.0f, 0.5f, 0.5f);
+    GenWriteVertex(vertices + bottomCenter * GEN_FLOATS_PER_VERTEX, 0.0f, bottom, 0.0f, 0.0f, -1.0f, 0.0f, 0.5f, 0.5f);
+
+    // one pass over the ring writes the side and both cap vertices that share its angle
+    AngleStepper angle(0.0, 2.0 * GEN_PI / segments);
+    float inverseSegments = 1.0f / segments;
+    for (int i = 0; i <= segments; ++i, angle.Next())
+    {
+        bool seam = i == segments; // reuse the first angle so the seam closes exactly
+        float c = seam ? 1.0f : angle.Cos();
+        float s = seam ? 0.0f : angle.Sin();
+        float x = c * radius;
+        float z = s * radius;
+        float u = i * inverseSegments;
+
+        float* side = vertices + (size_t)i * 2 * GEN_FLOATS_PER_VERTEX;
+        GenWriteVertex(side, x, top, z, x, 0.0f, z, u, 1.0f);
+        GenWriteVertex(side + GEN_FLOATS_PER_VERTEX, x, bottom, z, x, 0.0f, z, u, 0.0f);
+        GenWriteVertex(vertices + (topCenter + 1 + i) * GEN_FLOATS_PER_VERTEX, x, top, z, 0.0f, 1.0f, 0.0f, x * 0.5f + 0.5f, z * 0.5f + 0.5f);
+        GenWriteVertex(vertices + (bottomCenter + 1 + i) * GEN_FLOATS_PER_VERTEX, x, bottom, z, 0.0f, -1.0f, 0.0f, x * 0.5f + 0.5f, z * 0.5f + 0.5f);
+    }
+
+    Index* out = indices;
+    for (int i = 0; i < segments; ++i)
+    {
+        Index base = (Index)(i * 2);
+        out[0] = base; out[1] = (Index)(base + 1); out[2] = (Index)(base + 3);
+        out[3] = base; out[4] = (Index)(base + 3); out[5] = (Index)(base + 2);
+        out += 6;
+    }
+    for (size_t center : { topCenter, bottomCenter })
+    {
+        for (int i = 0; i < segments; ++i)
+        {
+            out[0] = (Index)center;
+            out[1] = (Index)(center + i + 1);
+            out[2] = (Index)(center + i + 2);
+            out += 3;
+        }
+    }
+}
+
+
+// UV sphere around the z axis with poles at +-z
+inline GenMeshSize SphereMeshSize(int sectorCount, int stackCount)
+{
+    GenMeshSize size;
+    size.vertexCount = (size_t)(stackCount + 1) * (sectorCount + 1);
+    size.indexCount = stackCount > 1 ? (size_t)6 * sectorCount * (stackCount - 1) : 0;
+    return size;
+}
+
+// (sectorCount + 1) vertices per stack from the +z pole to the -z pole; the first and last stacks are single triangles
+template <typename Index>
+void GenerateSphere(int sectorCount, int stackCount, float radius, float* vertices, Index* indices)
+{
+    double sectorStep = 2.0 * GEN_PI / sectorCount;
+    float inverseSectors = 1.0f / sectorCount;
+    float inverseStacks = 1.0f / stackCount;
+
+    AngleStepper stack(GEN_PI / 2.0, -GEN_PI / stackCount); // from pi/2 down to -pi/2
+    float* v = vertices;
+    for (int i = 0; i <= stackCount; ++i, stack.Next())
+    {
+        float cosStack = stack.Cos();
+        float nz = i == 0 ? 1.0f : (i == stackCount ? -1.0f : stack.Sin()); // exact poles
+        float t = i * inverseStacks;
+
+        AngleStepper sector(0.0, sectorStep);
+        for (int j = 0; j <= sectorCount; ++j, sector.Next())
+        {
+            bool seam = j == sectorCount;
+            float nx = cosStack * (seam ? 1.0f : sector.Cos());
+            float ny = cosStack * (seam ? 0.0f : sector.Sin());
+            GenWriteVertex(v, nx * radius, ny * radius, nz * radius, nx, ny, nz, j * inverseSectors, t);
+            v += GEN_FLOATS_PER_VERTEX;
+        }
+    }
+
+    Index* out = indices;
+    for (int i = 0; i < stackCount; ++i)
+    {
+        Index k1 = (Index)(i * (sectorCount + 1));   // beginning of current stack
+        Index k2 = (Index)(k1 + sectorCount + 1);    // beginning of next stack
+        for (int j = 0; j < sectorCount; ++j, ++k1, ++k2)
+        {
+            if (i != 0)
+            {
+                out[0] = k1; out[1] = k2; out[2] = (Index)(k1 + 1);
+                out += 3;
+            }
+            if (i != stackCount - 1)
+            {
+                out[0] = (Index)(k1 + 1); out[1] = k2; out[2] = (Index)(k2 + 1);
+                out += 3;
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,1077 @@
+#ifndef MESHIMPORT_H
+#define MESHIMPORT_H
+
+#include <glm/glm.hpp>
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "jobsystem.h"
+#include "meshcache.h" // MappedFile
+
+// Imports Wavefront OBJ and binary glTF 2.0 (.glb) files into the interleaved layout the generated meshes use:
+// 8 floats per vertex (position, normal, texture coordinate) and triangle indices. Input files are memory mapped;
+// large OBJ files are parsed in parallel chunks and their face corners welded into unique vertices with a hash map.
+// Missing normals are computed from the faces, missing texture coordinates are zero.
+
+const int IMPORT_FLOATS_PER_VERTEX = 8;
+
+
+// ---- number parsing (the mapped file is not null terminated, so the C library parsers cannot be used) ----
+
+inline const char* ImportSkipSpaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+    return p;
+}
+
+inline const char* ImportSkipLine(const char* p, const char* end)
+{
+    while (p < end && *p != '\n')
+        ++p;
+    return p < end ? p + 1 : end;
+}
+
+// parses an optionally signed decimal number with optional exponent; returns false if there are no digits
+inline bool ImportParseDouble(const char*& p, const char* end, double& value)
+{
+    p = ImportSkipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+    {
+        if (mantissa < 100000000000000000ull)
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        else
+            ++exponent; // digits beyond double precision only scale the value
+    }
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+        {
+            if (mantissa < 100000000000000000ull)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                --exponent;
+            }
+        }
+    }
+    if (digits == 0)
+        return false;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negativeExponent = *p++ == '-';
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p)
+            e = e < 10000 ? e * 10 + (*p - '0') : e;
+        exponent += negativeExponent ? -e : e;
+    }
+
+    double result = (double)mantissa;
+    if (exponent != 0)
+        result *= std::pow(10.0, (double)exponent);
+    value = negative ? -result : result;
+    return true;
+}
+
+inline bool ImportParseFloat(const char*& p, const char* end, float& value)
+{
+    double result;
+    if (!ImportParseDouble(p, end, result))
+        return false;
+    value = (float)result;
+    return true;
+}
+
+// parses an optionally signed integer; returns false if there are no digits or the value does not fit an int
+inline bool ImportParseInt(const char*& p, const char* end, int& value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if (p >= end || *p < '0' || *p > '9')
+        return false;
+    int result = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+    {
+        int digit = *p - '0';
+        if (result > (INT_MAX - digit) / 10)
+            return false;
+        result = result * 10 + digit;
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+
+// ---- shared post-processing ----
+
+// fills in area weighted smooth normals for the vertices flagged in needsNormal
+inline void ImportComputeNormals(std::vector<float>& vertices, const std::vector<unsigned int>& indices, const std::vector<unsigned char>& needsNormal)
+{
+    bool any = false;
+    for (unsigned char flag : needsNormal)
+        any = any || flag;
+    if (!any)
+        return;
+
+    std::vector<glm::vec3> normals(needsNormal.size(), glm::vec3(0.0f));
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        const float* a = &vertices[indices[i] * IMPORT_FLOATS_PER_VERTEX];
+        const float* b = &vertices[indices[i + 1] * IMPORT_FLOATS_PER_VERTEX];
+        const float* c = &vertices[indices[i + 2] * IMPORT_FLOATS_PER_VERTEX];
+        glm::vec3 p0(a[0], a[1], a[2]), p1(b[0], b[1], b[2]), p2(c[0], c[1], c[2]);
+        glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+        for (int k = 0; k < 3; ++k)
+            if (needsNormal[indices[i + k]])
+                normals[indices[i + k]] += faceNormal;
+    }
+
+    for (size_t v = 0; v < needsNormal.size(); ++v)
+    {
+        if (!needsNormal[v])
+            continue;
+        float length = glm::length(normals[v]);
+        glm::vec3 n = length > 0.0f ? normals[v] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+        float* out = &vertices[v * IMPORT_FLOATS_PER_VERTEX + 3];
+        out[0] = n.x;
+        out[1] = n.y;
+        out[2] = n.z;
+    }
+}
+
+
+// ---- OBJ ----
+
+// one face corner; indices are 0-based, -1 when the attribute is missing
+struct ObjCorner
+{
+    int position;
+    int uv;
+    int normal;
+};
+
+// the result of parsing one chunk of lines
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+    std::vector<float> positions;           // 3 per element
+    std::vector<float> uvs;                 // 2 per element
+    std::vector<float> normals;             // 3 per element
+    std::vector<ObjCorner> corners;         // 3 per triangle
+    std::vector<unsigned char> relative;    // per corner: bit 0/1/2 set when position/uv/normal counts from the chunk start
+    int positionBase = 0;                   // elements defined by the chunks before this one
+    int uvBase = 0;
+    int normalBase = 0;
+    bool valid = true;
+};
+
+// parses "v", "v/vt", "v//vn" or "v/vt/vn"; negative indices count back from the chunk's current element count
+inline bool ObjParseCorner(const char*& p, const char* end, const ObjChunk& chunk, ObjCorner& corner, unsigned char& relative)
+{
+    int counts[3] = { (int)chunk.positions.size() / 3, (int)chunk.uvs.size() / 2, (int)chunk.normals.size() / 3 };
+    int values[3] = { 0, 0, 0 };
+    bool present[3] = { false, false, false };
+    relative = 0;
+
+    for (int k = 0; k < 3; ++k)
+    {
+        if (k > 0)
+        {
+            if (p >= end || *p != '/')
+                break;
+            ++p;
+        }
+        present[k] = ImportParseInt(p, end, values[k]);
+        if (!present[k] && (k == 0 || (p < end && *p >= '0' && *p <= '9')))
+            return false; // no position, or an index too large for an int
+        if (present[k] && values[k] == 0)
+            return false;
+    }
+
+    int* out[3] = { &corner.position, &corner.uv, &corner.normal };
+    for (int k = 0; k < 3; ++k)
+    {
+        if (!present[k])
+            *out[k] = -1;
+        else if (values[k] > 0)
+            *out[k] = values[k] - 1;
+        else
+        {
+            *out[k] = counts[k] + values[k];
+            relative |= (unsigned char)(1 << k);
+        }
+    }
+    return true;
+}
+
+inline void ObjParseChunk(ObjChunk& chunk)
+{
+    std::vector<ObjCorner> face;
+    std::vector<unsigned char> faceRelative;
+    const char* p = chunk.begin;
+    const char* end = chunk.end;
+
+    while (p < end)
+    {
+        p = ImportSkipSpaces(p, end);
+        if (p + 1 < end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            float x = 0.0f, y = 0.0f, z = 0.0f;
+            p += 1;
+            if (!ImportParseFloat(p, end, x) || !ImportParseFloat(p, end, y) || !ImportParseFloat(p, end, z))
+                chunk.valid = false;
+            chunk.positions.push_back(x);
+            chunk.positions.push_back(y);
+            chunk.positions.push_back(z);
+        }
+        else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+        {
+            float u = 0.0f, v = 0.0f;
+            p += 2;
+            if (!ImportParseFloat(p, end, u))
+                chunk.valid = false;
+            ImportParseFloat(p, end, v); // v is optional
+            chunk.uvs.push_back(u);
+            chunk.uvs.push_back(v);
+        }
+        else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+        {
+            float x = 0.0f, y = 0.0f, z = 0.0f;
+            p += 2;
+            if (!ImportParseFloat(p, end, x) || !ImportParseFloat(p, end, y) || !ImportParseFloat(p, end, z))
+                chunk.valid = false;
+            chunk.normals.push_back(x);
+            chunk.normals.push_back(y);
+            chunk.normals.push_back(z);
+        }
+        else if (p + 1 < end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            face.clear();
+            faceRelative.clear();
+            p += 1;
+            for (;;)
+            {
+                p = ImportSkipSpaces(p, end);
+                if (p >= end || *p == '\n' || *p == '#')
+                    break;
+                ObjCorner corner;
+                unsigned char relative;
+                if (!ObjParseCorner(p, end, chunk, corner, relative))
+                {
+                    chunk.valid = false;
+                    break;
+                }
+                face.push_back(corner);
+                faceRelative.push_back(relative);
+            }
+
+            // triangle fan for polygons
+            for (size_t i = 2; i < face.size(); ++i)
+            {
+                size_t fan[3] = { 0, i - 1, i };
+                for (size_t k : fan)
+                {
+                    chunk.corners.push_back(face[k]);
+                    chunk.relative.push_back(faceRelative[k]);
+                }
+            }
+        }
+        // everything else (comments, groups, materials, smoothing groups) is ignored
+        p = ImportSkipLine(p, end);
+    }
+}
+
+inline bool ImportOBJ(const char* path, JobSystem& jobs, std::vector<float>& vertices, std::vector<unsigned int>& indices, std::string& error)
+{
+    MappedFile file;
+    if (!file.Open(path))
+    {
+        error = "cannot open file";
+        return false;
+    }
+    const char* data = (const char*)file.Data();
+    const char* dataEnd = data + file.Size();
+
+    // split at line boundaries; small files are parsed in one piece
+    const size_t minChunkSize = 1 << 20;
+    size_t chunkCount = file.Size() / minChunkSize;
+    size_t maxChunks = jobs.ThreadCount() * 4;
+    chunkCount = chunkCount < 1 ? 1 : (chunkCount > maxChunks ? maxChunks : chunkCount);
+    std::vector<ObjChunk> chunks(chunkCount);
+    const char* chunkBegin = data;
+    for (size_t i = 0; i < chunkCount; ++i)
+    {
+        const char* chunkEnd = i + 1 == chunkCount ? dataEnd : data + file.Size() / chunkCount * (i + 1);
+        if (chunkEnd < chunkBegin)
+            chunkEnd = chunkBegin;
+        chunkEnd = ImportSkipLine(chunkEnd == data ? data : chunkEnd - 1, dataEnd);
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    jobs.ParallelFor((int)chunkCount, 1, [&chunks](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+            ObjParseChunk(chunks[i]);
+    });
+
+    // element offsets of every chunk
+    std::vector<float> positions, uvs, normals;
+    size_t cornerCount = 0;
+    {
+        size_t positionFloats = 0, uvFloats = 0, normalFloats = 0;
+        for (ObjChunk& chunk : chunks)
+        {
+            if (!chunk.valid)
+            {
+                error = "malformed line";
+                return false;
+            }
+            chunk.positionBase = (int)(positionFloats / 3);
+            chunk.uvBase = (int)(uvFloats / 2);
+            chunk.normalBase = (int)(normalFloats / 3);
+            positionFloats += chunk.positions.size();
+            uvFloats += chunk.uvs.size();
+            normalFloats += chunk.normals.size();
+            cornerCount += chunk.corners.size();
+        }
+        positions.reserve(positionFloats);
+        uvs.reserve(uvFloats);
+        normals.reserve(normalFloats);
+    }
+    for (ObjChunk& chunk : chunks)
+    {
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        uvs.insert(uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+        normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+    }
+    int positionCount = (int)positions.size() / 3, uvCount = (int)uvs.size() / 2, normalCount = (int)normals.size() / 3;
+
+    // weld identical position/uv/normal triples with an open addressing hash table of vertex indices
+    size_t tableSize = 1;
+    while (tableSize < cornerCount * 2)
+        tableSize <<= 1;
+    const unsigned int empty = ~0u;
+    std::vector<unsigned int> table(tableSize, empty);
+    std::vector<ObjCorner> vertexKeys;
+    std::vector<unsigned char> needsNormal;
+    vertices.clear();
+    indices.clear();
+    indices.reserve(cornerCount);
+
+    for (ObjChunk& chunk : chunks)
+    {
+        for (size_t i = 0; i < chunk.corners.size(); ++i)
+        {
+            ObjCorner c = chunk.corners[i];
+            unsigned char relative = chunk.relative[i];
+            if (relative & 1)
+                c.position += chunk.positionBase;
+            if (relative & 2)
+                c.uv += chunk.uvBase;
+            if (relative & 4)
+                c.normal += chunk.normalBase;
+            if (c.position < 0 || c.position >= positionCount || c.uv >= uvCount || c.normal >= normalCount
+                || ((relative & 2) && c.uv < 0) || ((relative & 4) && c.normal < 0))
+            {
+                error = "face index out of range";
+                return false;
+            }
+
+            uint32_t hash = (uint32_t)c.position * 73856093u ^ (uint32_t)c.uv * 19349663u ^ (uint32_t)c.normal * 83492791u;
+            hash ^= hash >> 16;
+            size_t slot = hash & (tableSize - 1);
+            while (table[slot] != empty)
+            {
+                const ObjCorner& key = vertexKeys[table[slot]];
+                if (key.position == c.position && key.uv == c.uv && key.normal == c.normal)
+                    break;
+                slot = (slot + 1) & (tableSize - 1);
+            }
+
+            if (table[slot] == empty)
+            {
+                table[slot] = (unsigned int)vertexKeys.size();
+                vertexKeys.push_back(c);
+                const float* p = &positions[c.position * 3];
+                const float* n = c.normal >= 0 ? &normals[c.normal * 3] : nullptr;
+                const float* t = c.uv >= 0 ? &uvs[c.uv * 2] : nullptr;
+                float vertex[IMPORT_FLOATS_PER_VERTEX] = {
+                    p[0], p[1], p[2],
+                    n ? n[0] : 0.0f, n ? n[1] : 0.0f, n ? n[2] : 0.0f,
+                    t ? t[0] : 0.0f, t ? t[1] : 0.0f };
+                vertices.insert(vertices.end(), vertex, vertex + IMPORT_FLOATS_PER_VERTEX);
+                needsNormal.push_back(n ? 0 : 1);
+            }
+            indices.push_back(table[slot]);
+        }
+    }
+
+    if (indices.empty())
+    {
+        error = "no faces";
+        return false;
+    }
+    ImportComputeNormals(vertices, indices, needsNormal);
+    return true;
+}
+
+
+// ---- minimal JSON reader for the glTF scene description ----
+
+// A parsed JSON document stored as a flat node array; children are linked through firstChild/nextSibling
+class JsonDocument
+{
+public:
+    enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+    struct Node
+    {
+        Type type;
+        double number;          // JSON_NUMBER, JSON_BOOL (0 or 1)
+        std::string text;       // JSON_STRING
+        std::string key;        // member name when the parent is an object
+        int firstChild;
+        int nextSibling;
+        int childCount;
+    };
+
+    bool Parse(const char* text, size_t length)
+    {
+        nodes.clear();
+        p = text;
+        end = text + length;
+        depth = 0;
+        if (parseValue() < 0)
+            return false;
+        skipSpaces();
+        return p == end || *p == '\0';
+    }
+
+    // the root value is node 0
+    const Node& Get(int node) const { return nodes[node]; }
+
+    // child of an object by name, -1 if node is not an object or has no such member
+    int Member(int node, const char* key) const
+    {
+        if (node < 0 || nodes[node].type != JSON_OBJECT)
+            return -1;
+        for (int child = nodes[node].firstChild; child >= 0; child = nodes[child].nextSibling)
+            if (nodes[child].key == key)
+                return child;
+        return -1;
+    }
+
+    // index-th element of an array, -1 if out of range
+    int Element(int node, int index) const
+    {
+        if (node < 0 || index < 0 || nodes[node].type != JSON_ARRAY)
+            return -1;
+        int child = nodes[node].firstChild;
+        for (int i = 0; i < index && child >= 0; ++i)
+            child = nodes[child].nextSibling;
+        return child;
+    }
+
+    int Size(int node) const
+    {
+        return node < 0 ? 0 : nodes[node].childCount;
+    }
+
+    double Number(int node, double fallback) const
+    {
+        return node >= 0 && (nodes[node].type == JSON_NUMBER || nodes[node].type == JSON_BOOL) ? nodes[node].number : fallback;
+    }
+
+    // -1 when the number is fractional or out of the int range
+    int Int(int node, int fallback) const
+    {
+        double number = Number(node, fallback);
+        if (!(number >= INT_MIN && number <= INT_MAX) || number != std::floor(number))
+            return -1;
+        return (int)number;
+    }
+
+    const char* String(int node) const
+    {
+        return node >= 0 && nodes[node].type == JSON_STRING ? nodes[node].text.c_str() : "";
+    }
+
+private:
+    std::vector<Node> nodes;
+    const char* p = nullptr;
+    const char* end = nullptr;
+    int depth = 0;
+
+    void skipSpaces()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            ++p;
+    }
+
+    int addNode(Type type)
+    {
+        Node node;
+        node.type = type;
+        node.number = 0.0;
+        node.firstChild = -1;
+        node.nextSibling = -1;
+        node.childCount = 0;
+        nodes.push_back(node);
+        return (int)nodes.size() - 1;
+    }
+
+    bool parseString(std::string& out)
+    {
+        if (p >= end || *p != '"')
+            return false;
+        ++p;
+        out.clear();
+        while (p < end && *p != '"')
+        {
+            char c = *p++;
+            if (c == '\\')
+            {
+                if (p >= end)
+                    return false;
+                char escaped = *p++;
+                switch (escaped)
+                {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u':
+                    // names that matter to the importer are ASCII; other code points are replaced
+                    if (end - p < 4)
+                        return false;
+                    p += 4;
+                    out += '?';
+                    break;
+                default: out += escaped; break;
+                }
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        if (p >= end)
+            return false;
+        ++p;
+        return true;
+    }
+
+    int parseValue()
+    {
+        skipSpaces();
+        if (p >= end || ++depth > 64)
+            return -1;
+
+        int node = -1;
+        if (*p == '{' || *p == '[')
+        {
+            bool isObject = *p == '{';
+            char close = isObject ? '}' : ']';
+            node = addNode(isObject ? JSON_OBJECT : JSON_ARRAY);
+            ++p;
+            skipSpaces();
+            int last = -1;
+            if (p < end && *p == close)
+                ++p;
+            else
+            {
+                for (;;)
+                {
+                    std::string key;
+                    if (isObject)
+                    {
+                        skipSpaces();
+                        if (!parseString(key))
+                            return -1;
+                        skipSpaces();
+                        if (p >= end || *p != ':')
+                            return -1;
+                        ++p;
+                    }
+                    int child = parseValue();
+                    if (child < 0)
+                        return -1;
+                    nodes[child].key.swap(key);
+                    if (last < 0)
+                        nodes[node].firstChild = child;
+                    else
+                        nodes[last].nextSibling = child;
+                    last = child;
+                    ++nodes[node].childCount;
+
+                    skipSpaces();
+                    if (p < end && *p == ',')
+                    {
+                        ++p;
+                        continue;
+                    }
+                    if (p < end && *p == close)
+                    {
+                        ++p;
+                        break;
+                    }
+                    return -1;
+                }
+            }
+        }
+        else if (*p == '"')
+        {
+            node = addNode(JSON_STRING);
+            std::string text;
+            if (!parseString(text))
+                return -1;
+            nodes[node].text.swap(text);
+        }
+        else if (end - p >= 4 && std::strncmp(p, "true", 4) == 0)
+        {
+            node = addNode(JSON_BOOL);
+            nodes[node].number = 1.0;
+            p += 4;
+        }
+        else if (end - p >= 5 && std::strncmp(p, "false", 5) == 0)
+        {
+            node = addNode(JSON_BOOL);
+            p += 5;
+        }
+        else if (end - p >= 4 && std::strncmp(p, "null", 4) == 0)
+        {
+            node = addNode(JSON_NULL);
+            p += 4;
+        }
+        else
+        {
+            double value;
+            if (!ImportParseDouble(p, end, value))
+                return -1;
+            node = addNode(JSON_NUMBER);
+            nodes[node].number = value;
+        }
+        --depth;
+        return node;
+    }
+};
+
+
+// ---- glTF 2.0 binary ----
+
+// Reads the file's BIN chunk through the accessors of the scene description
+class GltfReader
+{
+public:
+    GltfReader(const JsonDocument& json, const unsigned char* bin, size_t binSize) : json(json), bin(bin), binSize(binSize) {}
+
+    // reads a float accessor (or a normalized integer one) with up to 4 components per element
+    bool ReadFloats(int accessorIndex, int components, std::vector<float>& out, size_t& count) const
+    {
+        Accessor a;
+        if (!getAccessor(accessorIndex, a) || a.components != components)
+            return false;
+        count = a.count;
+        out.assign(a.count * components, 0.0f);
+        if (!a.data)
+            return true; // no buffer view: all zeros
+
+        for (size_t i = 0; i < a.count; ++i)
+        {
+            const unsigned char* element = a.data + i * a.stride;
+            for (int c = 0; c < components; ++c)
+            {
+                float value, scale = 1.0f;
+                switch (a.componentType)
+                {
+                case 5126: { std::memcpy(&value, element + c * 4, 4); break; }
+                case 5121: { value = element[c]; scale = 255.0f; break; }
+                case 5123: { uint16_t v; std::memcpy(&v, element + c * 2, 2); value = v; scale = 65535.0f; break; }
+                case 5120: { value = (int8_t)element[c]; scale = 127.0f; break; }
+                case 5122: { int16_t v; std::memcpy(&v, element + c * 2, 2); value = v; scale = 32767.0f; break; }
+                default: return false;
+                }
+                if (a.normalized)
+                    value = std::fmax(value / scale, -1.0f); // the most negative signed value also maps to -1
+                out[i * components + c] = value;
+            }
+        }
+        return true;
+    }
+
+    bool ReadIndices(int accessorIndex, std::vector<unsigned int>& out) const
+    {
+        Accessor a;
+        if (!getAccessor(accessorIndex, a) || a.components != 1 || !a.data)
+            return false;
+        out.resize(a.count);
+        for (size_t i = 0; i < a.count; ++i)
+        {
+            const unsigned char* element = a.data + i * a.stride;
+            switch (a.componentType)
+            {
+            case 5121: out[i] = element[0]; break;
+            case 5123: { uint16_t v; std::memcpy(&v, element, 2); out[i] = v; break; }
+            case 5125: { uint32_t v; std::memcpy(&v, element, 4); out[i] = v; break; }
+            default: return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Accessor
+    {
+        const unsigned char* data;  // first element, nullptr when the accessor has no buffer view
+        size_t count;
+        size_t stride;
+        int componentType;
+        int components;
+        bool normalized;
+    };
+
+    const JsonDocument& json;
+    const unsigned char* bin;
+    size_t binSize;
+
+    static int componentSize(int componentType)
+    {
+        switch (componentType)
+        {
+        case 5120: case 5121: return 1;
+        case 5122: case 5123: return 2;
+        case 5125: case 5126: return 4;
+        default: return 0;
+        }
+    }
+
+    static int componentCount(const char* type)
+    {
+        if (std::strcmp(type, "SCALAR") == 0) return 1;
+        if (std::strcmp(type, "VEC2") == 0) return 2;
+        if (std::strcmp(type, "VEC3") == 0) return 3;
+        if (std::strcmp(type, "VEC4") == 0) return 4;
+        return 0;
+    }
+
+    bool getAccessor(int accessorIndex, Accessor& a) const
+    {
+        int accessor = json.Element(json.Member(0, "accessors"), accessorIndex);
+        if (accessor < 0 || json.Member(accessor, "sparse") >= 0)
+            return false;
+
+        a.componentType = json.Int(json.Member(accessor, "componentType"), 0);
+        a.components = componentCount(json.String(json.Member(accessor, "type")));
+        a.normalized = json.Number(json.Member(accessor, "normalized"), 0.0) != 0.0;
+        size_t elementSize = (size_t)componentSize(a.componentType) * a.components;
+        if (elementSize == 0 || !getSize(accessor, "count", a.count) || a.count > UINT_MAX)
+            return false; // vertices are addressed with 32 bit indices
+
+        a.data = nullptr;
+        a.stride = elementSize;
+        int viewIndex = json.Int(json.Member(accessor, "bufferView"), -1);
+        if (viewIndex < 0)
+            return a.count <= binSize / elementSize; // all zeros, but no larger than the real data could be
+
+        int view = json.Element(json.Member(0, "bufferViews"), viewIndex);
+        if (view < 0 || json.Int(json.Member(view, "buffer"), 0) != 0)
+            return false; // only the embedded BIN chunk is supported
+        size_t viewOffset, viewLength, accessorOffset, stride;
+        if (!getSize(view, "byteOffset", viewOffset) || !getSize(view, "byteLength", viewLength) ||
+            !getSize(accessor, "byteOffset", accessorOffset) || !getSize(view, "byteStride", stride))
+            return false;
+        a.stride = stride > 0 ? stride : elementSize;
+
+        // compared without adding untrusted sizes, which could wrap around
+        if (viewOffset > binSize || viewLength > binSize - viewOffset)
+            return false;
+        if (a.count > 0 && (accessorOffset > viewLength || elementSize > viewLength - accessorOffset ||
+            a.count - 1 > (viewLength - accessorOffset - elementSize) / a.stride))
+            return false;
+        a.data = bin + viewOffset + accessorOffset;
+        return true;
+    }
+
+    // reads an optional byte offset, length or count (0 when missing); false when it is negative, fractional or
+    // too large to convert
+    bool getSize(int object, const char* name, size_t& value) const
+    {
+        const double limit = sizeof(size_t) >= 8 ? 9007199254740992.0 : (double)(SIZE_MAX / 2); // 2^53
+        double number = json.Number(json.Member(object, name), 0.0);
+        if (!(number >= 0.0 && number <= limit) || number != std::floor(number))
+            return false;
+        value = (size_t)number;
+        return true;
+    }
+};
+
+// local matrix of a glTF node: "matrix" or translation * rotation * scale
+inline glm::mat4 GltfNodeMatrix(const JsonDocument& json, int node)
+{
+    glm::mat4 m(1.0f);
+    int matrix = json.Member(node, "matrix");
+    if (json.Size(matrix) == 16)
+    {
+        for (int i = 0; i < 16; ++i)
+            m[i / 4][i % 4] = (float)json.Number(json.Element(matrix, i), 0.0);
+        return m;
+    }
+
+    int t = json.Member(node, "translation"), r = json.Member(node, "rotation"), s = json.Member(node, "scale");
+    glm::vec3 translation(0.0f), scale(1.0f);
+    glm::vec4 q(0.0f, 0.0f, 0.0f, 1.0f);
+    for (int i = 0; i < 3; ++i)
+    {
+        translation[i] = (float)json.Number(json.Element(t, i), 0.0);
+        scale[i] = (float)json.Number(json.Element(s, i), 1.0);
+    }
+    for (int i = 0; i < 4; ++i)
+        q[i] = (float)json.Number(json.Element(r, i), i == 3 ? 1.0 : 0.0);
+
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    m[0] = glm::vec4((1.0f - 2.0f * (yy + zz)) * scale.x, 2.0f * (xy + wz) * scale.x, 2.0f * (xz - wy) * scale.x, 0.0f);
+    m[1] = glm::vec4(2.0f * (xy - wz) * scale.y, (1.0f - 2.0f * (xx + zz)) * scale.y, 2.0f * (yz + wx) * scale.y, 0.0f);
+    m[2] = glm::vec4(2.0f * (xz + wy) * scale.z, 2.0f * (yz - wx) * scale.z, (1.0f - 2.0f * (xx + yy)) * scale.z, 0.0f);
+    m[3] = glm::vec4(translation, 1.0f);
+    return m;
+}
+
+// appends the triangles of one mesh, transformed to world space
+inline bool GltfAppendMesh(const JsonDocument& json, const GltfReader& reader, int mesh, const glm::mat4& world,
+    std::vector<float>& vertices, std::vector<unsigned int>& indices, std::vector<unsigned char>& needsNormal, std::string& error)
+{
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+    int primitives = json.Member(mesh, "primitives");
+    std::vector<float> positions, normals, uvs;
+    std::vector<unsigned int> primitiveIndices;
+
+    for (int i = 0; i < json.Size(primitives); ++i)
+    {
+        int primitive = json.Element(primitives, i);
+        if (json.Int(json.Member(primitive, "mode"), 4) != 4)
+            continue; // only triangle lists
+
+        int attributes = json.Member(primitive, "attributes");
+        int positionAccessor = json.Int(json.Member(attributes, "POSITION"), -1);
+        int normalAccessor = json.Int(json.Member(attributes, "NORMAL"), -1);
+        int uvAccessor = json.Int(json.Member(attributes, "TEXCOORD_0"), -1);
+        int indexAccessor = json.Int(json.Member(primitive, "indices"), -1);
+
+        size_t count = 0, normalCount = 0, uvCount = 0;
+        if (positionAccessor < 0 || !reader.ReadFloats(positionAccessor, 3, positions, count))
+        {
+            error = "invalid POSITION accessor";
+            return false;
+        }
+        bool hasNormals = normalAccessor >= 0 && reader.ReadFloats(normalAccessor, 3, normals, normalCount) && normalCount == count;
+        bool hasUVs = uvAccessor >= 0 && reader.ReadFloats(uvAccessor, 2, uvs, uvCount) && uvCount == count;
+
+        if (indexAccessor >= 0)
+        {
+            if (!reader.ReadIndices(indexAccessor, primitiveIndices))
+            {
+                error = "invalid index accessor";
+                return false;
+            }
+        }
+        else
+        {
+            primitiveIndices.resize(count);
+            for (size_t v = 0; v < count; ++v)
+                primitiveIndices[v] = (unsigned int)v;
+        }
+
+        unsigned int base = (unsigned int)(vertices.size() / IMPORT_FLOATS_PER_VERTEX);
+        for (size_t v = 0; v < count; ++v)
+        {
+            glm::vec4 p = world * glm::vec4(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2], 1.0f);
+            glm::vec3 n(0.0f);
+            if (hasNormals)
+            {
+                n = normalMatrix * glm::vec3(normals[v * 3], normals[v * 3 + 1], normals[v * 3 + 2]);
+                float length = glm::length(n);
+                n = length > 0.0f ? n / length : n;
+            }
+            // glTF puts the texture origin at the top left, OpenGL (and our flipped textures) at the bottom left
+            float u = hasUVs ? uvs[v * 2] : 0.0f;
+            float t = hasUVs ? 1.0f - uvs[v * 2 + 1] : 0.0f;
+            float vertex[IMPORT_FLOATS_PER_VERTEX] = { p.x, p.y, p.z, n.x, n.y, n.z, u, t };
+            vertices.insert(vertices.end(), vertex, vertex + IMPORT_FLOATS_PER_VERTEX);
+            needsNormal.push_back(hasNormals ? 0 : 1);
+        }
+
+        for (size_t k = 0; k + 2 < primitiveIndices.size(); k += 3)
+        {
+            if (primitiveIndices[k] >= count || primitiveIndices[k + 1] >= count || primitiveIndices[k + 2] >= count)
+            {
+                error = "index out of range";
+                return false;
+            }
+            indices.push_back(base + primitiveIndices[k]);
+            indices.push_back(base + primitiveIndices[k + 1]);
+            indices.push_back(base + primitiveIndices[k + 2]);
+        }
+    }
+    return true;
+}
+
+inline bool ImportGLB(const char* path, std::vector<float>& vertices, std::vector<unsigned int>& indices, std::string& error)
+{
+    MappedFile file;
+    if (!file.Open(path))
+    {
+        error = "cannot open file";
+        return false;
+    }
+
+    // 12 byte header, then chunks of (length, type, data); JSON comes first, BIN second
+    const unsigned char* data = file.Data();
+    size_t size = file.Size();
+    uint32_t header[3];
+    if (size < 20)
+    {
+        error = "file too small";
+        return false;
+    }
+    std::memcpy(header, data, sizeof(header));
+    if (header[0] != 0x46546C67u || header[1] != 2 || header[2] > size)
+    {
+        error = "not a glTF 2.0 binary file";
+        return false;
+    }
+
+    const char* jsonText = nullptr;
+    size_t jsonLength = 0;
+    const unsigned char* bin = nullptr;
+    size_t binLength = 0;
+    for (size_t offset = 12; offset + 8 <= header[2];)
+    {
+        uint32_t chunk[2];
+        std::memcpy(chunk, data + offset, sizeof(chunk));
+        if (offset + 8 + chunk[0] > header[2])
+            break;
+        if (chunk[1] == 0x4E4F534Au && !jsonText)
+        {
+            jsonText = (const char*)data + offset + 8;
+            jsonLength = chunk[0];
+        }
+        else if (chunk[1] == 0x004E4942u && !bin)
+        {
+            bin = data + offset + 8;
+            binLength = chunk[0];
+        }
+        offset += 8 + ((chunk[0] + 3) & ~3u);
+    }
+
+    JsonDocument json;
+    if (!jsonText || !json.Parse(jsonText, jsonLength))
+    {
+        error = "invalid JSON chunk";
+        return false;
+    }
+    GltfReader reader(json, bin, binLength);
+
+    // walk the node hierarchy of the default scene; files without scenes use every root node
+    std::vector<int> roots;
+    int nodes = json.Member(0, "nodes");
+    int scene = json.Element(json.Member(0, "scenes"), json.Int(json.Member(0, "scene"), 0));
+    if (scene >= 0)
+    {
+        int sceneNodes = json.Member(scene, "nodes");
+        for (int i = 0; i < json.Size(sceneNodes); ++i)
+            roots.push_back(json.Int(json.Element(sceneNodes, i), -1));
+    }
+    else
+    {
+        std::vector<unsigned char> isChild(json.Size(nodes), 0);
+        for (int i = 0; i < json.Size(nodes); ++i)
+        {
+            int children = json.Member(json.Element(nodes, i), "children");
+            for (int c = 0; c < json.Size(children); ++c)
+            {
+                int child = json.Int(json.Element(children, c), -1);
+                if (child >= 0 && child < (int)isChild.size())
+                    isChild[child] = 1;
+            }
+        }
+        for (int i = 0; i < json.Size(nodes); ++i)
+            if (!isChild[i])
+                roots.push_back(i);
+    }
+
+    vertices.clear();
+    indices.clear();
+    std::vector<unsigned char> needsNormal;
+    struct Pending { int node; glm::mat4 parentMatrix; int depth; };
+    std::vector<Pending> stack;
+    for (int root : roots)
+        stack.push_back({ root, glm::mat4(1.0f), 0 });
+    while (!stack.empty())
+    {
+        Pending pending = stack.back();
+        stack.pop_back();
+        int node = json.Element(nodes, pending.node);
+        if (node < 0 || pending.depth > 64)
+        {
+            error = "invalid node hierarchy";
+            return false;
+        }
+
+        glm::mat4 world = pending.parentMatrix * GltfNodeMatrix(json, node);
+        int mesh = json.Element(json.Member(0, "meshes"), json.Int(json.Member(node, "mesh"), -1));
+        if (mesh >= 0 && !GltfAppendMesh(json, reader, mesh, world, vertices, indices, needsNormal, error))
+            return false;
+
+        int children = json.Member(node, "children");
+        for (int c = 0; c < json.Size(children); ++c)
+            stack.push_back({ json.Int(json.Element(children, c), -1), world, pending.depth + 1 });
+    }
+
+    if (indices.empty())
+    {
+        error = "no triangles";
+        return false;
+    }
+    ImportComputeNormals(vertices, indices, needsNormal);
+    return true;
+}
+
+
+// imports an .obj or .glb file depending on its extension
+inline bool ImportMesh(const char* path, JobSystem& jobs, std::vector<float>& vertices, std::vector<unsigned int>& indices, std::string& error)
+{
+    const char* extension = std::strrchr(path, '.');
+    std::string lower = extension ? extension : "";
+    for (char& c : lower)
+        c = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+
+    if (lower == ".obj")
+        return ImportOBJ(path, jobs, vertices, indices, error);
+    if (lower == ".glb")
+        return ImportGLB(path, vertices, indices, error);
+    error = "unsupported file type (expected .obj or .glb)";
+    return false;
+}
+#endif
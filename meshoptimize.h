@@ -0,0 +1,277 @@
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Post-transform vertex cache statistics of an index buffer
+struct VertexCacheStats
+{
+    float acmr; // average cache miss ratio: transformed vertices per triangle (0.5 is ideal for large grids, 3 is worst)
+    float atvr; // average transformed vertex ratio: transformed vertices per vertex (1 is ideal)
+};
+
+
+// simulates a FIFO post-transform cache of the given size over the index buffer
+inline VertexCacheStats AnalyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = 16)
+{
+    VertexCacheStats stats = { 0.0f, 0.0f };
+    if (indices.empty() || vertexCount == 0)
+        return stats;
+
+    // a vertex is in the cache if it was loaded fewer than cacheSize misses ago
+    std::vector<unsigned int> loadedAt(vertexCount, 0);
+    unsigned int misses = 0;
+    for (unsigned int index : indices)
+    {
+        if (loadedAt[index] == 0 || misses - loadedAt[index] + 1 > cacheSize)
+        {
+            ++misses;
+            loadedAt[index] = misses;
+        }
+    }
+
+    stats.acmr = (float)misses / (indices.size() / 3);
+    stats.atvr = (float)misses / vertexCount;
+    return stats;
+}
+
+
+// Reorders triangles for the post-transform vertex cache (Tom Forsyth, "Linear-Speed Vertex Cache Optimisation")
+inline void OptimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount)
+{
+    const int cacheSize = 32;
+    const float cacheDecayPower = 1.5f;
+    const float lastTriangleScore = 0.75f;
+    const float valenceBoostScale = 2.0f;
+    const float valenceBoostPower = 0.5f;
+
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // triangles using each vertex (compressed adjacency lists)
+    std::vector<unsigned int> remaining(vertexCount, 0);
+    for (unsigned int index : indices)
+        ++remaining[index];
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    auto vertexScore = [&](unsigned int v)
+    {
+        if (remaining[v] == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+        int position = cachePosition[v];
+        if (position >= 0)
+        {
+            if (position < 3)
+                score = lastTriangleScore; // the triangle just emitted: fixed score so it isn't favoured too much
+            else
+                score = std::pow(1.0f - (float)(position - 3) / (cacheSize - 3), cacheDecayPower);
+        }
+        // vertices with few triangles left are worth finishing
+        return score + valenceBoostScale * std::pow((float)remaining[v], -valenceBoostPower);
+    };
+
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        vertexScores[v] = vertexScore((unsigned int)v);
+    std::vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+    std::vector<unsigned char> emitted(triangleCount, 0);
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    std::vector<unsigned int> cache, newCache;
+    cache.reserve(cacheSize + 3);
+    newCache.reserve(cacheSize + 3);
+    size_t scanCursor = 0;
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+    {
+        // best triangle touching the cache; if there is none, the first unemitted one in index order
+        int best = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : cache)
+        {
+            for (unsigned int a = offsets[v]; a < offsets[v + 1]; ++a)
+            {
+                unsigned int t = adjacency[a];
+                if (!emitted[t] && triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    best = (int)t;
+                }
+            }
+        }
+        if (best < 0)
+        {
+            while (emitted[scanCursor])
+                ++scanCursor;
+            best = (int)scanCursor;
+        }
+
+        // emit it and remove it from its vertices' adjacency
+        emitted[best] = 1;
+        const unsigned int* tri = &indices[best * 3];
+        for (int k = 0; k < 3; ++k)
+        {
+            unsigned int v = tri[k];
+            output.push_back(v);
+            --remaining[v];
+            for (unsigned int a = offsets[v]; a < offsets[v + 1]; ++a)
+            {
+                if (adjacency[a] == (unsigned int)best)
+                {
+                    std::swap(adjacency[a], adjacency[offsets[v] + remaining[v]]);
+                    break;
+                }
+            }
+        }
+
+        // move the triangle's vertices to the front of the LRU cache
+        newCache.assign(tri, tri + 3);
+        for (unsigned int v : cache)
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                newCache.push_back(v);
+        for (size_t i = 0; i < newCache.size(); ++i)
+            cachePosition[newCache[i]] = i < (size_t)cacheSize ? (int)i : -1;
+
+        // rescore everything whose cache position or valence changed, including vertices that just fell out
+        for (unsigned int v : newCache)
+        {
+            float score = vertexScore(v);
+            float delta = score - vertexScores[v];
+            vertexScores[v] = score;
+            for (unsigned int a = offsets[v]; a < offsets[v] + remaining[v]; ++a)
+                triangleScores[adjacency[a]] += delta;
+        }
+
+        if (newCache.size() > (size_t)cacheSize)
+            newCache.resize(cacheSize);
+        cache.swap(newCache);
+    }
+
+    indices.swap(output);
+}
+
+
+// Reorders clusters of triangles so outward facing ones are drawn first, which lets early depth testing reject
+// more of the hidden fragments. Clusters are split where the vertex cache restarts (all three vertices of a
+// triangle miss a FIFO cache), so the cache order from OptimizeVertexCache is kept within each cluster.
+inline void OptimizeOverdraw(std::vector<unsigned int>& indices, const float* vertices, size_t floatsPerVertex, size_t vertexCount, unsigned int cacheSize = 16)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    auto position = [&](unsigned int v) { return glm::vec3(vertices[v * floatsPerVertex], vertices[v * floatsPerVertex + 1], vertices[v * floatsPerVertex + 2]); };
+
+    // cluster boundaries
+    std::vector<size_t> clusterStart;
+    std::vector<unsigned int> loadedAt(vertexCount, 0);
+    unsigned int misses = 0;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        int triangleMisses = 0;
+        for (int k = 0; k < 3; ++k)
+        {
+            unsigned int v = indices[t * 3 + k];
+            if (loadedAt[v] == 0 || misses - loadedAt[v] + 1 > cacheSize)
+            {
+                ++misses;
+                loadedAt[v] = misses;
+                ++triangleMisses;
+            }
+        }
+        if (t == 0 || triangleMisses == 3)
+            clusterStart.push_back(t);
+    }
+    clusterStart.push_back(triangleCount);
+    size_t clusterCount = clusterStart.size() - 1;
+    if (clusterCount < 2)
+        return;
+
+    // area weighted centroid of the whole mesh
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> clusterCentroid(clusterCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> clusterNormal(clusterCount, glm::vec3(0.0f));
+    for (size_t c = 0; c < clusterCount; ++c)
+    {
+        float clusterArea = 0.0f;
+        for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; ++t)
+        {
+            glm::vec3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+            float area = glm::length(normal);
+            glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+            clusterCentroid[c] += centroid * area;
+            clusterNormal[c] += normal;
+            clusterArea += area;
+            meshCentroid += centroid * area;
+            meshArea += area;
+        }
+        if (clusterArea > 0.0f)
+            clusterCentroid[c] /= clusterArea;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // clusters facing away from the centre occlude the others, draw them first
+    std::vector<float> sortKey(clusterCount);
+    std::vector<size_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c)
+    {
+        float length = glm::length(clusterNormal[c]);
+        glm::vec3 normal = length > 0.0f ? clusterNormal[c] / length : glm::vec3(0.0f);
+        sortKey[c] = glm::dot(clusterCentroid[c] - meshCentroid, normal);
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    for (size_t c : order)
+        output.insert(output.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+    indices.swap(output);
+}
+
+
+// Reorders vertices in the order the index buffer first references them, so vertex fetch walks memory
+// linearly; unreferenced vertices are dropped. Returns the new vertex count.
+inline size_t OptimizeVertexFetch(std::vector<float>& vertices, std::vector<unsigned int>& indices, size_t floatsPerVertex)
+{
+    size_t vertexCount = vertices.size() / floatsPerVertex;
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertexCount, unused);
+    std::vector<float> output;
+    output.reserve(vertices.size());
+
+    unsigned int next = 0;
+    for (unsigned int& index : indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = next++;
+            output.insert(output.end(), vertices.begin() + index * floatsPerVertex, vertices.begin() + (index + 1) * floatsPerVertex);
+        }
+        index = remap[index];
+    }
+
+    vertices.swap(output);
+    return next;
+}
+#endif
@@ -0,0 +1,240 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Occlusion culling against a low resolution depth buffer rendered on the CPU. A few large occluders are
+// rasterized into level 0, then every level above keeps the farthest depth of its 2x2 children (a hierarchical
+// Z pyramid). A bounding box is hidden when its nearest depth lies behind the stored depth of every texel its
+// screen rectangle touches, on the level where that rectangle spans at most 2x2 texels.
+// Rasterization is conservative in the culling direction: only pixels the occluder covers completely are
+// written, with the farthest depth the triangle reaches inside the pixel, so nothing visible is ever culled.
+// Depths are window depths (0 near, 1 far) as GL produces them.
+
+class OcclusionBuffer
+{
+public:
+    // size of level 0; the pyramid goes down to 1x1
+    void Resize(int width, int height)
+    {
+        levels.clear();
+        widths.clear();
+        heights.clear();
+        width = std::max(width, 1);
+        height = std::max(height, 1);
+        while (true)
+        {
+            levels.emplace_back((size_t)width * height, 1.0f);
+            widths.push_back(width);
+            heights.push_back(height);
+            if (width == 1 && height == 1)
+                break;
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+        }
+    }
+
+    int Width() const { return widths.empty() ? 0 : widths[0]; }
+    int Height() const { return heights.empty() ? 0 : heights[0]; }
+    int LevelCount() const { return (int)levels.size(); }
+
+    void Clear()
+    {
+        std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+        occluderTriangles = 0;
+    }
+
+    // Rasterizes indexed triangles whose positions are the first three floats of each vertex (stride in floats)
+    void DrawOccluder(const float* vertices, int stride, const uint32_t* indices, size_t indexCount, const glm::mat4& modelViewProjection)
+    {
+        for (size_t i = 0; i + 2 < indexCount; i += 3)
+        {
+            glm::vec4 clip[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                const float* p = vertices + (size_t)indices[i + k] * stride;
+                clip[k] = modelViewProjection * glm::vec4(p[0], p[1], p[2], 1.0f);
+            }
+            drawClipped(clip);
+        }
+    }
+
+    // Rebuilds the levels above 0 from the occluders drawn since Clear
+    void BuildHierarchy()
+    {
+        for (size_t level = 1; level < levels.size(); ++level)
+        {
+            const std::vector<float>& below = levels[level - 1];
+            int belowWidth = widths[level - 1], belowHeight = heights[level - 1];
+            std::vector<float>& depths = levels[level];
+            for (int y = 0; y < heights[level]; ++y)
+            {
+                int y0 = y * 2, y1 = std::min(y * 2 + 1, belowHeight - 1);
+                for (int x = 0; x < widths[level]; ++x)
+                {
+                    int x0 = x * 2, x1 = std::min(x * 2 + 1, belowWidth - 1);
+                    float farthest = std::max(std::max(below[(size_t)y0 * belowWidth + x0], below[(size_t)y0 * belowWidth + x1]),
+                        std::max(below[(size_t)y1 * belowWidth + x0], below[(size_t)y1 * belowWidth + x1]));
+                    depths[(size_t)y * widths[level] + x] = farthest;
+                }
+            }
+        }
+    }
+
+    // false only when the world space box is certainly hidden behind the occluders
+    bool IsVisible(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::mat4& viewProjection) const
+    {
+        float minX, minY, maxX, maxY, nearestDepth;
+        if (!projectBox(boxMin, boxMax, viewProjection, minX, minY, maxX, maxY, nearestDepth))
+            return true; // crosses the near plane
+
+        int x0 = std::max((int)std::floor(minX), 0);
+        int y0 = std::max((int)std::floor(minY), 0);
+        int x1 = std::min((int)std::ceil(maxX) - 1, widths[0] - 1);
+        int y1 = std::min((int)std::ceil(maxY) - 1, heights[0] - 1);
+        if (x0 > x1 || y0 > y1)
+            return true; // off screen, left to the frustum test
+
+        // the coarsest level would always answer; pick the finest one where the rectangle touches at most 2x2 texels
+        int level = 0;
+        while (level + 1 < (int)levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+            ++level;
+
+        const std::vector<float>& depths = levels[level];
+        for (int y = y0 >> level; y <= y1 >> level; ++y)
+            for (int x = x0 >> level; x <= x1 >> level; ++x)
+                if (nearestDepth <= depths[(size_t)y * widths[level] + x])
+                    return true;
+        return false;
+    }
+
+    // Fraction of the screen covered by the box's screen rectangle, 1 when it crosses the near plane;
+    // used to pick the objects worth rasterizing as occluders
+    float ScreenCoverage(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::mat4& viewProjection) const
+    {
+        float minX, minY, maxX, maxY, nearestDepth;
+        if (!projectBox(boxMin, boxMax, viewProjection, minX, minY, maxX, maxY, nearestDepth))
+            return 1.0f;
+        float w = std::min(maxX, (float)widths[0]) - std::max(minX, 0.0f);
+        float h = std::min(maxY, (float)heights[0]) - std::max(minY, 0.0f);
+        return w > 0.0f && h > 0.0f ? w * h / ((float)widths[0] * heights[0]) : 0.0f;
+    }
+
+    size_t OccluderTriangles() const { return occluderTriangles; }
+
+private:
+    std::vector<std::vector<float>> levels;
+    std::vector<int> widths;
+    std::vector<int> heights;
+    size_t occluderTriangles = 0;
+
+    // screen rectangle in level 0 pixels and nearest window depth of a box; false when a corner is behind the near plane
+    bool projectBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::mat4& viewProjection,
+        float& minX, float& minY, float& maxX, float& maxY, float& nearestDepth) const
+    {
+        minX = minY = nearestDepth = 1e30f;
+        maxX = maxY = -1e30f;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            glm::vec4 clip = viewProjection * glm::vec4(
+                corner & 1 ? boxMax.x : boxMin.x, corner & 2 ? boxMax.y : boxMin.y, corner & 4 ? boxMax.z : boxMin.z, 1.0f);
+            if (clip.z < -clip.w || clip.w <= 0.0f)
+                return false;
+            glm::vec3 window = toWindow(clip);
+            minX = std::min(minX, window.x);
+            maxX = std::max(maxX, window.x);
+            minY = std::min(minY, window.y);
+            maxY = std::max(maxY, window.y);
+            nearestDepth = std::min(nearestDepth, window.z);
+        }
+        return true;
+    }
+
+    glm::vec3 toWindow(const glm::vec4& clip) const
+    {
+        float inverseW = 1.0f / clip.w;
+        return glm::vec3((clip.x * inverseW * 0.5f + 0.5f) * widths[0], (clip.y * inverseW * 0.5f + 0.5f) * heights[0], clip.z * inverseW * 0.5f + 0.5f);
+    }
+
+    // clips a triangle against the near plane (z >= -w); the far plane needs no clipping, depths past it are clamped
+    void drawClipped(const glm::vec4 (&clip)[3])
+    {
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int k = 0; k < 3; ++k)
+        {
+            const glm::vec4& a = clip[k];
+            const glm::vec4& b = clip[(k + 1) % 3];
+            float da = a.z + a.w, db = b.z + b.w;
+            if (da >= 0.0f)
+                polygon[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                polygon[count++] = a + (b - a) * (da / (da - db));
+        }
+        for (int k = 1; k + 1 < count; ++k)
+            drawTriangle(toWindow(polygon[0]), toWindow(polygon[k]), toWindow(polygon[k + 1]));
+    }
+
+    void drawTriangle(glm::vec3 v0, glm::vec3 v1, const glm::vec3& v2)
+    {
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+        if (std::fabs(area) < 1e-6f)
+            return;
+        if (area < 0.0f)
+        {
+            std::swap(v0, v1); // occluders are double sided; make the winding counterclockwise
+            area = -area;
+        }
+        ++occluderTriangles;
+
+        int width = widths[0], height = heights[0];
+        int x0 = std::max((int)std::floor(std::min(v0.x, std::min(v1.x, v2.x))), 0);
+        int x1 = std::min((int)std::ceil(std::max(v0.x, std::max(v1.x, v2.x))) - 1, width - 1);
+        int y0 = std::max((int)std::floor(std::min(v0.y, std::min(v1.y, v2.y))), 0);
+        int y1 = std::min((int)std::ceil(std::max(v0.y, std::max(v1.y, v2.y))) - 1, height - 1);
+        if (x0 > x1 || y0 > y1)
+            return;
+
+        // edge functions a x + b y + c, positive inside; a pixel is covered completely when every edge is
+        // positive at the pixel corner closest to it, half a pixel from the center in x and y
+        const glm::vec3* v[3] = { &v0, &v1, &v2 };
+        float a[3], b[3], c[3], inset[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            const glm::vec3& p = *v[k];
+            const glm::vec3& q = *v[(k + 1) % 3];
+            a[k] = p.y - q.y;
+            b[k] = q.x - p.x;
+            c[k] = p.x * q.y - p.y * q.x;
+            inset[k] = 0.5f * (std::fabs(a[k]) + std::fabs(b[k]));
+        }
+
+        // depth plane, and the farthest it reaches within half a pixel of the center, never past the farthest vertex
+        float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+        float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+        float depthSlack = 0.5f * (std::fabs(dzdx) + std::fabs(dzdy));
+        float farthest = std::min(std::max(v0.z, std::max(v1.z, v2.z)), 1.0f);
+
+        std::vector<float>& depths = levels[0];
+        for (int y = y0; y <= y1; ++y)
+        {
+            float cy = y + 0.5f;
+            for (int x = x0; x <= x1; ++x)
+            {
+                float cx = x + 0.5f;
+                if (a[0] * cx + b[0] * cy + c[0] < inset[0] || a[1] * cx + b[1] * cy + c[1] < inset[1] || a[2] * cx + b[2] * cy + c[2] < inset[2])
+                    continue;
+                float depth = std::min(v0.z + dzdx * (cx - v0.x) + dzdy * (cy - v0.y) + depthSlack, farthest);
+                float& stored = depths[(size_t)y * width + x];
+                stored = std::min(stored, depth);
+            }
+        }
+    }
+};
+#endif
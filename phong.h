@@ -0,0 +1,215 @@
+#ifndef PHONG_H
+#define PHONG_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// The three-light Phong model of cubeFragmentShaderSource on the CPU, for the software rasterizer and offline baking.
+// ShadePhong is the straightforward per-fragment reference; ShadePhongBatch shades fragments stored as separate
+// arrays per component (SoA), 8 at a time with AVX2, 4 at a time with SSE, or one at a time otherwise. The widest
+// instruction set the compiler targets is used (/arch:AVX2 or -mavx2 for AVX2; SSE is always there on x64).
+#if defined(__AVX2__)
+#define PHONG_USE_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PHONG_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+const float PHONG_AMBIENT_STRENGTH = 0.01f;
+const float PHONG_SPECULAR_INTENSITY = 0.6f;    // the highlight size of 16 is applied as four squarings
+
+// Shading constants, the values of the FrameData uniform block
+struct PhongLights
+{
+    glm::vec3 viewPosition;
+    glm::vec3 lightPositions[3];
+    glm::vec3 lightColors[3];
+};
+
+// Fragments to shade; element i of every array belongs to fragment i. Normals need not be normalized.
+struct PhongFragments
+{
+    const float* positionX;
+    const float* positionY;
+    const float* positionZ;
+    const float* normalX;
+    const float* normalY;
+    const float* normalZ;
+    const float* colorR;    // texture color
+    const float* colorG;
+    const float* colorB;
+};
+
+struct PhongOutput
+{
+    float* r;
+    float* g;
+    float* b;
+};
+
+
+// Reference implementation for one fragment
+inline glm::vec3 ShadePhong(const PhongLights& lights, const glm::vec3& position, const glm::vec3& normal, const glm::vec3& textureColor)
+{
+    glm::vec3 norm = glm::normalize(normal);
+    glm::vec3 viewDir = glm::normalize(lights.viewPosition - position);
+    glm::vec3 light(0.0f);
+    for (int i = 0; i < 3; ++i)
+    {
+        glm::vec3 lightDirection = glm::normalize(lights.lightPositions[i] - position);
+        float impact = std::max(glm::dot(norm, lightDirection), 0.0f);
+        glm::vec3 reflectDir = 2.0f * glm::dot(norm, lightDirection) * norm - lightDirection; // reflect(-lightDirection, norm)
+        float specular = std::max(glm::dot(viewDir, reflectDir), 0.0f);
+        specular *= specular;
+        specular *= specular;
+        specular *= specular;
+        specular *= specular;
+        light += (PHONG_AMBIENT_STRENGTH + impact + PHONG_SPECULAR_INTENSITY * specular) * lights.lightColors[i];
+    }
+    return light * textureColor;
+}
+
+
+// Lanes of the batch kernel: one wrapper per register width with the handful of operations Phong needs
+struct PhongFloat1
+{
+    static const int WIDTH = 1;
+    float v;
+    static PhongFloat1 Load(const float* p) { return { *p }; }
+    static PhongFloat1 Set(float x) { return { x }; }
+    void Store(float* p) const { *p = v; }
+    friend PhongFloat1 operator+(PhongFloat1 a, PhongFloat1 b) { return { a.v + b.v }; }
+    friend PhongFloat1 operator-(PhongFloat1 a, PhongFloat1 b) { return { a.v - b.v }; }
+    friend PhongFloat1 operator*(PhongFloat1 a, PhongFloat1 b) { return { a.v * b.v }; }
+    friend PhongFloat1 Max(PhongFloat1 a, PhongFloat1 b) { return { a.v > b.v ? a.v : b.v }; }
+    friend PhongFloat1 InverseSqrt(PhongFloat1 a) { return { 1.0f / std::sqrt(a.v) }; }
+};
+
+#ifdef PHONG_USE_SSE
+struct PhongFloat4
+{
+    static const int WIDTH = 4;
+    __m128 v;
+    static PhongFloat4 Load(const float* p) { return { _mm_loadu_ps(p) }; }
+    static PhongFloat4 Set(float x) { return { _mm_set1_ps(x) }; }
+    void Store(float* p) const { _mm_storeu_ps(p, v); }
+    friend PhongFloat4 operator+(PhongFloat4 a, PhongFloat4 b) { return { _mm_add_ps(a.v, b.v) }; }
+    friend PhongFloat4 operator-(PhongFloat4 a, PhongFloat4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+    friend PhongFloat4 operator*(PhongFloat4 a, PhongFloat4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+    friend PhongFloat4 Max(PhongFloat4 a, PhongFloat4 b) { return { _mm_max_ps(a.v, b.v) }; }
+    // 12-bit estimate refined with one Newton-Raphson step to about 22 bits
+    friend PhongFloat4 InverseSqrt(PhongFloat4 a)
+    {
+        __m128 estimate = _mm_rsqrt_ps(a.v);
+        __m128 halfA = _mm_mul_ps(_mm_set1_ps(0.5f), a.v);
+        __m128 refine = _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfA, _mm_mul_ps(estimate, estimate)));
+        return { _mm_mul_ps(estimate, refine) };
+    }
+};
+#endif
+
+#ifdef PHONG_USE_AVX2
+struct PhongFloat8
+{
+    static const int WIDTH = 8;
+    __m256 v;
+    static PhongFloat8 Load(const float* p) { return { _mm256_loadu_ps(p) }; }
+    static PhongFloat8 Set(float x) { return { _mm256_set1_ps(x) }; }
+    void Store(float* p) const { _mm256_storeu_ps(p, v); }
+    friend PhongFloat8 operator+(PhongFloat8 a, PhongFloat8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+    friend PhongFloat8 operator-(PhongFloat8 a, PhongFloat8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    friend PhongFloat8 operator*(PhongFloat8 a, PhongFloat8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    friend PhongFloat8 Max(PhongFloat8 a, PhongFloat8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+    friend PhongFloat8 InverseSqrt(PhongFloat8 a)
+    {
+        __m256 estimate = _mm256_rsqrt_ps(a.v);
+        __m256 halfA = _mm256_mul_ps(_mm256_set1_ps(0.5f), a.v);
+        __m256 refine = _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(halfA, _mm256_mul_ps(estimate, estimate)));
+        return { _mm256_mul_ps(estimate, refine) };
+    }
+};
+#endif
+
+
+// Shades Wide::WIDTH fragments starting at index i
+template <typename Wide>
+inline void PhongKernel(const PhongLights& lights, const PhongFragments& in, size_t i, const PhongOutput& out)
+{
+    Wide px = Wide::Load(in.positionX + i), py = Wide::Load(in.positionY + i), pz = Wide::Load(in.positionZ + i);
+    Wide nx = Wide::Load(in.normalX + i), ny = Wide::Load(in.normalY + i), nz = Wide::Load(in.normalZ + i);
+
+    Wide inverseLength = InverseSqrt(nx * nx + ny * ny + nz * nz);
+    nx = nx * inverseLength;
+    ny = ny * inverseLength;
+    nz = nz * inverseLength;
+
+    Wide vx = Wide::Set(lights.viewPosition.x) - px, vy = Wide::Set(lights.viewPosition.y) - py, vz = Wide::Set(lights.viewPosition.z) - pz;
+    inverseLength = InverseSqrt(vx * vx + vy * vy + vz * vz);
+    vx = vx * inverseLength;
+    vy = vy * inverseLength;
+    vz = vz * inverseLength;
+
+    const Wide zero = Wide::Set(0.0f);
+    const Wide two = Wide::Set(2.0f);
+    Wide r = zero, g = zero, b = zero;
+    for (int l = 0; l < 3; ++l)
+    {
+        Wide lx = Wide::Set(lights.lightPositions[l].x) - px, ly = Wide::Set(lights.lightPositions[l].y) - py, lz = Wide::Set(lights.lightPositions[l].z) - pz;
+        inverseLength = InverseSqrt(lx * lx + ly * ly + lz * lz);
+        lx = lx * inverseLength;
+        ly = ly * inverseLength;
+        lz = lz * inverseLength;
+
+        Wide nDotL = nx * lx + ny * ly + nz * lz;
+        Wide twoNDotL = two * nDotL;
+        Wide specular = Max((twoNDotL * nx - lx) * vx + (twoNDotL * ny - ly) * vy + (twoNDotL * nz - lz) * vz, zero);
+        specular = specular * specular;
+        specular = specular * specular;
+        specular = specular * specular;
+        specular = specular * specular;
+
+        Wide intensity = Wide::Set(PHONG_AMBIENT_STRENGTH) + Max(nDotL, zero) + Wide::Set(PHONG_SPECULAR_INTENSITY) * specular;
+        r = r + intensity * Wide::Set(lights.lightColors[l].x);
+        g = g + intensity * Wide::Set(lights.lightColors[l].y);
+        b = b + intensity * Wide::Set(lights.lightColors[l].z);
+    }
+
+    (r * Wide::Load(in.colorR + i)).Store(out.r + i);
+    (g * Wide::Load(in.colorG + i)).Store(out.g + i);
+    (b * Wide::Load(in.colorB + i)).Store(out.b + i);
+}
+
+// Shades count fragments with the widest available kernel; out may alias the color arrays of in
+inline void ShadePhongBatch(const PhongLights& lights, const PhongFragments& in, size_t count, const PhongOutput& out)
+{
+    size_t i = 0;
+#if defined(PHONG_USE_AVX2)
+    for (; i + 8 <= count; i += 8)
+        PhongKernel<PhongFloat8>(lights, in, i, out);
+#elif defined(PHONG_USE_SSE)
+    for (; i + 8 <= count; i += 8)
+    {
+        PhongKernel<PhongFloat4>(lights, in, i, out);
+        PhongKernel<PhongFloat4>(lights, in, i + 4, out);
+    }
+#endif
+    for (; i < count; ++i)
+        PhongKernel<PhongFloat1>(lights, in, i, out);
+}
+
+// name of the kernel ShadePhongBatch uses, for reports
+inline const char* PhongKernelName()
+{
+#if defined(PHONG_USE_AVX2)
+    return "AVX2, 8 fragments per step";
+#elif defined(PHONG_USE_SSE)
+    return "SSE, 2x4 fragments per step";
+#else
+    return "scalar";
+#endif
+}
+#endif
@@ -0,0 +1,98 @@
+#ifndef PICKING_H
+#define PICKING_H
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "vertexformat.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Ray casts against triangle meshes for mouse picking. Every mesh keeps its positions and a BVH over its
+// triangles, so one cast costs a few dozen box and triangle tests however many triangles the mesh has; the
+// scene BVH over the object boxes decides which meshes are cast against at all.
+
+// Moller-Trumbore, both sides; returns the distance along direction (in units of its length) or -1
+inline float IntersectRayTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    glm::vec3 edge1 = b - a;
+    glm::vec3 edge2 = c - a;
+    glm::vec3 p = glm::cross(direction, edge2);
+    float determinant = glm::dot(edge1, p);
+    if (std::fabs(determinant) < 1e-12f)
+        return -1.0f;
+    float inverse = 1.0f / determinant;
+    glm::vec3 s = origin - a;
+    float u = glm::dot(s, p) * inverse;
+    if (u < 0.0f || u > 1.0f)
+        return -1.0f;
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(direction, q) * inverse;
+    if (v < 0.0f || u + v > 1.0f)
+        return -1.0f;
+    return glm::dot(edge2, q) * inverse;
+}
+
+
+class PickMesh
+{
+public:
+    // decodes the positions of vertices in any VertexFormat; indices are 2 or 4 bytes each
+    void Build(const void* vertices, size_t vertexCount, VertexFormat format, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+        const void* indices, size_t indexSize, size_t indexCount)
+    {
+        size_t stride = VertexStride(format);
+        positions.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            const unsigned char* vertex = (const unsigned char*)vertices + i * stride;
+            if (format == VERTEX_FORMAT_QUANTIZED)
+            {
+                const unsigned short* p = ((const QuantizedVertex*)vertex)->position;
+                positions[i] = boundsMin + glm::vec3(p[0], p[1], p[2]) / 65535.0f * (boundsMax - boundsMin);
+            }
+            else
+            {
+                // FULL and COMPACT both start with three floats
+                const float* p = (const float*)vertex;
+                positions[i] = glm::vec3(p[0], p[1], p[2]);
+            }
+        }
+
+        triangles.resize(indexCount);
+        for (size_t i = 0; i < indexCount; ++i)
+            triangles[i] = indexSize == 2 ? ((const uint16_t*)indices)[i] : ((const uint32_t*)indices)[i];
+
+        size_t triangleCount = indexCount / 3;
+        std::vector<glm::vec3> triangleMin(triangleCount), triangleMax(triangleCount);
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            const glm::vec3& a = positions[triangles[t * 3]];
+            const glm::vec3& b = positions[triangles[t * 3 + 1]];
+            const glm::vec3& c = positions[triangles[t * 3 + 2]];
+            triangleMin[t] = glm::min(a, glm::min(b, c));
+            triangleMax[t] = glm::max(a, glm::max(b, c));
+        }
+        bvh.Build(triangleMin.data(), triangleMax.data(), (int)triangleCount);
+    }
+
+    size_t TriangleCount() const { return triangles.size() / 3; }
+
+    // nearest triangle along a mesh space ray within distance (updated on a hit); -1 when nothing is hit
+    int Raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance) const
+    {
+        return bvh.Raycast(origin, direction, distance, [&](int triangle, float)
+        {
+            return IntersectRayTriangle(origin, direction, positions[triangles[triangle * 3]], positions[triangles[triangle * 3 + 1]], positions[triangles[triangle * 3 + 2]]);
+        });
+    }
+
+private:
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> triangles;    // three vertex indices per triangle
+    BVH bvh;
+};
+#endif
@@ -0,0 +1,114 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+// A GL buffer split into FRAME_COUNT sections that stay mapped for its whole lifetime (persistent, coherent).
+// The CPU fills the section of frame N with plain stores while the GPU may still be reading frames N-1 and N-2;
+// every section is guarded by a fence, so BeginFrame only blocks when the GPU falls more than two frames behind.
+class PersistentRingBuffer
+{
+public:
+    static const int FRAME_COUNT = 3;
+
+    PersistentRingBuffer() {}
+    ~PersistentRingBuffer() { Destroy(); }
+
+    PersistentRingBuffer(const PersistentRingBuffer&) = delete;
+    PersistentRingBuffer& operator=(const PersistentRingBuffer&) = delete;
+
+    // creates the buffer; sectionSize is rounded up so every section can be bound as a uniform or storage range
+    bool Create(size_t sectionSize)
+    {
+        Destroy();
+
+        GLint uniformAlignment = 256, storageAlignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+        alignment = (size_t)(uniformAlignment > storageAlignment ? uniformAlignment : storageAlignment);
+        if (alignment == 0)
+            alignment = 256;
+        sectionBytes = Align(sectionSize);
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(sectionBytes * FRAME_COUNT), NULL, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr)(sectionBytes * FRAME_COUNT), flags);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if (!mapped)
+        {
+            Destroy();
+            return false;
+        }
+        section = 0;
+        return true;
+    }
+
+    void Destroy()
+    {
+        if (!buffer)
+            return;
+        for (int i = 0; i < FRAME_COUNT; ++i)
+            waitForSection(i);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        mapped = nullptr;
+        sectionBytes = 0;
+    }
+
+    // waits until the GPU no longer reads the current section and returns it for writing
+    unsigned char* BeginFrame()
+    {
+        waitForSection(section);
+        return mapped + SectionOffset();
+    }
+
+    // fences the commands that read the current section and moves on to the next one
+    void EndFrame()
+    {
+        fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        section = (section + 1) % FRAME_COUNT;
+    }
+
+    GLuint Buffer() const { return buffer; }
+    size_t SectionOffset() const { return sectionBytes * section; }
+    size_t SectionSize() const { return sectionBytes; }
+
+    // rounds an offset inside a section up to the binding alignment
+    size_t Align(size_t offset) const { return (offset + alignment - 1) / alignment * alignment; }
+
+    // number of BeginFrame calls that had to wait for the GPU
+    unsigned StallCount() const { return stalls; }
+
+private:
+    GLuint buffer = 0;
+    unsigned char* mapped = nullptr;
+    size_t sectionBytes = 0;
+    size_t alignment = 256;
+    int section = 0;
+    GLsync fences[FRAME_COUNT] = {};
+    unsigned stalls = 0;
+
+    void waitForSection(int i)
+    {
+        if (!fences[i])
+            return;
+        GLenum result = glClientWaitSync(fences[i], 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED)
+        {
+            ++stalls;
+            do
+                result = glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            while (result == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fences[i]);
+        fences[i] = 0;
+    }
+};
+#endif
@@ -0,0 +1,175 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Omnidirectional shadow maps for the point lights. Every light has a depth cube map holding the distance to
+// the nearest static caster divided by the far plane; it is rendered once (one layered draw per caster, a
+// geometry shader emits every triangle to the faces it touches) and only again when the light moves or a static
+// object moves. Dynamic casters are drawn every frame into a second cube map per light, which starts as a GPU
+// copy of the static one, so a frame without moving lights costs one copy and the dynamic objects per light.
+// Both maps use depth comparison with linear filtering, so one sample gives 2x2 percentage closer filtering.
+// Casters are drawn double sided (several meshes are open); receivers offset their lookup along the normal.
+
+const int SHADOW_LIGHT_COUNT = 3;
+
+class PointShadowMaps
+{
+public:
+    PointShadowMaps() {}
+    ~PointShadowMaps() { Destroy(); }
+
+    PointShadowMaps(const PointShadowMaps&) = delete;
+    PointShadowMaps& operator=(const PointShadowMaps&) = delete;
+
+    // program is the caster shader: it needs uFaceMatrices[6], uLightPosition and uFarPlane
+    void Create(int mapSize, float farPlaneDistance, GLuint program)
+    {
+        Destroy();
+        size = mapSize;
+        farPlane = farPlaneDistance;
+        faceMatricesLocation = glGetUniformLocation(program, "uFaceMatrices");
+        lightPositionLocation = glGetUniformLocation(program, "uLightPosition");
+        farPlaneLocation = glGetUniformLocation(program, "uFarPlane");
+
+        glGenTextures(SHADOW_LIGHT_COUNT, staticMaps);
+        glGenTextures(SHADOW_LIGHT_COUNT, dynamicMaps);
+        for (int i = 0; i < SHADOW_LIGHT_COUNT; ++i)
+        {
+            createCubeMap(staticMaps[i]);
+            createCubeMap(dynamicMaps[i]);
+            staticValid[i] = false;
+            composited[i] = false;
+        }
+        glGenFramebuffers(1, &framebuffer);
+    }
+
+    void Destroy()
+    {
+        if (!framebuffer)
+            return;
+        glDeleteTextures(SHADOW_LIGHT_COUNT, staticMaps);
+        glDeleteTextures(SHADOW_LIGHT_COUNT, dynamicMaps);
+        glDeleteFramebuffers(1, &framebuffer);
+        framebuffer = 0;
+    }
+
+    bool IsCreated() const { return framebuffer != 0; }
+    float FarPlane() const { return farPlane; }
+
+    // a static caster moved: every static map is rendered again
+    void InvalidateStatic()
+    {
+        for (int i = 0; i < SHADOW_LIGHT_COUNT; ++i)
+            staticValid[i] = false;
+    }
+
+    // true when the light's static map is missing or was rendered from another position
+    bool NeedsStaticPass(int light, const glm::vec3& position) const
+    {
+        return !staticValid[light] || staticPositions[light] != position;
+    }
+
+    // Begin a pass with the caster program bound, draw the casters, then call EndPass.
+    // A static pass clears and rebuilds the light's static map; a dynamic pass starts from a copy of it.
+    void BeginStaticPass(int light, const glm::vec3& position)
+    {
+        beginPass(staticMaps[light], position);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        staticValid[light] = true;
+        staticPositions[light] = position;
+        ++staticPasses;
+    }
+
+    void BeginDynamicPass(int light, const glm::vec3& position)
+    {
+        glCopyImageSubData(staticMaps[light], GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, dynamicMaps[light], GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, size, size, 6);
+        beginPass(dynamicMaps[light], position);
+        composited[light] = true;
+        ++dynamicPasses;
+    }
+
+    void EndPass()
+    {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)previousFramebuffer);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    }
+
+    // binds every light's map for this frame to consecutive texture units; call once per frame after the passes
+    void Bind(GLint firstUnit)
+    {
+        for (int i = 0; i < SHADOW_LIGHT_COUNT; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, composited[i] ? dynamicMaps[i] : staticMaps[i]);
+            composited[i] = false;
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    unsigned StaticPassCount() const { return staticPasses; }
+    unsigned DynamicPassCount() const { return dynamicPasses; }
+
+private:
+    GLuint staticMaps[SHADOW_LIGHT_COUNT] = {};
+    GLuint dynamicMaps[SHADOW_LIGHT_COUNT] = {};
+    GLuint framebuffer = 0;
+    int size = 1024;
+    float farPlane = 50.0f;
+    GLint faceMatricesLocation = -1;
+    GLint lightPositionLocation = -1;
+    GLint farPlaneLocation = -1;
+    bool staticValid[SHADOW_LIGHT_COUNT] = {};
+    glm::vec3 staticPositions[SHADOW_LIGHT_COUNT];
+    bool composited[SHADOW_LIGHT_COUNT] = {};  // the dynamic map holds this frame's shadows
+    GLint previousFramebuffer = 0;
+    GLint previousViewport[4] = {};
+    unsigned staticPasses = 0;
+    unsigned dynamicPasses = 0;
+
+    void createCubeMap(GLuint texture)
+    {
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT32F, size, size);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    // attaches all six faces as layers and sets the caster uniforms for the light
+    void beginPass(GLuint cubeMap, const glm::vec3& position)
+    {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMap, 0);
+        glDrawBuffer(GL_NONE);
+        glViewport(0, 0, size, size);
+        glEnable(GL_DEPTH_TEST);
+
+        // GL cube map face order (+X, -X, +Y, -Y, +Z, -Z) with the conventional up vectors
+        static const glm::vec3 directions[6] = {
+            glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+        static const glm::vec3 ups[6] = {
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+            glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, farPlane);
+        glm::mat4 faces[6];
+        for (int face = 0; face < 6; ++face)
+            faces[face] = projection * glm::lookAt(position, position + directions[face], ups[face]);
+        glUniformMatrix4fv(faceMatricesLocation, 6, GL_FALSE, glm::value_ptr(faces[0]));
+        glUniform3fv(lightPositionLocation, 1, glm::value_ptr(position));
+        glUniform1f(farPlaneLocation, farPlane);
+    }
+};
+#endif
@@ -0,0 +1,468 @@
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+#include <glm/glm.hpp>
+
+#include "jobsystem.h"
+#include "phong.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// CPU rendering backend for machines without a GPU. It draws the same meshes, model matrices and textures as
+// the GL path and shades with the Phong model of cubeFragmentShaderSource. A frame runs in three phases:
+//   1. per draw (in parallel): vertex transform, near plane clipping and triangle setup
+//   2. binning: every triangle is appended to the 64x64 pixel screen tiles its bounding box touches
+//   3. per tile (in parallel): depth tested rasterization into a visibility buffer (triangle + barycentrics),
+//      then one shading pass over the visible pixels, so hidden fragments are never shaded. The visible
+//      fragments are gathered into SoA arrays and lit by the ShadePhongBatch SIMD kernel
+// Tiles never share pixels, so phase 3 needs no synchronization. Output rows are bottom-up like glReadPixels.
+
+const int RASTER_FLOATS_PER_VERTEX = 8; // position, normal, texture coordinate (the MeshData layout)
+const int RASTER_TILE_SIZE = 64;
+
+// Geometry drawn by the software rasterizer
+struct RasterMesh
+{
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+};
+
+
+// RGBA8 texture with bottom-up rows, sampled like GL_LINEAR + GL_REPEAT on the base level
+class RasterTexture
+{
+public:
+    // converts 3 or 4 channel pixels; returns false for other channel counts
+    bool Create(const unsigned char* pixels, int textureWidth, int textureHeight, int channels)
+    {
+        if (channels != 3 && channels != 4)
+            return false;
+        width = textureWidth;
+        height = textureHeight;
+        texels.resize((size_t)width * height * 4);
+        for (size_t i = 0; i < (size_t)width * height; ++i)
+        {
+            texels[i * 4] = pixels[i * channels];
+            texels[i * 4 + 1] = pixels[i * channels + 1];
+            texels[i * 4 + 2] = pixels[i * channels + 2];
+            texels[i * 4 + 3] = channels == 4 ? pixels[i * channels + 3] : 255;
+        }
+        return true;
+    }
+
+    glm::vec3 Sample(float u, float v) const
+    {
+        float x = u * width - 0.5f;
+        float y = v * height - 0.5f;
+        float floorX = std::floor(x);
+        float floorY = std::floor(y);
+        float fx = x - floorX;
+        float fy = y - floorY;
+        int x0 = wrap((int)floorX, width);
+        int y0 = wrap((int)floorY, height);
+        int x1 = x0 + 1 == width ? 0 : x0 + 1;
+        int y1 = y0 + 1 == height ? 0 : y0 + 1;
+
+        const unsigned char* t00 = &texels[((size_t)y0 * width + x0) * 4];
+        const unsigned char* t10 = &texels[((size_t)y0 * width + x1) * 4];
+        const unsigned char* t01 = &texels[((size_t)y1 * width + x0) * 4];
+        const unsigned char* t11 = &texels[((size_t)y1 * width + x1) * 4];
+        glm::vec3 color;
+        for (int c = 0; c < 3; ++c)
+        {
+            float top = t00[c] + (t10[c] - t00[c]) * fx;
+            float bottom = t01[c] + (t11[c] - t01[c]) * fx;
+            color[c] = (top + (bottom - top) * fy) * (1.0f / 255.0f);
+        }
+        return color;
+    }
+
+private:
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> texels;
+
+    static int wrap(int i, int size)
+    {
+        i %= size;
+        return i < 0 ? i + size : i;
+    }
+};
+
+
+// Per-frame constants, the values the FrameData uniform block holds on the GL path
+struct RasterFrame
+{
+    glm::mat4 viewProjection;
+    PhongLights lights;
+    glm::vec2 uvScale;
+};
+
+
+// Times of the phases of the last frame, in milliseconds
+struct RasterStats
+{
+    double setupMs;
+    double binMs;
+    double rasterMs;
+    size_t triangles; // after clipping and trivial rejection
+};
+
+class SoftwareRasterizer
+{
+public:
+    void Resize(int frameWidth, int frameHeight)
+    {
+        width = frameWidth;
+        height = frameHeight;
+        tilesX = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+        tilesY = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+        bins.assign((size_t)tilesX * tilesY, std::vector<const Triangle*>());
+        color.assign((size_t)width * height * 4, 0);
+        depth.assign((size_t)width * height, 1.0f);
+        visible.assign((size_t)width * height, nullptr);
+        barycentrics.assign((size_t)width * height * 2, 0.0f);
+    }
+
+    // starts a frame with the given constants; the frame is cleared to black when it is rendered
+    void BeginFrame(const RasterFrame& rasterFrame)
+    {
+        frame = rasterFrame;
+        draws.clear();
+    }
+
+    // queues a mesh; a null texture draws it unlit white like the lamp shader
+    void Draw(const RasterMesh* mesh, const RasterTexture* texture, const glm::mat4& model)
+    {
+        if (mesh)
+            draws.push_back({ mesh, texture, model });
+    }
+
+    // renders the queued draws
+    void Render(JobSystem& jobs)
+    {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+
+        if (drawTriangles.size() < draws.size())
+            drawTriangles.resize(draws.size());
+        jobs.ParallelFor((int)draws.size(), 1, [this](int first, int last)
+        {
+            std::vector<ClipVertex> vertices;
+            for (int d = first; d < last; ++d)
+                setupDraw(draws[d], vertices, drawTriangles[d]);
+        });
+        Clock::time_point setupDone = Clock::now();
+
+        // draw order is kept inside every bin, so results don't depend on the thread count
+        stats.triangles = 0;
+        for (std::vector<const Triangle*>& bin : bins)
+            bin.clear();
+        for (size_t d = 0; d < draws.size(); ++d)
+        {
+            stats.triangles += drawTriangles[d].size();
+            for (const Triangle& triangle : drawTriangles[d])
+            {
+                for (int ty = triangle.minY / RASTER_TILE_SIZE; ty <= triangle.maxY / RASTER_TILE_SIZE; ++ty)
+                    for (int tx = triangle.minX / RASTER_TILE_SIZE; tx <= triangle.maxX / RASTER_TILE_SIZE; ++tx)
+                        bins[(size_t)ty * tilesX + tx].push_back(&triangle);
+            }
+        }
+        Clock::time_point binDone = Clock::now();
+
+        jobs.ParallelFor(tilesX * tilesY, 1, [this](int first, int last)
+        {
+            ShadingBatch batch;
+            for (int tile = first; tile < last; ++tile)
+                renderTile(tile, batch);
+        });
+        Clock::time_point rasterDone = Clock::now();
+
+        stats.setupMs = std::chrono::duration<double, std::milli>(setupDone - start).count();
+        stats.binMs = std::chrono::duration<double, std::milli>(binDone - setupDone).count();
+        stats.rasterMs = std::chrono::duration<double, std::milli>(rasterDone - binDone).count();
+    }
+
+    const unsigned char* Pixels() const { return color.data(); }
+    int Width() const { return width; }
+    int Height() const { return height; }
+    const RasterStats& Stats() const { return stats; }
+
+private:
+    struct DrawCall
+    {
+        const RasterMesh* mesh;
+        const RasterTexture* texture;
+        glm::mat4 model;
+    };
+
+    struct ClipVertex
+    {
+        glm::vec4 clip;
+        glm::vec3 position; // world space
+        glm::vec3 normal;   // world space, not normalized
+        glm::vec2 uv;
+    };
+
+    // a clipped triangle ready for rasterization; attributes are interpolated perspective-correct
+    struct Triangle
+    {
+        float x[3], y[3];   // window coordinates
+        float z[3];         // depth in [0, 1]
+        float invW[3];
+        glm::vec3 position[3];
+        glm::vec3 normal[3];
+        glm::vec2 uv[3];
+        const RasterTexture* texture;
+        int minX, minY, maxX, maxY; // pixel bounds, clamped to the frame
+    };
+
+    // visible lit fragments of one tile in SoA form, shaded together
+    struct ShadingBatch
+    {
+        std::vector<float> attributes[9]; // position xyz, normal xyz, texture rgb (overwritten with the result)
+        std::vector<size_t> pixels;
+
+        void Reserve(size_t count)
+        {
+            for (std::vector<float>& attribute : attributes)
+                attribute.resize(count);
+            pixels.resize(count);
+        }
+    };
+
+    int width = 0;
+    int height = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    RasterFrame frame;
+    RasterStats stats = {};
+    std::vector<DrawCall> draws;
+    std::vector<std::vector<Triangle>> drawTriangles;   // per draw, reused between frames
+    std::vector<std::vector<const Triangle*>> bins;     // per tile
+    std::vector<unsigned char> color;
+    std::vector<float> depth;
+    std::vector<const Triangle*> visible;               // nearest triangle per pixel
+    std::vector<float> barycentrics;                    // its perspective-correct weights of vertices 1 and 2
+
+    void setupDraw(const DrawCall& draw, std::vector<ClipVertex>& vertices, std::vector<Triangle>& triangles)
+    {
+        triangles.clear();
+        const RasterMesh& mesh = *draw.mesh;
+        glm::mat4 modelViewProjection = frame.viewProjection * draw.model;
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(draw.model)));
+
+        size_t vertexCount = mesh.vertices.size() / RASTER_FLOATS_PER_VERTEX;
+        vertices.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            const float* v = &mesh.vertices[i * RASTER_FLOATS_PER_VERTEX];
+            glm::vec4 position(v[0], v[1], v[2], 1.0f);
+            ClipVertex& out = vertices[i];
+            out.clip = modelViewProjection * position;
+            out.position = glm::vec3(draw.model * position);
+            out.normal = normalMatrix * glm::vec3(v[3], v[4], v[5]);
+            out.uv = glm::vec2(v[6], v[7]) * frame.uvScale;
+        }
+
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            const ClipVertex* corners[3] = { &vertices[mesh.indices[i]], &vertices[mesh.indices[i + 1]], &vertices[mesh.indices[i + 2]] };
+
+            // trivially reject triangles entirely outside one of the clip planes
+            bool outside = false;
+            for (int axis = 0; axis < 3 && !outside; ++axis)
+            {
+                outside = (corners[0]->clip[axis] > corners[0]->clip.w && corners[1]->clip[axis] > corners[1]->clip.w && corners[2]->clip[axis] > corners[2]->clip.w)
+                    || (corners[0]->clip[axis] < -corners[0]->clip.w && corners[1]->clip[axis] < -corners[1]->clip.w && corners[2]->clip[axis] < -corners[2]->clip.w);
+            }
+            if (outside)
+                continue;
+
+            // clip against the near plane (z >= -w); the others are handled by the screen bounds and the depth range
+            ClipVertex polygon[4];
+            int count = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                const ClipVertex& a = *corners[k];
+                const ClipVertex& b = *corners[(k + 1) % 3];
+                float da = a.clip.z + a.clip.w;
+                float db = b.clip.z + b.clip.w;
+                if (da >= 0.0f)
+                    polygon[count++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f))
+                {
+                    float t = da / (da - db);
+                    ClipVertex& c = polygon[count++];
+                    c.clip = glm::mix(a.clip, b.clip, t);
+                    c.position = glm::mix(a.position, b.position, t);
+                    c.normal = glm::mix(a.normal, b.normal, t);
+                    c.uv = glm::mix(a.uv, b.uv, t);
+                }
+            }
+            for (int k = 1; k + 1 < count; ++k)
+                setupTriangle(polygon[0], polygon[k], polygon[k + 1], draw.texture, triangles);
+        }
+    }
+
+    void setupTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, const RasterTexture* texture, std::vector<Triangle>& triangles)
+    {
+        Triangle triangle;
+        const ClipVertex* corners[3] = { &a, &b, &c };
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+        for (int k = 0; k < 3; ++k)
+        {
+            const ClipVertex& v = *corners[k];
+            float invW = 1.0f / v.clip.w;
+            triangle.x[k] = (v.clip.x * invW * 0.5f + 0.5f) * width;
+            triangle.y[k] = (v.clip.y * invW * 0.5f + 0.5f) * height;
+            triangle.z[k] = v.clip.z * invW * 0.5f + 0.5f;
+            triangle.invW[k] = invW;
+            triangle.position[k] = v.position;
+            triangle.normal[k] = v.normal;
+            triangle.uv[k] = v.uv;
+            minX = std::min(minX, triangle.x[k]);
+            minY = std::min(minY, triangle.y[k]);
+            maxX = std::max(maxX, triangle.x[k]);
+            maxY = std::max(maxY, triangle.y[k]);
+        }
+
+        float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) - (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+        if (area == 0.0f || !(area == area))
+            return;
+
+        // pixels whose center (x + 0.5, y + 0.5) can be covered
+        triangle.minX = std::max(0, (int)std::ceil(minX - 0.5f));
+        triangle.minY = std::max(0, (int)std::ceil(minY - 0.5f));
+        triangle.maxX = std::min(width - 1, (int)std::floor(maxX - 0.5f));
+        triangle.maxY = std::min(height - 1, (int)std::floor(maxY - 0.5f));
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+            return;
+
+        triangle.texture = texture;
+        triangles.push_back(triangle);
+    }
+
+    void renderTile(int tile, ShadingBatch& batch)
+    {
+        int tileX = (tile % tilesX) * RASTER_TILE_SIZE;
+        int tileY = (tile / tilesX) * RASTER_TILE_SIZE;
+        int tileEndX = std::min(tileX + RASTER_TILE_SIZE, width);
+        int tileEndY = std::min(tileY + RASTER_TILE_SIZE, height);
+
+        for (int y = tileY; y < tileEndY; ++y)
+        {
+            std::fill(depth.begin() + (size_t)y * width + tileX, depth.begin() + (size_t)y * width + tileEndX, 1.0f);
+            std::fill(visible.begin() + (size_t)y * width + tileX, visible.begin() + (size_t)y * width + tileEndX, nullptr);
+        }
+
+        for (const Triangle* triangle : bins[tile])
+            rasterize(*triangle, tileX, tileY, tileEndX, tileEndY);
+
+        // background is black and lamps are white; everything else is interpolated and gathered for lighting
+        batch.Reserve((size_t)RASTER_TILE_SIZE * RASTER_TILE_SIZE);
+        size_t count = 0;
+        for (int y = tileY; y < tileEndY; ++y)
+        {
+            for (int x = tileX; x < tileEndX; ++x)
+            {
+                size_t pixel = (size_t)y * width + x;
+                const Triangle* t = visible[pixel];
+                if (!t || !t->texture)
+                {
+                    writePixel(pixel, glm::vec3(t ? 1.0f : 0.0f));
+                    continue;
+                }
+
+                float b1 = barycentrics[pixel * 2], b2 = barycentrics[pixel * 2 + 1];
+                float b0 = 1.0f - b1 - b2;
+                glm::vec3 position = t->position[0] * b0 + t->position[1] * b1 + t->position[2] * b2;
+                glm::vec3 normal = t->normal[0] * b0 + t->normal[1] * b1 + t->normal[2] * b2;
+                glm::vec2 uv = t->uv[0] * b0 + t->uv[1] * b1 + t->uv[2] * b2;
+                glm::vec3 texel = t->texture->Sample(uv.x, uv.y);
+                for (int c = 0; c < 3; ++c)
+                {
+                    batch.attributes[c][count] = position[c];
+                    batch.attributes[3 + c][count] = normal[c];
+                    batch.attributes[6 + c][count] = texel[c];
+                }
+                batch.pixels[count++] = pixel;
+            }
+        }
+
+        PhongFragments fragments = {
+            batch.attributes[0].data(), batch.attributes[1].data(), batch.attributes[2].data(),
+            batch.attributes[3].data(), batch.attributes[4].data(), batch.attributes[5].data(),
+            batch.attributes[6].data(), batch.attributes[7].data(), batch.attributes[8].data() };
+        PhongOutput result = { batch.attributes[6].data(), batch.attributes[7].data(), batch.attributes[8].data() };
+        ShadePhongBatch(frame.lights, fragments, count, result);
+        for (size_t i = 0; i < count; ++i)
+            writePixel(batch.pixels[i], glm::vec3(result.r[i], result.g[i], result.b[i]));
+    }
+
+    void writePixel(size_t pixel, const glm::vec3& value)
+    {
+        unsigned char* out = &color[pixel * 4];
+        for (int c = 0; c < 3; ++c)
+            out[c] = (unsigned char)(std::min(std::max(value[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+        out[3] = 255;
+    }
+
+    // depth tests the triangle's pixels inside the tile and records the nearest ones
+    void rasterize(const Triangle& t, int tileX, int tileY, int tileEndX, int tileEndY)
+    {
+        int minX = std::max(t.minX, tileX);
+        int minY = std::max(t.minY, tileY);
+        int maxX = std::min(t.maxX, tileEndX - 1);
+        int maxY = std::min(t.maxY, tileEndY - 1);
+        if (minX > maxX || minY > maxY)
+            return;
+
+        // edge k is opposite vertex k; E_k(x, y) is linear, so it steps by a constant per pixel
+        float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+        float sign = area > 0.0f ? 1.0f : -1.0f; // both windings are drawn, like the GL path without face culling
+        float inverseArea = 1.0f / (area * sign);
+        float stepX[3], stepY[3], rowStart[3];
+        float startX = minX + 0.5f;
+        float startY = minY + 0.5f;
+        for (int k = 0; k < 3; ++k)
+        {
+            int a = (k + 1) % 3;
+            int b = (k + 2) % 3;
+            stepX[k] = -(t.y[b] - t.y[a]) * sign;
+            stepY[k] = (t.x[b] - t.x[a]) * sign;
+            rowStart[k] = ((t.x[b] - t.x[a]) * (startY - t.y[a]) - (t.y[b] - t.y[a]) * (startX - t.x[a])) * sign;
+        }
+
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float e0 = rowStart[0], e1 = rowStart[1], e2 = rowStart[2];
+            for (int x = minX; x <= maxX; ++x, e0 += stepX[0], e1 += stepX[1], e2 += stepX[2])
+            {
+                if (e0 < 0.0f || e1 < 0.0f || e2 < 0.0f)
+                    continue;
+
+                float l0 = e0 * inverseArea, l1 = e1 * inverseArea, l2 = e2 * inverseArea;
+                float z = l0 * t.z[0] + l1 * t.z[1] + l2 * t.z[2];
+                size_t pixel = (size_t)y * width + x;
+                if (z >= depth[pixel] || z < 0.0f)
+                    continue;
+
+                // perspective-correct weights for the attributes
+                float w0 = l0 * t.invW[0], w1 = l1 * t.invW[1], w2 = l2 * t.invW[2];
+                float inverseSum = 1.0f / (w0 + w1 + w2);
+                depth[pixel] = z;
+                visible[pixel] = &t;
+                barycentrics[pixel * 2] = w1 * inverseSum;
+                barycentrics[pixel * 2 + 1] = w2 * inverseSum;
+            }
+            for (int k = 0; k < 3; ++k)
+                rowStart[k] += stepY[k];
+        }
+    }
+};
+#endif
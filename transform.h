@@ -0,0 +1,274 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <cmath>
+#include <vector>
+
+// SSE is always available on x64 (and on x86 builds compiled with /arch:SSE2)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// Index of a node stored inside a TransformHierarchy (stays valid when the nodes are re-sorted)
+typedef int TransformHandle;
+const TransformHandle INVALID_TRANSFORM = -1;
+
+
+// out = a * b for column-major 4x4 matrices
+inline void MultiplyMatrix4(const float* a, const float* b, float* out)
+{
+#ifdef TRANSFORM_USE_SSE
+    __m128 a0 = _mm_loadu_ps(a);
+    __m128 a1 = _mm_loadu_ps(a + 4);
+    __m128 a2 = _mm_loadu_ps(a + 8);
+    __m128 a3 = _mm_loadu_ps(a + 12);
+    for (int c = 0; c < 4; ++c)
+    {
+        // each output column is a linear combination of the columns of a
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[c * 4 + 0]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[c * 4 + 1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[c * 4 + 2])));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[c * 4 + 3])));
+        _mm_storeu_ps(out + c * 4, r);
+    }
+#else
+    float r[16];
+    for (int c = 0; c < 4; ++c)
+        for (int row = 0; row < 4; ++row)
+            r[c * 4 + row] = a[row] * b[c * 4] + a[4 + row] * b[c * 4 + 1] + a[8 + row] * b[c * 4 + 2] + a[12 + row] * b[c * 4 + 3];
+    for (int i = 0; i < 16; ++i)
+        out[i] = r[i];
+#endif
+}
+
+
+// Stores the translate/rotate/scale of every scene object together with its cached local and world matrices.
+// Data is kept as structure-of-arrays, sorted so every parent comes before its children (grouped by depth),
+// which lets Update walk the arrays linearly and only recompute nodes that changed or whose parent changed.
+class TransformHierarchy
+{
+public:
+    // creates a node; a parent must be created before any of its children
+    TransformHandle Create(const glm::vec3& position, float angle, const glm::vec3& axis, const glm::vec3& scale, TransformHandle parent = INVALID_TRANSFORM)
+    {
+        int parentSlot = parent == INVALID_TRANSFORM ? -1 : handleToSlot[parent];
+        int nodeDepth = parentSlot < 0 ? 0 : depth[parentSlot] + 1;
+
+        // appending keeps the arrays sorted unless the new node is shallower than the last one
+        if (!depth.empty() && nodeDepth < depth.back())
+            needsSort = true;
+
+        TransformHandle handle = (TransformHandle)handleToSlot.size();
+        handleToSlot.push_back((int)slotToHandle.size());
+        slotToHandle.push_back(handle);
+        parents.push_back(parentSlot);
+        depth.push_back(nodeDepth);
+        positions.push_back(position);
+        rotations.push_back(axisAngleToQuaternion(angle, axis));
+        scales.push_back(scale);
+        dirty.push_back(1);
+        changed.push_back(0);
+        localMatrices.push_back(glm::mat4(1.0f));
+        worldMatrices.push_back(glm::mat4(1.0f));
+        levelsValid = false;
+        return handle;
+    }
+
+    void SetPosition(TransformHandle handle, const glm::vec3& position)
+    {
+        int slot = handleToSlot[handle];
+        positions[slot] = position;
+        dirty[slot] = 1;
+    }
+
+    void SetRotation(TransformHandle handle, float angle, const glm::vec3& axis)
+    {
+        int slot = handleToSlot[handle];
+        rotations[slot] = axisAngleToQuaternion(angle, axis);
+        dirty[slot] = 1;
+    }
+
+    void SetScale(TransformHandle handle, const glm::vec3& scale)
+    {
+        int slot = handleToSlot[handle];
+        scales[slot] = scale;
+        dirty[slot] = 1;
+    }
+
+    const glm::vec3& GetPosition(TransformHandle handle) const
+    {
+        return positions[handleToSlot[handle]];
+    }
+
+    // returns the world matrix computed by the last Update
+    const glm::mat4& GetWorldMatrix(TransformHandle handle) const
+    {
+        return worldMatrices[handleToSlot[handle]];
+    }
+
+    // true when the last Update recomputed the node's world matrix (it or an ancestor moved)
+    bool Changed(TransformHandle handle) const
+    {
+        return changed[handleToSlot[handle]] != 0;
+    }
+
+    int Count() const
+    {
+        return (int)positions.size();
+    }
+
+    // recomputes the local and world matrices of dirty nodes, one depth level after another
+    void Update()
+    {
+        PrepareUpdate();
+        for (size_t level = 0; level + 1 < levelStart.size(); ++level)
+            UpdateRange(levelStart[level], levelStart[level + 1]);
+    }
+
+    // sorts the nodes if needed and computes the depth level ranges; call before UpdateRange
+    void PrepareUpdate()
+    {
+        if (needsSort)
+            sortByDepth();
+        if (!levelsValid)
+            buildLevels();
+    }
+
+    // number of depth levels; every range [LevelBegin(i), LevelEnd(i)) only depends on earlier levels
+    int LevelCount() const { return (int)levelStart.size() - 1; }
+    int LevelBegin(int level) const { return levelStart[level]; }
+    int LevelEnd(int level) const { return levelStart[level + 1]; }
+
+    // updates the slots [begin, end); their parents must already be up to date
+    void UpdateRange(int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            int parent = parents[i];
+            bool parentChanged = parent >= 0 && changed[parent];
+            changed[i] = 0;
+            if (!dirty[i] && !parentChanged)
+                continue;
+
+            if (dirty[i])
+            {
+                composeLocalMatrix(i);
+                dirty[i] = 0;
+            }
+
+            if (parent >= 0)
+                MultiplyMatrix4(&worldMatrices[parent][0][0], &localMatrices[i][0][0], &worldMatrices[i][0][0]);
+            else
+                worldMatrices[i] = localMatrices[i];
+
+            changed[i] = 1;
+        }
+    }
+
+private:
+    // slot indirection so handles stay stable when the arrays are re-sorted
+    std::vector<int> handleToSlot;
+    std::vector<TransformHandle> slotToHandle;
+
+    // structure-of-arrays node data, indexed by slot
+    std::vector<int> parents;               // parent slot or -1
+    std::vector<int> depth;                 // number of ancestors
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec4> rotations;       // unit quaternion (x, y, z, w)
+    std::vector<glm::vec3> scales;
+    std::vector<unsigned char> dirty;       // local values changed since the last update
+    std::vector<unsigned char> changed;     // world matrix recomputed during the current update
+    std::vector<glm::mat4> localMatrices;
+    std::vector<glm::mat4> worldMatrices;
+
+    std::vector<int> levelStart;            // first slot of every depth level, plus the end
+    bool needsSort = false;
+    bool levelsValid = false;
+
+    static glm::vec4 axisAngleToQuaternion(float angle, const glm::vec3& axis)
+    {
+        glm::vec3 n = glm::normalize(axis);
+        float s = std::sin(angle * 0.5f);
+        return glm::vec4(n.x * s, n.y * s, n.z * s, std::cos(angle * 0.5f));
+    }
+
+    // local = translate(position) * rotate(quaternion) * scale(scale)
+    void composeLocalMatrix(int i)
+    {
+        const glm::vec4& q = rotations[i];
+        const glm::vec3& s = scales[i];
+        const glm::vec3& p = positions[i];
+        float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+        float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+        float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+        glm::mat4& m = localMatrices[i];
+        m[0] = glm::vec4((1.0f - 2.0f * (yy + zz)) * s.x, 2.0f * (xy + wz) * s.x, 2.0f * (xz - wy) * s.x, 0.0f);
+        m[1] = glm::vec4(2.0f * (xy - wz) * s.y, (1.0f - 2.0f * (xx + zz)) * s.y, 2.0f * (yz + wx) * s.y, 0.0f);
+        m[2] = glm::vec4(2.0f * (xz + wy) * s.z, 2.0f * (yz - wx) * s.z, (1.0f - 2.0f * (xx + yy)) * s.z, 0.0f);
+        m[3] = glm::vec4(p.x, p.y, p.z, 1.0f);
+    }
+
+    // counting sort by depth, keeping creation order within a level
+    void sortByDepth()
+    {
+        int count = Count();
+        int maxDepth = 0;
+        for (int i = 0; i < count; ++i)
+            maxDepth = depth[i] > maxDepth ? depth[i] : maxDepth;
+
+        std::vector<int> offsets(maxDepth + 2, 0);
+        for (int i = 0; i < count; ++i)
+            ++offsets[depth[i] + 1];
+        for (int d = 0; d <= maxDepth; ++d)
+            offsets[d + 1] += offsets[d];
+
+        std::vector<int> newSlot(count);
+        for (int i = 0; i < count; ++i)
+            newSlot[i] = offsets[depth[i]]++;
+
+        permute(parents, newSlot);
+        for (int& parent : parents)
+            parent = parent < 0 ? -1 : newSlot[parent];
+        permute(slotToHandle, newSlot);
+        permute(depth, newSlot);
+        permute(positions, newSlot);
+        permute(rotations, newSlot);
+        permute(scales, newSlot);
+        permute(dirty, newSlot);
+        permute(changed, newSlot);
+        permute(localMatrices, newSlot);
+        permute(worldMatrices, newSlot);
+        for (int slot = 0; slot < count; ++slot)
+            handleToSlot[slotToHandle[slot]] = slot;
+
+        needsSort = false;
+        levelsValid = false;
+    }
+
+    template <typename T>
+    static void permute(std::vector<T>& values, const std::vector<int>& newSlot)
+    {
+        std::vector<T> sorted(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            sorted[newSlot[i]] = values[i];
+        values.swap(sorted);
+    }
+
+    void buildLevels()
+    {
+        levelStart.clear();
+        levelStart.push_back(0);
+        for (int i = 1; i < Count(); ++i)
+            if (depth[i] != depth[i - 1])
+                levelStart.push_back(i);
+        if (Count() > 0)
+            levelStart.push_back(Count());
+        levelsValid = true;
+    }
+};
+#endif
@@ -0,0 +1,167 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Vertex layouts a mesh can be uploaded with. Every generator produces FULL vertices
+// (8 floats: position, normal, texture coordinate) which are then converted.
+enum VertexFormat
+{
+    VERTEX_FORMAT_FULL,         // 32 bytes: vec3 position, vec3 normal, vec2 uv (floats)
+    VERTEX_FORMAT_COMPACT,      // 20 bytes: vec3 float position, 2x snorm16 octahedral normal, 2x half uv
+    VERTEX_FORMAT_QUANTIZED     // 16 bytes: 3x unorm16 position relative to the mesh bounds (+ padding), normal and uv as COMPACT
+};
+
+struct CompactVertex
+{
+    float position[3];
+    short normal[2];
+    unsigned short uv[2];
+};
+
+struct QuantizedVertex
+{
+    unsigned short position[4]; // w is padding to keep the attributes 4-byte aligned
+    short normal[2];
+    unsigned short uv[2];
+};
+
+
+// size in bytes of one vertex in the given format
+inline size_t VertexStride(VertexFormat format)
+{
+    switch (format)
+    {
+    case VERTEX_FORMAT_COMPACT:
+        return sizeof(CompactVertex);
+    case VERTEX_FORMAT_QUANTIZED:
+        return sizeof(QuantizedVertex);
+    default:
+        return sizeof(float) * 8;
+    }
+}
+
+
+// converts a float to IEEE half precision (round to nearest, overflow clamps to infinity)
+inline unsigned short FloatToHalf(float value)
+{
+    unsigned int bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    unsigned int sign = (bits >> 16) & 0x8000u;
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    unsigned int mantissa = bits & 0x7FFFFFu;
+
+    if (exponent <= 0)
+    {
+        // too small for a normal half: produce a denormal or zero
+        if (exponent < -10)
+            return (unsigned short)sign;
+        mantissa |= 0x800000u;
+        unsigned int shift = (unsigned int)(14 - exponent);
+        unsigned int half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1u)
+            ++half;
+        return (unsigned short)(sign | half);
+    }
+    if (exponent >= 31)
+        return (unsigned short)(sign | 0x7C00u);
+
+    unsigned int half = sign | ((unsigned int)exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000u)
+        ++half; // rounding may carry into the exponent, which is still the correct result
+    return (unsigned short)half;
+}
+
+
+// maps a float in [-1, 1] to a signed normalized 16-bit integer
+inline short FloatToSnorm16(float value)
+{
+    value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+    return (short)std::floor(value * 32767.0f + 0.5f);
+}
+
+
+// maps a float in [0, 1] to an unsigned normalized 16-bit integer
+inline unsigned short FloatToUnorm16(float value)
+{
+    value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+    return (unsigned short)std::floor(value * 65535.0f + 0.5f);
+}
+
+
+// octahedral encoding: projects the unit normal onto an octahedron and unfolds it into the [-1, 1] square;
+// a zero normal (degenerate imported geometry) has no direction and is encoded as +Z
+inline glm::vec2 OctahedralEncode(const glm::vec3& normal)
+{
+    float length = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    if (!(length > 0.0f))
+        return glm::vec2(0.0f);
+    glm::vec3 n = normal / length;
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        e.x = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        e.y = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return e;
+}
+
+
+// converts FULL vertices (8 floats each) to the given format; bounds are only used by VERTEX_FORMAT_QUANTIZED
+inline void EncodeVertices(const float* vertices, size_t vertexCount, VertexFormat format, const glm::vec3& boundsMin, const glm::vec3& boundsMax, std::vector<unsigned char>& out)
+{
+    out.resize(vertexCount * VertexStride(format));
+    if (format == VERTEX_FORMAT_FULL)
+    {
+        if (vertexCount > 0)
+            std::memcpy(out.data(), vertices, out.size());
+        return;
+    }
+
+    // guard against flat meshes (e.g. the plane) where one extent is zero
+    glm::vec3 extent = boundsMax - boundsMin;
+    glm::vec3 inverseExtent(
+        extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+        extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+        extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        const float* v = vertices + i * 8;
+        glm::vec2 octahedral = OctahedralEncode(glm::vec3(v[3], v[4], v[5]));
+        short normal[2] = { FloatToSnorm16(octahedral.x), FloatToSnorm16(octahedral.y) };
+        unsigned short uv[2] = { FloatToHalf(v[6]), FloatToHalf(v[7]) };
+
+        if (format == VERTEX_FORMAT_COMPACT)
+        {
+            CompactVertex vertex;
+            vertex.position[0] = v[0];
+            vertex.position[1] = v[1];
+            vertex.position[2] = v[2];
+            vertex.normal[0] = normal[0];
+            vertex.normal[1] = normal[1];
+            vertex.uv[0] = uv[0];
+            vertex.uv[1] = uv[1];
+            std::memcpy(&out[i * sizeof(vertex)], &vertex, sizeof(vertex));
+        }
+        else
+        {
+            QuantizedVertex vertex;
+            vertex.position[0] = FloatToUnorm16((v[0] - boundsMin.x) * inverseExtent.x);
+            vertex.position[1] = FloatToUnorm16((v[1] - boundsMin.y) * inverseExtent.y);
+            vertex.position[2] = FloatToUnorm16((v[2] - boundsMin.z) * inverseExtent.z);
+            vertex.position[3] = 0;
+            vertex.normal[0] = normal[0];
+            vertex.normal[1] = normal[1];
+            vertex.uv[0] = uv[0];
+            vertex.uv[1] = uv[1];
+            std::memcpy(&out[i * sizeof(vertex)], &vertex, sizeof(vertex));
+        }
+    }
+}
+#endif